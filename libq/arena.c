@@ -0,0 +1,217 @@
+/*
+ * Copyright 2026 Gentoo Foundation
+ * Distributed under the terms of the GNU General Public License v2
+ */
+
+#include "main.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <xalloc.h>
+#ifdef _OPENMP
+# include <omp.h>
+#endif
+
+#include "arena.h"
+
+#define ARENA_BLKSIZE  (64 * 1024)
+#define ARENA_ALIGN    (sizeof(void *) * 2)
+
+typedef struct arena_blk_ arena_blk;
+struct arena_blk_ {
+  arena_blk *next;
+  size_t     size;
+  size_t     used;
+  char       data[];
+};
+
+struct arena_ {
+  arena_blk *blks;     /* head is the block being bumped */
+  size_t     blksize;
+  size_t     used;     /* bytes handed out */
+  size_t     peak;     /* bytes reserved from malloc */
+#ifdef _OPENMP
+  omp_lock_t lock;
+#endif
+};
+
+/* allocates a new arena, blksize 0 selects the default chunk size */
+arena_t *arena_new
+(
+  size_t blksize
+)
+{
+  arena_t *ret = xzalloc(sizeof(*ret));
+  ret->blksize = blksize == 0 ? ARENA_BLKSIZE : blksize;
+#ifdef _OPENMP
+  omp_init_lock(&ret->lock);
+#endif
+  return ret;
+}
+
+static void *arena_get
+(
+  arena_t *a,
+  size_t   len,
+  size_t   align
+)
+{
+  arena_blk *blk = a->blks;
+  size_t     off = 0;
+
+  if (blk != NULL)
+  {
+    off = (blk->used + (align - 1)) & ~(align - 1);
+    if (off + len <= blk->size)
+    {
+      blk->used  = off + len;
+      a->used   += len;
+      return blk->data + off;
+    }
+  }
+
+  if (len > a->blksize / 4)
+  {
+    /* oversized requests get a block of their own, which is queued
+     * behind the current one so its remaining space isn't lost */
+    blk        = xmalloc(sizeof(*blk) + len);
+    blk->size  = len;
+    blk->used  = len;
+    if (a->blks != NULL)
+    {
+      blk->next     = a->blks->next;
+      a->blks->next = blk;
+    }
+    else
+    {
+      blk->next = NULL;
+      a->blks   = blk;
+    }
+  }
+  else
+  {
+    blk        = xmalloc(sizeof(*blk) + a->blksize);
+    blk->size  = a->blksize;
+    blk->used  = len;
+    blk->next  = a->blks;
+    a->blks    = blk;
+  }
+
+  a->used += len;
+  a->peak += sizeof(*blk) + blk->size;
+
+  return blk->data;
+}
+
+/* an arena may be shared between threads and OpenMP tasks, which need
+ * not run inside a parallel region, hence always serialise, using a
+ * lock per arena such that separate arenas don't contend */
+static void *arena_get_locked
+(
+  arena_t *a,
+  size_t   len,
+  size_t   align
+)
+{
+  void *ret;
+
+#ifdef _OPENMP
+  omp_set_lock(&a->lock);
+#endif
+  ret = arena_get(a, len, align);
+#ifdef _OPENMP
+  omp_unset_lock(&a->lock);
+#endif
+
+  return ret;
+}
+
+/* returns len bytes of uninitialised memory aligned for any type */
+void *arena_alloc
+(
+  arena_t *a,
+  size_t   len
+)
+{
+  return arena_get_locked(a, len, ARENA_ALIGN);
+}
+
+/* returns len bytes of zeroed memory aligned for any type */
+void *arena_zalloc
+(
+  arena_t *a,
+  size_t   len
+)
+{
+  void *ret = arena_get_locked(a, len, ARENA_ALIGN);
+  memset(ret, 0, len);
+  return ret;
+}
+
+/* copies len bytes of ptr into the arena and NUL-terminates the result,
+ * such that it can be used to copy (non-terminated) strings */
+void *arena_memdup
+(
+  arena_t    *a,
+  const void *ptr,
+  size_t      len
+)
+{
+  char *ret = arena_get_locked(a, len + 1, 1);
+  memcpy(ret, ptr, len);
+  ret[len] = '\0';
+  return ret;
+}
+
+char *arena_strdup
+(
+  arena_t    *a,
+  const char *str
+)
+{
+  return arena_memdup(a, str, strlen(str));
+}
+
+/* returns the number of bytes handed out by this arena */
+size_t arena_used
+(
+  arena_t *a
+)
+{
+  return a == NULL ? 0 : a->used;
+}
+
+/* returns the number of bytes this arena allocated from the system,
+ * since nothing is returned before arena_free this is also the peak */
+size_t arena_peak
+(
+  arena_t *a
+)
+{
+  return a == NULL ? 0 : a->peak;
+}
+
+/* releases all memory handed out by this arena */
+void arena_free
+(
+  arena_t *a
+)
+{
+  arena_blk *blk;
+  arena_blk *next;
+
+  if (a == NULL)
+    return;
+
+  for (blk = a->blks; blk != NULL; blk = next)
+  {
+    next = blk->next;
+    free(blk);
+  }
+#ifdef _OPENMP
+  omp_destroy_lock(&a->lock);
+#endif
+  free(a);
+}
+
+/* vim: set ts=2 sw=2 expandtab cino+=\:0 foldmethod=marker: */
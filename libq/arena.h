@@ -0,0 +1,25 @@
+/*
+ * Copyright 2026 Gentoo Foundation
+ * Distributed under the terms of the GNU General Public License v2
+ */
+
+#ifndef _ARENA_H
+#define _ARENA_H 1
+
+#include <stdlib.h>
+
+/* bump allocator: memory handed out is only released all at once by
+ * arena_free */
+typedef struct arena_ arena_t;
+arena_t *arena_new(size_t blksize);
+void    *arena_alloc(arena_t *a, size_t len);
+void    *arena_zalloc(arena_t *a, size_t len);
+void    *arena_memdup(arena_t *a, const void *ptr, size_t len);
+char    *arena_strdup(arena_t *a, const char *str);
+size_t   arena_used(arena_t *a);
+size_t   arena_peak(arena_t *a);
+void     arena_free(arena_t *a);
+
+#endif
+
+/* vim: set ts=2 sw=2 expandtab cino+=\:0 foldmethod=marker: */
@@ -15,7 +15,7 @@
 
 #include "array.h"
 
-#define ARRAY_INC_SIZE 32
+#define ARRAY_MIN_SIZE 32
 
 struct array_t {
   void   **eles;
@@ -68,6 +68,28 @@ void array_deepfree
   array_free(arr);
 }
 
+/* ensures the array can hold at least cnt elements without having to
+ * reallocate, growth is geometric so appends are amortised O(1) */
+void array_reserve
+(
+  array  *arr,
+  size_t  cnt
+)
+{
+  size_t siz;
+
+  if (arr == NULL ||
+      cnt <= arr->siz)
+    return;
+
+  siz = arr->siz < ARRAY_MIN_SIZE ? ARRAY_MIN_SIZE : arr->siz;
+  while (siz < cnt)
+    siz *= 2;
+
+  arr->eles = xreallocarray(arr->eles, siz, sizeof(arr->eles[0]));
+  arr->siz  = siz;
+}
+
 /* appends the given pointer to the list, no copying of data takes place
  * returns the pointer */
 void *array_append
@@ -81,14 +103,9 @@ void *array_append
   if (arr == NULL)
     return NULL;
 
+  array_reserve(arr, arr->len + 1);
   n = arr->len++;
 
-  if (arr->len > arr->siz)
-  {
-    arr->siz += ARRAY_INC_SIZE;
-    arr->eles = xrealloc(arr->eles, arr->siz * sizeof(arr->eles[0]));
-  }
-
   arr->sorted = false;
   return arr->eles[n] = data;
 }
@@ -126,22 +143,87 @@ void array_move
   array *src
 )
 {
-  void   *elem;
-  size_t  n;
-
   if (dst == NULL ||
       src == NULL ||
       array_cnt(src) == 0)
     return;
 
-  array_for_each(src, n, elem)
-    array_append(dst, elem);
+  array_reserve(dst, dst->len + src->len);
+  memcpy(&dst->eles[dst->len], src->eles, sizeof(src->eles[0]) * src->len);
+  dst->len   += src->len;
+  dst->sorted = false;
 
   /* we lack an array_clear or something, sofar we didn't really have a
    * need for it, so simply declare the src empty */
   src->len = 0;
 }
 
+/* moves all elements from src into dst like array_move, but assuming
+ * both arrays are sorted according to compar, keeps the result sorted
+ * the merge is stable: on equal elements, those from dst come first */
+void array_merge
+(
+  array           *dst,
+  array           *src,
+  array_compar_cb *compar
+)
+{
+  size_t i;
+  size_t j;
+  size_t k;
+
+  if (dst == NULL ||
+      src == NULL ||
+      array_cnt(src) == 0)
+    return;
+
+  /* merge from the back, such that dst can be filled in place */
+  array_reserve(dst, dst->len + src->len);
+  i = dst->len;
+  j = src->len;
+  k = i + j;
+  while (j > 0)
+  {
+    if (i > 0 &&
+        compar(&dst->eles[i - 1], &src->eles[j - 1]) > 0)
+      dst->eles[--k] = dst->eles[--i];
+    else
+      dst->eles[--k] = src->eles[--j];
+  }
+  dst->len   += src->len;
+  dst->sorted = false;
+  src->len    = 0;
+}
+
+/* retains only the elements for which func returns true, in their
+ * original order, using a single pass over the array
+ * the callback is responsible for releasing the elements it drops
+ * returns the number of elements dropped */
+size_t array_filter
+(
+  array           *arr,
+  array_filter_cb *func,
+  void            *priv
+)
+{
+  size_t i;
+  size_t n;
+
+  if (arr == NULL)
+    return 0;
+
+  for (i = 0, n = 0; i < arr->len; i++)
+  {
+    if (func(arr->eles[i], priv))
+      arr->eles[n++] = arr->eles[i];
+  }
+
+  i        = arr->len - n;
+  arr->len = n;
+
+  return i;
+}
+
 /* removes the given element from the array and returns the pointer to
  * the data removed from the array
  * the caller should ensure the pointer is freed if necessary */
@@ -15,13 +15,17 @@
 typedef struct array_t array;
 typedef void (array_free_cb)(void *priv);
 typedef int (array_compar_cb)(const void *l, const void *r);
+typedef bool (array_filter_cb)(void *elem, void *priv);
 
 array *array_new(void);
 void   array_free(array *arr);
 void   array_deepfree(array *arr, array_free_cb *func);
 void  *array_append(array *arr, void *data);
 void  *array_append_copy(array *arr, const void *data, size_t len);
+void   array_reserve(array *arr, size_t cnt);
 void   array_move(array *dst, array *src);
+void   array_merge(array *dst, array *src, array_compar_cb *func);
+size_t array_filter(array *arr, array_filter_cb *func, void *priv);
 void  *array_remove(array *arr, size_t elem);
 void   array_delete(array *arr, size_t elem, array_free_cb *func);
 size_t array_cnt(array *arr);
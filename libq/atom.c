@@ -68,6 +68,96 @@ const char * const booga[] = {
   "<"
 };
 
+/* version keys {{{
+ * A version key is a byte string such that memcmp on the keys of two
+ * atoms orders them like the PMS version comparison in atom_compare
+ * does, which makes sorting large sets of packages cheap.  The key
+ * consists of
+ * - each numeric component as 0x01, its length and its digits without
+ *   leading zeros, followed by 0x00
+ * - the letter, or 0x00 when absent
+ * - each suffix as its type and big-endian number, up to and including
+ *   the terminating VER_NORM entry
+ * - the revision as big-endian 32-bits number
+ * Since no key is a prefix of another, comparing up to the length of
+ * the shortest key suffices.  Versions for which this doesn't hold
+ * with the comparison in atom_compare, components after the first with
+ * leading zeros, or too large to be compared as integers, get no key,
+ * and are compared the old way. */
+#define ATOM_VERKEY_MAXDIGITS 18  /* fits a long long */
+
+static void atom_verkey_build
+(
+  atom_ctx *a
+)
+{
+  unsigned char  buf[BUFSIZ];
+  const char    *p;
+  const char    *q;
+  atom_suffix   *as;
+  size_t         len = 0;
+  size_t         i;
+  bool           first = true;
+
+  /* numeric components, separated by single dots */
+  for (p = a->PV; ; p = q + 1)
+  {
+    for (q = p; *q >= '0' && *q <= '9'; q++)
+      ;
+    if (q == p)
+      return;
+    if (first)
+    {
+      /* the first component is always compared as integer */
+      while (p < q - 1 && *p == '0')
+        p++;
+      first = false;
+    }
+    else if (*p == '0' && q - p > 1)
+    {
+      /* stringwise comparison, see Algorithm 3.3 */
+      return;
+    }
+    if (q - p > ATOM_VERKEY_MAXDIGITS ||
+        len + 2 + (q - p) + 1 > sizeof(buf))
+      return;
+    buf[len++] = 0x01;
+    buf[len++] = (unsigned char)(q - p);
+    memcpy(buf + len, p, q - p);
+    len += q - p;
+    if (*q != '.')
+      break;
+  }
+  buf[len++] = 0x00;
+
+  /* anything after the letter is a suffix, which are parsed already,
+   * but further dots would be seen as components by atom_compare */
+  if (a->letter != '\0')
+    q++;
+  if (strchr(q, '.') != NULL)
+    return;
+  buf[len++] = (unsigned char)a->letter;
+
+  for (as = a->suffixes; ; as++)
+  {
+    if (len + 1 + sizeof(as->sint) + sizeof(a->PR_int) > sizeof(buf))
+      return;
+    buf[len++] = (unsigned char)as->suffix;
+    for (i = sizeof(as->sint); i-- > 0; )
+      buf[len++] = (unsigned char)(as->sint >> (i * 8));
+    if (as->suffix == VER_NORM)
+      break;
+  }
+
+  for (i = sizeof(a->PR_int); i-- > 0; )
+    buf[len++] = (unsigned char)(a->PR_int >> (i * 8));
+
+  a->verkey     = xmalloc(len);
+  a->verkey_len = len;
+  memcpy(a->verkey, buf, len);
+}
+/* }}} */
+
 /* split string into individual components, known as an atom
  * for a definition of which variable contains what, see:
  * https://projects.gentoo.org/pms/latest/pms.html#names-and-versions */
@@ -488,6 +578,8 @@ atom_ctx *atom_explode_cat
     ret->suffixes[idx]  = t;
   }
 
+  atom_verkey_build(ret);
+
   return ret;
 }
 
@@ -602,6 +694,13 @@ atom_ctx *atom_clone
     memcpy(ret->suffixes, a->suffixes, sizeof(ret->suffixes[0]) * slen);
   }
 
+  if (a->verkey != NULL)
+  {
+    ret->verkey     = xmalloc(a->verkey_len);
+    ret->verkey_len = a->verkey_len;
+    memcpy(ret->verkey, a->verkey, a->verkey_len);
+  }
+
   if (a->usedeps)
   {
     atom_usedep *w;
@@ -639,6 +738,7 @@ void atom_implode
     a->usedeps = n;
   }
   free(a->suffixes);
+  free(a->verkey);
   free(a);
 }
 
@@ -879,9 +979,26 @@ atom_equality atom_compare_flg
       ver_bits |= (1 << 2);
   }
 
-  /* check version */
-  if (data->PV &&
-      query->PV)
+  /* check version, using the keys when both have one, and the
+   * comparison doesn't involve globbing, the revision (the last
+   * bytes of the key) is handled below in both cases */
+  if (data->verkey != NULL &&
+      query->verkey != NULL &&
+      sfx_op != ATOM_OP_STAR)
+  {
+    size_t len = data->verkey_len < query->verkey_len ?
+                 data->verkey_len : query->verkey_len;
+    int    cmp;
+
+    cmp = memcmp(data->verkey, query->verkey,
+                 len - sizeof(data->PR_int));
+    if (cmp < 0)
+      return _atom_compare_match(OLDER, pfx_op);
+    else if (cmp > 0)
+      return _atom_compare_match(NEWER, pfx_op);
+  }
+  else if (data->PV &&
+           query->PV)
   {
     char              *s1;
     char              *ends1;
@@ -889,6 +1006,7 @@ atom_equality atom_compare_flg
     char              *ends2;
     long long          n1;
     long long          n2;
+    int                cmp;
     const atom_suffix *as1;
     const atom_suffix *as2;
 
@@ -975,19 +1093,16 @@ atom_equality atom_compare_flg
           if (*s1 == '0' ||
               *s2 == '0')
           {  /* 3.3#L1 */
-            /* find end of component */
+            /* find end of component, a trailing letter isn't part
+             * of it, that is compared in step 3 */
             for (ends1 = s1;
-                 (*ends1 != '\0' &&
-                  *ends1 != '.' &&
-                  *ends1 != '_');
+                 isdigit((unsigned char)*ends1);
                  ends1++)
               ;
             if (ends1 != s1)
               ends1--;
             for (ends2 = s2;
-                 (*ends2 != '\0' &&
-                  *ends2 != '.' &&
-                  *ends2 != '_');
+                 isdigit((unsigned char)*ends2);
                  ends2++)
               ;
             if (ends2 != s2)
@@ -997,16 +1112,19 @@ atom_equality atom_compare_flg
             if (ends1 - s1 > 1 ||
                 ends2 - s2 > 1)
             {
-              /* 3.3L2-3: remove *trailing* zeros */
-              for (; ends1 > s1 && *ends1 == '0'; ends1--)
+              /* 3.3L2-3: remove *trailing* zeros, ends point to the
+               * last character, so the lengths are one more */
+              n1 = ends1 - s1 + 1;
+              n2 = ends2 - s2 + 1;
+              for (; n1 > 0 && s1[n1 - 1] == '0'; n1--)
                 ;
-              for (; ends2 > s2 && *ends2 == '0'; ends2--)
+              for (; n2 > 0 && s2[n2 - 1] == '0'; n2--)
                 ;
-              /* 3.3L4 ASCII stringwise comparison */
-              n1 = ends1 - s1;
-              n2 = ends2 - s2;
-              n1 = strncmp(s1, s2, n1 > n2 ? n1 : n2);
-              n2 = 0;
+              /* 3.3L4 ASCII stringwise comparison, where a string
+               * that is a prefix of the other sorts first */
+              cmp = strncmp(s1, s2, n1 < n2 ? n1 : n2);
+              n1  = cmp != 0 ? cmp : n1 - n2;
+              n2  = 0;
             }
             else
             {
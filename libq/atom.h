@@ -91,6 +91,8 @@ typedef struct {
   atom_slotdep  slotdep;
   char         *REPO;
   unsigned int  BUILDID;
+  unsigned char *verkey;     /* memcmp-able PV and PR, if representable */
+  size_t        verkey_len;
 } atom_ctx;
 /* backwards compat definition */
 typedef atom_ctx depend_atom;
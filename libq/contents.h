@@ -24,7 +24,10 @@ typedef struct {
 	long mtime;
 } contents_entry;
 
+contents_entry *contents_parse_line_len_r(
+		contents_entry *e, char *line, size_t len);
 contents_entry *contents_parse_line_len(char *line, size_t len);
+#define contents_parse_line_r(E, L) contents_parse_line_len_r(E, L, strlen(L))
 #define contents_parse_line(L) contents_parse_line_len(L, strlen(L))
 
 #endif
@@ -1,5 +1,5 @@
 /*
- * Copyright 2018-2024 Gentoo Foundation
+ * Copyright 2018-2026 Gentoo Foundation
  * Distributed under the terms of the GNU General Public License v2
  *
  * Copyright 2018-     Fabian Groffen  - <grobian@gentoo.org>
@@ -12,7 +12,15 @@
 
 #include "main.h"
 
+#ifdef _OPENMP
+# include <omp.h>
+#endif
+#include <time.h>
+#include <xalloc.h>
+
+#include "arena.h"
 #include "hash.h"
+#include "hash_x86.h"
 
 void
 hash_hex(char *out, const unsigned char *buf, const int length)
@@ -92,11 +100,27 @@ hash_hex(char *out, const unsigned char *buf, const int length)
 /* len func(dest,destlen,cbctx) */
 typedef size_t (*read_cb)(char *,size_t,void *);
 
-static size_t read_stdio(char *dest, size_t destlen, void *ctx)
+/* reads straight from a file descriptor, unlike stdio this needs no
+ * allocations, any error is kept in err */
+struct fdctx {
+	int fd;
+	int err;
+};
+
+static size_t read_fd(char *dest, size_t destlen, void *ctx)
 {
-	FILE *io = ctx;
+	struct fdctx *fdc = ctx;
+	ssize_t       rd;
+
+	do {
+		rd = read(fdc->fd, dest, destlen);
+	} while (rd < 0 && errno == EINTR);
+	if (rd < 0) {
+		fdc->err = errno;
+		return 0;
+	}
 
-	return fread(dest, 1, destlen, io);
+	return (size_t)rd;
 }
 
 struct bufctx {
@@ -122,6 +146,264 @@ static size_t read_buffer(char *dest, size_t destlen, void *ctx)
 	return readlen;
 }
 
+/* block functions for the hashes that have alternative implementations,
+ * these are selected once by hash_select_impls */
+typedef void (*sha1_update_fn)(const void *, size_t, struct sha1_ctx *);
+typedef void (*sha256_update_fn)(const void *, size_t, struct sha256_ctx *);
+
+static struct hash_impls_sel {
+	bool              selected;
+	sha1_update_fn    sha1;
+	const char       *sha1_name;
+	sha256_update_fn  sha256;
+	const char       *sha256_name;
+} hash_impls_sel;
+
+/* state for all of the hashes computed over a single input */
+struct hash_state {
+	int               hashes;
+	sha1_update_fn    sha1_update;
+	sha256_update_fn  sha256_update;
+	struct md5_ctx    m5;
+	struct sha1_ctx   s1;
+	struct sha256_ctx s256;
+	struct sha512_ctx s512;
+#ifdef HAVE_BLAKE2B
+	blake2b_state     bl2b;
+#endif
+};
+
+static bool hash_selftest_impls(sha1_update_fn, sha256_update_fn);
+
+/* picks the fastest implementation the CPU supports and passes the
+ * self-test, falling back to the portable gnulib code otherwise */
+static void
+hash_select_impls(void)
+{
+#pragma omp critical (hash_select)
+	{
+		if (!hash_impls_sel.selected) {
+			hash_impls_sel.sha1        = sha1_process_bytes;
+			hash_impls_sel.sha1_name   = "generic";
+			hash_impls_sel.sha256      = sha256_process_bytes;
+			hash_impls_sel.sha256_name = "generic";
+
+			if (hash_x86_have_shani()) {
+				if (hash_selftest_impls(hash_x86_sha1_process_bytes,
+										hash_x86_sha256_process_bytes))
+				{
+					hash_impls_sel.sha1        = hash_x86_sha1_process_bytes;
+					hash_impls_sel.sha1_name   = "sha-ni";
+					hash_impls_sel.sha256      =
+						hash_x86_sha256_process_bytes;
+					hash_impls_sel.sha256_name = "sha-ni";
+				} else {
+					warn("SHA-NI self-test failed, using generic SHA-1 "
+						 "and SHA-256 implementations");
+				}
+			}
+
+			hash_impls_sel.selected = true;
+		}
+	}
+}
+
+static void
+hash_state_init(struct hash_state *hs, int hashes)
+{
+	hash_select_impls();
+
+	hs->hashes        = hashes;
+	hs->sha1_update   = hash_impls_sel.sha1;
+	hs->sha256_update = hash_impls_sel.sha256;
+	if (hashes & HASH_MD5)
+		md5_init_ctx(&hs->m5);
+	if (hashes & HASH_SHA1)
+		sha1_init_ctx(&hs->s1);
+	if (hashes & HASH_SHA256)
+		sha256_init_ctx(&hs->s256);
+	if (hashes & HASH_SHA512)
+		sha512_init_ctx(&hs->s512);
+#ifdef HAVE_BLAKE2B
+	if (hashes & HASH_BLAKE2B)
+		blake2b_init(&hs->bl2b, BLAKE2B_OUTBYTES);
+#endif
+}
+
+/* feeds data to the hashes in the mask hash, which allows the pipeline
+ * to run each of them from a different thread */
+static void
+hash_state_update(struct hash_state *hs, int hash, const char *data, size_t len)
+{
+	hash &= hs->hashes;
+	if (hash & HASH_MD5)
+		md5_process_bytes(data, len, &hs->m5);
+	if (hash & HASH_SHA1)
+		hs->sha1_update(data, len, &hs->s1);
+	if (hash & HASH_SHA256)
+		hs->sha256_update(data, len, &hs->s256);
+	if (hash & HASH_SHA512)
+		sha512_process_bytes(data, len, &hs->s512);
+#ifdef HAVE_BLAKE2B
+	if (hash & HASH_BLAKE2B)
+		blake2b_update(&hs->bl2b, (const unsigned char *)data, len);
+#endif
+}
+
+static void
+hash_state_final(
+		struct hash_state *hs,
+		char              *md5,
+		char              *sha1,
+		char              *sha256,
+		char              *sha512,
+		char              *blak2b)
+{
+	if (hs->hashes & HASH_MD5) {
+		unsigned char md5buf[MD5_DIGEST_SIZE];
+		md5_finish_ctx(&hs->m5, md5buf);
+		hash_hex(md5, md5buf, MD5_DIGEST_SIZE);
+	}
+	if (hs->hashes & HASH_SHA1) {
+		unsigned char sha1buf[SHA1_DIGEST_SIZE];
+		sha1_finish_ctx(&hs->s1, sha1buf);
+		hash_hex(sha1, sha1buf, SHA1_DIGEST_SIZE);
+	}
+	if (hs->hashes & HASH_SHA256) {
+		unsigned char sha256buf[SHA256_DIGEST_SIZE];
+		sha256_finish_ctx(&hs->s256, sha256buf);
+		hash_hex(sha256, sha256buf, SHA256_DIGEST_SIZE);
+	}
+	if (hs->hashes & HASH_SHA512) {
+		unsigned char sha512buf[SHA512_DIGEST_SIZE];
+		sha512_finish_ctx(&hs->s512, sha512buf);
+		hash_hex(sha512, sha512buf, SHA512_DIGEST_SIZE);
+	}
+#ifdef HAVE_BLAKE2B
+	if (hs->hashes & HASH_BLAKE2B) {
+		unsigned char blak2bbuf[BLAKE2B_OUTBYTES];
+		blake2b_final(&hs->bl2b, blak2bbuf, BLAKE2B_OUTBYTES);
+		hash_hex(blak2b, blak2bbuf, BLAKE2B_OUTBYTES);
+	}
+#else
+	(void)blak2b;
+#endif
+}
+
+/* incremental interface, hashes data handed in piece by piece */
+hash_ctx *
+hash_ctx_new(int hashes)
+{
+	hash_ctx *ret = xmalloc(sizeof(*ret));
+
+	hash_state_init(ret, hashes);
+
+	return ret;
+}
+
+void
+hash_ctx_update(hash_ctx *ctx, const void *data, size_t len)
+{
+	hash_state_update(ctx, ctx->hashes, data, len);
+}
+
+/* writes the digests for the hashes given to hash_ctx_new and releases
+ * ctx */
+void
+hash_ctx_finish(
+		hash_ctx *ctx,
+		char     *md5,
+		char     *sha1,
+		char     *sha256,
+		char     *sha512,
+		char     *blak2b)
+{
+	hash_state_final(ctx, md5, sha1, sha256, sha512, blak2b);
+	free(ctx);
+}
+
+/* inputs are hashed sequentially in small blocks until they exceed
+ * HASH_PIPELINE_MIN, only then it pays off to set up the pipeline */
+#define HASH_PIPELINE_MIN  (64 * 1024)
+#define HASH_CHUNK_SIZE    (256 * 1024)
+
+#ifdef _OPENMP
+/* hashes the remainder of the input using a thread team that lives for
+ * the duration of the input: thread 0 reads the next chunk while the
+ * other threads each run their share of the hashes over the current
+ * chunk, the two chunks are swapped at a barrier
+ * returns false when the pipeline cannot be used, in which case nothing
+ * was read */
+static bool
+hash_pipeline(struct hash_state *hs, read_cb rcb, void *ctx, size_t *flen)
+{
+	/* most expensive first, such that they are spread when there are
+	 * fewer workers than hashes */
+	static const int algos[] = {
+		HASH_SHA512, HASH_BLAKE2B, HASH_SHA256, HASH_SHA1, HASH_MD5
+	};
+	int     hashes = hs->hashes;
+	int     nalgos = 0;
+	int     nthreads;
+	char   *buf[2];
+	size_t  blen[2];
+	size_t  i;
+
+#ifndef HAVE_BLAKE2B
+	hashes &= ~HASH_BLAKE2B;
+#endif
+	for (i = 0; i < sizeof(algos) / sizeof(algos[0]); i++)
+		if (hashes & algos[i])
+			nalgos++;
+
+	if (nalgos == 0 ||
+		omp_in_parallel() ||
+		(nthreads = omp_get_max_threads()) < 2)
+		return false;
+	if (nthreads > nalgos + 1)
+		nthreads = nalgos + 1;
+
+	buf[0]  = xmalloc(HASH_CHUNK_SIZE * 2);
+	buf[1]  = buf[0] + HASH_CHUNK_SIZE;
+	blen[0] = rcb(buf[0], HASH_CHUNK_SIZE, ctx);
+	blen[1] = 0;
+
+#pragma omp parallel num_threads(nthreads) shared(buf, blen)
+	{
+		int    tid = omp_get_thread_num();
+		int    nth = omp_get_num_threads();
+		int    mask = 0;
+		int    k;
+		size_t a;
+		size_t cur = 0;
+
+		/* deal the hashes over the workers, thread 0 only reads unless
+		 * it is all alone */
+		for (a = 0, k = 0; a < sizeof(algos) / sizeof(algos[0]); a++) {
+			if (!(hashes & algos[a]))
+				continue;
+			if (nth == 1 || (k++ % (nth - 1)) + 1 == tid)
+				mask |= algos[a];
+		}
+
+		while (blen[cur] > 0) {
+			if (tid == 0) {
+				*flen += blen[cur];
+				blen[cur ^ 1] = rcb(buf[cur ^ 1], HASH_CHUNK_SIZE, ctx);
+			}
+			if (mask != 0)
+				hash_state_update(hs, mask, buf[cur], blen[cur]);
+#pragma omp barrier
+			cur ^= 1;
+		}
+	}
+
+	free(buf[0]);
+
+	return true;
+}
+#endif
+
 static int
 hash_multiple_internal(
 		read_cb rcb,
@@ -136,106 +418,24 @@ hash_multiple_internal(
 {
 	size_t            len;
 	char              data[8192];
-
-	struct md5_ctx    m5;
-	struct sha1_ctx   s1;
-	struct sha256_ctx s256;
-	struct sha512_ctx s512;
-#ifdef HAVE_BLAKE2B
-	blake2b_state     bl2b;
-#else
-	(void)blak2b;
-#endif
+	struct hash_state hs;
 
 	*flen = 0;
 
-	md5_init_ctx(&m5);
-	sha1_init_ctx(&s1);
-	sha256_init_ctx(&s256);
-	sha512_init_ctx(&s512);
-#ifdef HAVE_BLAKE2B
-	blake2b_init(&bl2b, BLAKE2B_OUTBYTES);
-#endif
+	hash_state_init(&hs, hashes);
 
 	while ((len = rcb(data, sizeof(data), ctx)) > 0) {
 		*flen += len;
-#pragma omp parallel sections
-		{
-#pragma omp section
-			{
-				if (hashes & HASH_MD5)
-					md5_process_bytes(data, len, &m5);
-			}
-#pragma omp section
-			{
-				if (hashes & HASH_SHA1)
-					sha1_process_bytes(data, len, &s1);
-			}
-#pragma omp section
-			{
-				if (hashes & HASH_SHA256)
-					sha256_process_bytes(data, len, &s256);
-			}
-#pragma omp section
-			{
-				if (hashes & HASH_SHA512)
-					sha512_process_bytes(data, len, &s512);
-			}
-#ifdef HAVE_BLAKE2B
-#pragma omp section
-			{
-				if (hashes & HASH_BLAKE2B)
-					blake2b_update(&bl2b, (unsigned char *)data, len);
-			}
+		hash_state_update(&hs, hashes, data, len);
+#ifdef _OPENMP
+		if (*flen >= HASH_PIPELINE_MIN &&
+			len == sizeof(data) &&
+			hash_pipeline(&hs, rcb, ctx, flen))
+			break;
 #endif
-		}
 	}
 
-#pragma omp parallel sections
-	{
-#pragma omp section
-		{
-			if (hashes & HASH_MD5) {
-				unsigned char md5buf[MD5_DIGEST_SIZE];
-				md5_finish_ctx(&m5, md5buf);
-				hash_hex(md5, md5buf, MD5_DIGEST_SIZE);
-			}
-		}
-#pragma omp section
-		{
-			if (hashes & HASH_SHA1) {
-				unsigned char sha1buf[SHA1_DIGEST_SIZE];
-				sha1_finish_ctx(&s1, sha1buf);
-				hash_hex(sha1, sha1buf, SHA1_DIGEST_SIZE);
-			}
-		}
-#pragma omp section
-		{
-			if (hashes & HASH_SHA256) {
-				unsigned char sha256buf[SHA256_DIGEST_SIZE];
-				sha256_finish_ctx(&s256, sha256buf);
-				hash_hex(sha256, sha256buf, SHA256_DIGEST_SIZE);
-			}
-		}
-#pragma omp section
-		{
-			if (hashes & HASH_SHA512) {
-				unsigned char sha512buf[SHA512_DIGEST_SIZE];
-				sha512_finish_ctx(&s512, sha512buf);
-				hash_hex(sha512, sha512buf, SHA512_DIGEST_SIZE);
-			}
-		}
-#ifdef HAVE_BLAKE2B
-#pragma omp section
-		{
-			if (hashes & HASH_BLAKE2B) {
-				unsigned char blak2bbuf[BLAKE2B_OUTBYTES];
-				blake2b_final(&bl2b, blak2bbuf, BLAKE2B_OUTBYTES);
-				hash_hex(blak2b, blak2bbuf, BLAKE2B_OUTBYTES);
-			}
-		}
-#endif
-	}
+	hash_state_final(&hs, md5, sha1, sha256, sha512, blak2b);
 
 	return 0;
 }
@@ -247,7 +447,8 @@ hash_multiple_internal(
  * available.  Only those hashes which are in the global hashes variable
  * are computed, the address space pointed to for non-used hashes are
  * left untouched, e.g. they can be NULL.  The number of bytes read from
- * the file pointed to by fname is returned in the flen argument.
+ * the file pointed to by fname is returned in the flen argument.  The
+ * fd is always closed, also on failure.
  */
 int
 hash_multiple_file_fd(
@@ -260,19 +461,17 @@ hash_multiple_file_fd(
 		size_t *flen,
 		int hashes)
 {
-	FILE *f;
-	int   ret;
-
-	if ((f = fdopen(fd, "r")) == NULL)
-		return -1;
+	struct fdctx fdc;
+	int          ret;
 
-	ret = hash_multiple_internal(read_stdio, f,
+	fdc.fd  = fd;
+	fdc.err = 0;
+	ret = hash_multiple_internal(read_fd, &fdc,
 								 md5, sha1, sha256, sha512, blak2b,
 								 flen, hashes);
+	close(fd);
 
-	fclose(f);
-
-	return ret;
+	return fdc.err != 0 ? -1 : ret;
 }
 
 int
@@ -288,7 +487,6 @@ hash_multiple_file_at_cb(
 		size_t *flen,
 		int hashes)
 {
-	int ret;
 	int fd = openat(pfd, fname, O_RDONLY | O_CLOEXEC);
 
 	if (fd == -1)
@@ -300,15 +498,182 @@ hash_multiple_file_at_cb(
 			return -1;
 	}
 
-	ret = hash_multiple_file_fd(fd, md5, sha1, sha256, sha512,
+	return hash_multiple_file_fd(fd, md5, sha1, sha256, sha512,
 			blak2b, flen, hashes);
+}
 
-	if (ret != 0)
-		close(fd);
+/* batch hashing {{{ */
+/* the names of a batch are short paths, a batch of a dir rarely needs
+ * more than a block */
+#define HASH_BATCH_NAMES_BLKSIZE  (4 * 1024)
+
+struct hash_batch_ {
+	int          nworkers;
+	int          flags;
+	hash_result *ents;
+	int         *hashes;
+	arena_t     *names;   /* fnames of the queued entries */
+	size_t       len;
+	size_t       size;
+};
+
+/* creates a batch that is processed by at most nworkers threads, or
+ * as many as OpenMP would use when nworkers is 0 */
+hash_batch *
+hash_batch_new(int nworkers, int flags)
+{
+	hash_batch *ret = xzalloc(sizeof(*ret));
+
+	ret->nworkers = nworkers;
+	ret->flags    = flags;
 
 	return ret;
 }
 
+/* queues fname relative to pfd for hashing using the given hashes, the
+ * name is copied, priv is returned as is in the result
+ * when hashes is 0, the file is only stat-ed, which allows callers to
+ * mix in entries they need no digests for while retaining their order */
+void
+hash_batch_add(hash_batch *b, int pfd, const char *fname,
+		int hashes, void *priv)
+{
+	hash_result *r;
+
+	if (b->len == b->size) {
+		b->size   = b->size == 0 ? 64 : b->size * 2;
+		b->ents   = xreallocarray(b->ents, b->size, sizeof(b->ents[0]));
+		b->hashes = xreallocarray(b->hashes, b->size, sizeof(b->hashes[0]));
+	}
+
+	r = &b->ents[b->len];
+	memset(r, 0, sizeof(*r));
+	r->pfd   = pfd;
+	if (b->names == NULL)
+		b->names = arena_new(HASH_BATCH_NAMES_BLKSIZE);
+	r->fname = arena_strdup(b->names, fname);
+	r->priv  = priv;
+	b->hashes[b->len] = hashes;
+	b->len++;
+}
+
+size_t
+hash_batch_size(hash_batch *b)
+{
+	return b == NULL ? 0 : b->len;
+}
+
+static void
+hash_batch_one(hash_batch *b, size_t n)
+{
+	hash_result  *r = &b->ents[n];
+	struct fdctx  fdc;
+	int           fd;
+
+	/* no hashes requested, only the file's status is wanted */
+	if (b->hashes[n] == 0) {
+		if (fstatat(r->pfd, r->fname, &r->st, 0) != 0)
+			r->err = errno;
+		else
+			r->flen = (size_t)r->st.st_size;
+		return;
+	}
+
+	fd = openat(r->pfd, r->fname, O_RDONLY | O_CLOEXEC);
+	if (fd == -1 ||
+		fstat(fd, &r->st) != 0)
+	{
+		r->err = errno;
+		if (fd != -1)
+			close(fd);
+		return;
+	}
+
+#ifdef POSIX_FADV_SEQUENTIAL
+	if (b->flags & HASH_BATCH_READAHEAD)
+		(void)posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+	fdc.fd  = fd;
+	fdc.err = 0;
+	hash_multiple_internal(read_fd, &fdc,
+						   r->md5, r->sha1, r->sha256, r->sha512, r->blak2b,
+						   &r->flen, b->hashes[n]);
+	if (fdc.err != 0)
+		r->err = fdc.err;
+	close(fd);
+}
+
+/* hashes all queued files and calls cb for each of them in the order
+ * they were added, the batch is empty afterwards such that it can be
+ * reused
+ * the files are spread over the workers one at a time, the pipelining
+ * of hash_multiple_internal is not used from them, files the size of
+ * ebuilds are better served by hashing several at once
+ * from within a parallel region, the files become tasks of the
+ * enclosing team instead, nworkers does not apply then */
+void
+hash_batch_run(hash_batch *b, hash_batch_cb cb, void *priv)
+{
+	size_t n;
+	int    nworkers;
+
+	if (b == NULL || b->len == 0)
+		return;
+
+	nworkers = b->nworkers;
+#ifdef _OPENMP
+	if (nworkers <= 0)
+		nworkers = omp_get_max_threads();
+#endif
+	if (nworkers <= 0)
+		nworkers = 1;
+	if ((size_t)nworkers > b->len)
+		nworkers = (int)b->len;
+
+#ifdef _OPENMP
+	if (omp_in_parallel()) {
+		/* called from a task already, so no team to spread over, hand
+		 * out the files as tasks for any idle thread to pick up, and
+		 * report once they are all done */
+#pragma omp taskloop grainsize(1)
+		for (n = 0; n < b->len; n++)
+			hash_batch_one(b, n);
+		if (cb != NULL)
+			for (n = 0; n < b->len; n++)
+				cb(&b->ents[n], priv);
+	} else
+#endif
+	{
+#pragma omp parallel for ordered schedule(dynamic) num_threads(nworkers)
+		for (n = 0; n < b->len; n++) {
+			hash_batch_one(b, n);
+#pragma omp ordered
+			{
+				if (cb != NULL)
+					cb(&b->ents[n], priv);
+			}
+		}
+	}
+
+	arena_free(b->names);
+	b->names = NULL;
+	b->len = 0;
+}
+
+void
+hash_batch_free(hash_batch *b)
+{
+	if (b == NULL)
+		return;
+
+	arena_free(b->names);
+	free(b->ents);
+	free(b->hashes);
+	free(b);
+}
+/* }}} */
+
 static char _hash_file_buf[128 + 1];
 char *
 hash_file_at_cb(int pfd, const char *fname, int hash, hash_cb_t cb)
@@ -365,3 +730,151 @@ hash_string(const char *buf, ssize_t buflen, int hash)
 
 	return _hash_file_buf;
 }
+
+/* compares the given implementations against the gnulib ones over
+ * inputs of varying lengths, fed in varying slices such that all
+ * buffering paths are exercised */
+static bool
+hash_selftest_impls(sha1_update_fn sha1, sha256_update_fn sha256)
+{
+	struct sha1_ctx   s1a;
+	struct sha1_ctx   s1b;
+	struct sha256_ctx s256a;
+	struct sha256_ctx s256b;
+	unsigned char     data[1024];
+	unsigned char     ra[SHA256_DIGEST_SIZE];
+	unsigned char     rb[SHA256_DIGEST_SIZE];
+	size_t            len;
+	size_t            off;
+	size_t            step;
+	size_t            i;
+
+	for (i = 0; i < sizeof(data); i++)
+		data[i] = (unsigned char)(i * 131 + (i >> 8));
+
+	for (len = 0; len <= sizeof(data); len += len < 200 ? 1 : 61) {
+		step = (len % 67) + 1;
+
+		sha1_init_ctx(&s1a);
+		sha1_init_ctx(&s1b);
+		sha256_init_ctx(&s256a);
+		sha256_init_ctx(&s256b);
+		sha1_process_bytes(data, len, &s1a);
+		sha256_process_bytes(data, len, &s256a);
+		for (off = 0; off < len; off += step) {
+			i = len - off < step ? len - off : step;
+			sha1(data + off, i, &s1b);
+			sha256(data + off, i, &s256b);
+		}
+
+		sha1_finish_ctx(&s1a, ra);
+		sha1_finish_ctx(&s1b, rb);
+		if (memcmp(ra, rb, SHA1_DIGEST_SIZE) != 0)
+			return false;
+		sha256_finish_ctx(&s256a, ra);
+		sha256_finish_ctx(&s256b, rb);
+		if (memcmp(ra, rb, SHA256_DIGEST_SIZE) != 0)
+			return false;
+	}
+
+	return true;
+}
+
+/* returns the name of the implementation used for the given hash */
+const char *
+hash_impl_name(int hash)
+{
+	hash_select_impls();
+
+	switch (hash) {
+		case HASH_SHA1:
+			return hash_impls_sel.sha1_name;
+		case HASH_SHA256:
+			return hash_impls_sel.sha256_name;
+#ifdef HAVE_BLAKE2B
+		case HASH_BLAKE2B:
+			return "libb2";
+#endif
+		case HASH_MD5:
+		case HASH_SHA512:
+			return "generic";
+		default:
+			return NULL;
+	}
+}
+
+/* prints the selected implementation for each of the hashes, along
+ * with the single-threaded throughput over an in-memory buffer, and
+ * that of the generic implementation when it isn't the one selected
+ * returns 0 when the self-test passes */
+int
+hash_bench(FILE *out)
+{
+	static const struct {
+		int         hash;
+		const char *name;
+	} algos[] = {
+		{ HASH_MD5,     "MD5"     },
+		{ HASH_SHA1,    "SHA1"    },
+		{ HASH_SHA256,  "SHA256"  },
+		{ HASH_SHA512,  "SHA512"  },
+#ifdef HAVE_BLAKE2B
+		{ HASH_BLAKE2B, "BLAKE2B" },
+#endif
+	};
+	const size_t      buflen = 1024 * 1024;
+	const size_t      rounds = 64;
+	struct hash_state hs;
+	struct timespec   start;
+	struct timespec   end;
+	char              digest[BLAKE2B_DIGEST_LENGTH + 1];
+	char             *buf;
+	double            secs;
+	size_t            i;
+	size_t            r;
+	int               pass;
+	int               ret = 0;
+
+	hash_select_impls();
+	if (hash_x86_have_shani() &&
+		!hash_selftest_impls(hash_x86_sha1_process_bytes,
+							 hash_x86_sha256_process_bytes))
+		ret = 1;
+	fprintf(out, "self-test: %s\n", ret == 0 ? "ok" : "FAILED");
+
+	buf = xmalloc(buflen);
+	for (i = 0; i < buflen; i++)
+		buf[i] = (char)(i * 131);
+
+	for (i = 0; i < sizeof(algos) / sizeof(algos[0]); i++) {
+		const char *impl = hash_impl_name(algos[i].hash);
+
+		/* the second pass measures the generic fallback */
+		for (pass = 0; pass < 2; pass++) {
+			hash_state_init(&hs, algos[i].hash);
+			if (pass == 1) {
+				if (strcmp(impl, "generic") == 0)
+					break;
+				impl              = "generic";
+				hs.sha1_update    = sha1_process_bytes;
+				hs.sha256_update  = sha256_process_bytes;
+			}
+
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			for (r = 0; r < rounds; r++)
+				hash_state_update(&hs, algos[i].hash, buf, buflen);
+			hash_state_final(&hs, digest, digest, digest, digest, digest);
+			clock_gettime(CLOCK_MONOTONIC, &end);
+
+			secs = (double)(end.tv_sec - start.tv_sec) +
+				((double)(end.tv_nsec - start.tv_nsec) / 1e9);
+			fprintf(out, "%-8s %-8s %9.1f MiB/s\n",
+					pass == 0 ? algos[i].name : "", impl,
+					secs > 0 ? (double)rounds / secs : 0.0);
+		}
+	}
+
+	free(buf);
+
+	return ret;
+}
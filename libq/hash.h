@@ -22,7 +22,12 @@
 #include "sha256.h"
 #include "sha512.h"
 
-#define BLAKE2B_DIGEST_SIZE    BLAKE2B_OUTBYTES
+#ifdef HAVE_BLAKE2B
+# define BLAKE2B_DIGEST_SIZE   BLAKE2B_OUTBYTES
+#else
+/* never computed, but keep the buffers for it sized */
+# define BLAKE2B_DIGEST_SIZE   SHA512_DIGEST_SIZE
+#endif
 
 #define MD5_DIGEST_LENGTH      (MD5_DIGEST_SIZE * 2)
 #define SHA1_DIGEST_LENGTH     (SHA1_DIGEST_SIZE * 2)
@@ -65,4 +70,41 @@ char *hash_file_at_cb(int pfd, const char *filename, int hash_algo, hash_cb_t cb
 #define hash_file_at(fd, f, h) hash_file_at_cb(fd, f, h, NULL)
 char *hash_string(const char *buf, ssize_t buflen, int hash);
 
+/* incremental interface, for data that doesn't come from a file */
+typedef struct hash_state hash_ctx;
+hash_ctx *hash_ctx_new(int hashes);
+void hash_ctx_update(hash_ctx *ctx, const void *data, size_t len);
+void hash_ctx_finish(hash_ctx *ctx, char *md5, char *sha1, char *sha256,
+		char *sha512, char *blak2b);
+
+/* batch interface: hash many files using a pool of worker threads,
+ * the results are handed to the callback in submission order, one at
+ * a time, but possibly from any of the worker threads; callbacks of
+ * batches run concurrently from different tasks are not serialised */
+typedef struct hash_batch_ hash_batch;
+typedef struct {
+	int          pfd;
+	const char  *fname;
+	void        *priv;    /* as given to hash_batch_add */
+	int          err;     /* errno when the file could not be hashed */
+	struct stat  st;
+	size_t       flen;
+	char         md5[MD5_DIGEST_LENGTH + 1];
+	char         sha1[SHA1_DIGEST_LENGTH + 1];
+	char         sha256[SHA256_DIGEST_LENGTH + 1];
+	char         sha512[SHA512_DIGEST_LENGTH + 1];
+	char         blak2b[BLAKE2B_DIGEST_LENGTH + 1];
+} hash_result;
+typedef void (*hash_batch_cb)(hash_result *res, void *priv);
+#define HASH_BATCH_READAHEAD  (1<<0)  /* advise the kernel on reads */
+hash_batch *hash_batch_new(int nworkers, int flags);
+void hash_batch_add(hash_batch *b, int pfd, const char *fname,
+		int hashes, void *priv);
+size_t hash_batch_size(hash_batch *b);
+void hash_batch_run(hash_batch *b, hash_batch_cb cb, void *priv);
+void hash_batch_free(hash_batch *b);
+
+const char *hash_impl_name(int hash);
+int hash_bench(FILE *out);
+
 #endif
@@ -0,0 +1,322 @@
+/*
+ * Copyright 2026 Gentoo Foundation
+ * Distributed under the terms of the GNU General Public License v2
+ */
+
+#include "main.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "hash_x86.h"
+
+/* the kernels are compiled using function level target attributes, so
+ * the rest of the code need not be built for a CPU that has them, and
+ * are only used after checking cpuid at runtime
+ * when gnulib wraps OpenSSL, its contexts aren't ours to poke in, and
+ * OpenSSL does this dispatching itself anyway */
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    defined(__GNUC__) && \
+    !defined(HAVE_OPENSSL_SHA1) && \
+    !defined(HAVE_OPENSSL_SHA256)
+# define HASH_X86_SHANI 1
+# include <cpuid.h>
+# include <immintrin.h>
+#endif
+
+#ifdef HASH_X86_SHANI
+#define HASH_X86_TARGET  __attribute__((target("sha,sse4.1,ssse3")))
+
+typedef void (hash_x86_blocks_fn)(uint32_t *state,
+                                  const unsigned char *data,
+                                  size_t nblocks);
+
+bool hash_x86_have_shani
+(
+  void
+)
+{
+  unsigned int a;
+  unsigned int b;
+  unsigned int c;
+  unsigned int d;
+
+  if (__get_cpuid(1, &a, &b, &c, &d) == 0 ||
+      (c & bit_SSSE3) == 0 ||
+      (c & bit_SSE4_1) == 0)
+    return false;
+  if (__get_cpuid_count(7, 0, &a, &b, &c, &d) == 0 ||
+      (b & bit_SHA) == 0)
+    return false;
+
+  return true;
+}
+
+/* SHA-1 {{{ */
+/* four rounds using round function F, computing the next message
+ * words from the preceding four at the same time */
+#define SHA1_ROUNDS4(F,I) \
+  do { \
+    if ((I) >= 4) \
+      msg[(I) & 3] = _mm_sha1msg2_epu32( \
+          _mm_xor_si128(_mm_sha1msg1_epu32(msg[(I) & 3], \
+                                           msg[((I) + 1) & 3]), \
+                        msg[((I) + 2) & 3]), \
+          msg[((I) + 3) & 3]); \
+    if ((I) == 0) \
+      e = _mm_add_epi32(e, msg[0]); \
+    else \
+      e = _mm_sha1nexte_epu32(e, msg[(I) & 3]); \
+    prev = abcd; \
+    abcd = _mm_sha1rnds4_epu32(abcd, e, F); \
+    e    = prev; \
+  } while (0)
+
+HASH_X86_TARGET
+static void hash_x86_sha1_blocks
+(
+  uint32_t            *state,
+  const unsigned char *data,
+  size_t               nblocks
+)
+{
+  const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL,
+                                      0x08090a0b0c0d0e0fULL);
+  __m128i       abcd;
+  __m128i       e0;
+  __m128i       abcd_save;
+  __m128i       e;
+  __m128i       prev;
+  __m128i       msg[4];
+  int           i;
+
+  abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)state), 0x1b);
+  e0   = _mm_set_epi32((int)state[4], 0, 0, 0);
+
+  for (; nblocks > 0; nblocks--, data += 64)
+  {
+    abcd_save = abcd;
+    e         = e0;
+
+    for (i = 0; i < 4; i++)
+      msg[i] = _mm_shuffle_epi8(
+          _mm_loadu_si128((const __m128i *)(data + (i * 16))), mask);
+
+    SHA1_ROUNDS4(0,  0); SHA1_ROUNDS4(0,  1); SHA1_ROUNDS4(0,  2);
+    SHA1_ROUNDS4(0,  3); SHA1_ROUNDS4(0,  4);
+    SHA1_ROUNDS4(1,  5); SHA1_ROUNDS4(1,  6); SHA1_ROUNDS4(1,  7);
+    SHA1_ROUNDS4(1,  8); SHA1_ROUNDS4(1,  9);
+    SHA1_ROUNDS4(2, 10); SHA1_ROUNDS4(2, 11); SHA1_ROUNDS4(2, 12);
+    SHA1_ROUNDS4(2, 13); SHA1_ROUNDS4(2, 14);
+    SHA1_ROUNDS4(3, 15); SHA1_ROUNDS4(3, 16); SHA1_ROUNDS4(3, 17);
+    SHA1_ROUNDS4(3, 18); SHA1_ROUNDS4(3, 19);
+
+    /* e holds the abcd from before the last four rounds, from which
+     * the final E is derived */
+    e0   = _mm_sha1nexte_epu32(e, e0);
+    abcd = _mm_add_epi32(abcd, abcd_save);
+  }
+
+  _mm_storeu_si128((__m128i *)state, _mm_shuffle_epi32(abcd, 0x1b));
+  state[4] = (uint32_t)_mm_extract_epi32(e0, 3);
+}
+#undef SHA1_ROUNDS4
+/* }}} */
+
+/* SHA-256 {{{ */
+static const uint32_t hash_x86_sha256_k[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+  0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+  0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+  0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+  0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+  0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+  0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+  0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+  0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+HASH_X86_TARGET
+static void hash_x86_sha256_blocks
+(
+  uint32_t            *state,
+  const unsigned char *data,
+  size_t               nblocks
+)
+{
+  const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+                                      0x0405060700010203ULL);
+  __m128i       state0;
+  __m128i       state1;
+  __m128i       abef_save;
+  __m128i       cdgh_save;
+  __m128i       tmp;
+  __m128i       msg[4];
+  int           i;
+
+  /* the instructions want the state as ABEF and CDGH */
+  tmp    = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[0]),
+                             0xb1);
+  state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[4]),
+                             0x1b);
+  state0 = _mm_alignr_epi8(tmp, state1, 8);
+  state1 = _mm_blend_epi16(state1, tmp, 0xf0);
+
+  for (; nblocks > 0; nblocks--, data += 64)
+  {
+    abef_save = state0;
+    cdgh_save = state1;
+
+    for (i = 0; i < 16; i++)
+    {
+      if (i < 4)
+        msg[i] = _mm_shuffle_epi8(
+            _mm_loadu_si128((const __m128i *)(data + (i * 16))), mask);
+      else
+        msg[i & 3] = _mm_sha256msg2_epu32(
+            _mm_add_epi32(_mm_sha256msg1_epu32(msg[i & 3],
+                                               msg[(i + 1) & 3]),
+                          _mm_alignr_epi8(msg[(i + 3) & 3],
+                                          msg[(i + 2) & 3], 4)),
+            msg[(i + 3) & 3]);
+
+      tmp    = _mm_add_epi32(msg[i & 3],
+                             _mm_loadu_si128((const __m128i *)
+                                             &hash_x86_sha256_k[i * 4]));
+      state1 = _mm_sha256rnds2_epu32(state1, state0, tmp);
+      state0 = _mm_sha256rnds2_epu32(state0, state1,
+                                     _mm_shuffle_epi32(tmp, 0x0e));
+    }
+
+    state0 = _mm_add_epi32(state0, abef_save);
+    state1 = _mm_add_epi32(state1, cdgh_save);
+  }
+
+  tmp    = _mm_shuffle_epi32(state0, 0x1b);
+  state1 = _mm_shuffle_epi32(state1, 0xb1);
+  _mm_storeu_si128((__m128i *)&state[0], _mm_blend_epi16(tmp, state1, 0xf0));
+  _mm_storeu_si128((__m128i *)&state[4], _mm_alignr_epi8(state1, tmp, 8));
+}
+/* }}} */
+
+/* gnulib counts the bytes processed in blocks, the buffered remainder
+ * is added by finish */
+static void hash_x86_add_total
+(
+  uint32_t *total,
+  size_t    len
+)
+{
+  total[0] += (uint32_t)len;
+  total[1] += (uint32_t)(len >> 31 >> 1) + (total[0] < (uint32_t)len);
+}
+
+/* the gnulib contexts share their layout for the bits that matter here:
+ * a 64-byte block size, a byte count in total, and a buffer holding a
+ * partial block (always less than 64 bytes in between calls) */
+static size_t hash_x86_process_bytes
+(
+  hash_x86_blocks_fn  *blocks,
+  uint32_t            *state,
+  uint32_t            *total,
+  unsigned char       *buffer,
+  size_t               buflen,
+  const unsigned char *data,
+  size_t               len
+)
+{
+  size_t n;
+
+  if (buflen > 0)
+  {
+    n = 64 - buflen;
+    if (n > len)
+      n = len;
+    memcpy(buffer + buflen, data, n);
+    buflen += n;
+    data   += n;
+    len    -= n;
+    if (buflen < 64)
+      return buflen;
+    blocks(state, buffer, 1);
+    hash_x86_add_total(total, 64);
+    buflen = 0;
+  }
+
+  if (len >= 64)
+  {
+    n = len & ~(size_t)63;
+    blocks(state, data, n / 64);
+    hash_x86_add_total(total, n);
+    data += n;
+    len  -= n;
+  }
+
+  memcpy(buffer, data, len);
+  return len;
+}
+
+void hash_x86_sha1_process_bytes
+(
+  const void      *buf,
+  size_t           len,
+  struct sha1_ctx *ctx
+)
+{
+  /* A through E are consecutive members */
+  ctx->buflen = (uint32_t)hash_x86_process_bytes(hash_x86_sha1_blocks,
+                                                 &ctx->A, ctx->total,
+                                                 (unsigned char *)ctx->buffer,
+                                                 ctx->buflen, buf, len);
+}
+
+void hash_x86_sha256_process_bytes
+(
+  const void        *buf,
+  size_t             len,
+  struct sha256_ctx *ctx
+)
+{
+  ctx->buflen = hash_x86_process_bytes(hash_x86_sha256_blocks,
+                                       ctx->state, ctx->total,
+                                       (unsigned char *)ctx->buffer,
+                                       ctx->buflen, buf, len);
+}
+#else
+bool hash_x86_have_shani
+(
+  void
+)
+{
+  return false;
+}
+
+void hash_x86_sha1_process_bytes
+(
+  const void      *buf,
+  size_t           len,
+  struct sha1_ctx *ctx
+)
+{
+  sha1_process_bytes(buf, len, ctx);
+}
+
+void hash_x86_sha256_process_bytes
+(
+  const void        *buf,
+  size_t             len,
+  struct sha256_ctx *ctx
+)
+{
+  sha256_process_bytes(buf, len, ctx);
+}
+#endif
+
+/* vim: set ts=2 sw=2 expandtab cino+=\:0 foldmethod=marker: */
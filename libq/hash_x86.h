@@ -0,0 +1,25 @@
+/*
+ * Copyright 2026 Gentoo Foundation
+ * Distributed under the terms of the GNU General Public License v2
+ */
+
+#ifndef _HASH_X86_H
+#define _HASH_X86_H 1
+
+#include <stdlib.h>
+
+#include "sha1.h"
+#include "sha256.h"
+
+/* SHA extensions (SHA-NI) kernels for x86, these operate on the gnulib
+ * contexts such that init and finish remain those of gnulib; they
+ * must only be used when hash_x86_have_shani returns true */
+bool hash_x86_have_shani(void);
+void hash_x86_sha1_process_bytes(const void *buf, size_t len,
+                                 struct sha1_ctx *ctx);
+void hash_x86_sha256_process_bytes(const void *buf, size_t len,
+                                   struct sha256_ctx *ctx);
+
+#endif
+
+/* vim: set ts=2 sw=2 expandtab cino+=\:0 foldmethod=marker: */
@@ -0,0 +1,204 @@
+/*
+ * Copyright 2026 Gentoo Foundation
+ * Distributed under the terms of the GNU General Public License v2
+ */
+
+#include "main.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <xalloc.h>
+#ifdef _OPENMP
+# include <omp.h>
+#endif
+
+#include "arena.h"
+#include "intern.h"
+
+#define INTERN_INITSIZE  1024  /* must be a power of two */
+
+typedef struct {
+  char         *str;
+  size_t        len;
+  unsigned int  hash;
+} intern_ent;
+
+struct intern_ {
+  arena_t      *arena;
+  intern_ent   *tbl;
+  size_t        size;
+  size_t        cnt;     /* unique strings stored */
+  size_t        refs;    /* strings handed out */
+  size_t        saved;   /* bytes not stored thanks to dedup */
+#ifdef _OPENMP
+  omp_lock_t    lock;
+#endif
+};
+
+static unsigned int
+intern_hash
+(
+  const char *s,
+  size_t      len
+)
+{
+  unsigned int ret = 2166136261UL;  /* FNV1a32 */
+  size_t       i;
+
+  for (i = 0; i < len; i++) {
+    ret ^= (unsigned char)s[i];
+    ret *= 16777619;
+  }
+
+  return ret;
+}
+
+/* allocates a new pool storing its strings in arena */
+intern_t *intern_new
+(
+  arena_t *arena
+)
+{
+  intern_t *ret = xzalloc(sizeof(*ret));
+  ret->arena    = arena;
+  ret->size     = INTERN_INITSIZE;
+  ret->tbl      = xzalloc(sizeof(ret->tbl[0]) * ret->size);
+#ifdef _OPENMP
+  omp_init_lock(&ret->lock);
+#endif
+  return ret;
+}
+
+static void intern_grow
+(
+  intern_t *ip
+)
+{
+  intern_ent *otbl  = ip->tbl;
+  size_t      osize = ip->size;
+  size_t      i;
+  size_t      pos;
+
+  ip->size *= 2;
+  ip->tbl   = xzalloc(sizeof(ip->tbl[0]) * ip->size);
+  for (i = 0; i < osize; i++) {
+    if (otbl[i].str == NULL)
+      continue;
+    for (pos = otbl[i].hash & (ip->size - 1);
+         ip->tbl[pos].str != NULL;
+         pos = (pos + 1) & (ip->size - 1))
+      ;
+    ip->tbl[pos] = otbl[i];
+  }
+  free(otbl);
+}
+
+static char *intern_get
+(
+  intern_t     *ip,
+  const char   *ptr,
+  size_t        len,
+  unsigned int  hash
+)
+{
+  intern_ent *ent;
+  size_t      pos;
+
+  ip->refs++;
+  for (pos = hash & (ip->size - 1);
+       ip->tbl[pos].str != NULL;
+       pos = (pos + 1) & (ip->size - 1))
+  {
+    ent = &ip->tbl[pos];
+    if (ent->hash == hash &&
+        ent->len == len &&
+        memcmp(ent->str, ptr, len) == 0)
+    {
+      ip->saved += len + 1;
+      return ent->str;
+    }
+  }
+
+  ent       = &ip->tbl[pos];
+  ent->str  = arena_memdup(ip->arena, ptr, len);
+  ent->len  = len;
+  ent->hash = hash;
+
+  /* keep load below 70% so probe sequences stay short */
+  if (++ip->cnt * 10 > ip->size * 7) {
+    char *ret = ent->str;
+    intern_grow(ip);
+    return ret;
+  }
+
+  return ent->str;
+}
+
+/* returns the pooled copy of len bytes at ptr, NUL-terminated */
+char *intern_mem
+(
+  intern_t   *ip,
+  const void *ptr,
+  size_t      len
+)
+{
+  unsigned int  hash = intern_hash(ptr, len);
+  char         *ret;
+
+  /* like the arena it allocates from, the pool may be shared with
+   * OpenMP tasks outside a parallel region, so always serialise */
+#ifdef _OPENMP
+  omp_set_lock(&ip->lock);
+#endif
+  ret = intern_get(ip, ptr, len, hash);
+#ifdef _OPENMP
+  omp_unset_lock(&ip->lock);
+#endif
+
+  return ret;
+}
+
+char *intern_str
+(
+  intern_t   *ip,
+  const char *str
+)
+{
+  return intern_mem(ip, str, strlen(str));
+}
+
+/* reports the number of unique strings, the number of strings handed
+ * out and the number of bytes that didn't need storing due to sharing */
+void intern_stats
+(
+  intern_t *ip,
+  size_t   *uniq,
+  size_t   *refs,
+  size_t   *saved
+)
+{
+  if (uniq != NULL)
+    *uniq = ip == NULL ? 0 : ip->cnt;
+  if (refs != NULL)
+    *refs = ip == NULL ? 0 : ip->refs;
+  if (saved != NULL)
+    *saved = ip == NULL ? 0 : ip->saved;
+}
+
+/* releases the lookup table, the strings live on in the arena */
+void intern_free
+(
+  intern_t *ip
+)
+{
+  if (ip == NULL)
+    return;
+
+  free(ip->tbl);
+#ifdef _OPENMP
+  omp_destroy_lock(&ip->lock);
+#endif
+  free(ip);
+}
+
+/* vim: set ts=2 sw=2 expandtab cino+=\:0 foldmethod=marker: */
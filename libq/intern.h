@@ -0,0 +1,26 @@
+/*
+ * Copyright 2026 Gentoo Foundation
+ * Distributed under the terms of the GNU General Public License v2
+ */
+
+#ifndef _INTERN_H
+#define _INTERN_H 1
+
+#include <stdlib.h>
+
+#include "arena.h"
+
+/* string pool: equal strings are stored once (in the given arena), so
+ * returned pointers may be compared for equality directly, they must
+ * never be modified */
+typedef struct intern_ intern_t;
+intern_t *intern_new(arena_t *arena);
+char     *intern_mem(intern_t *ip, const void *ptr, size_t len);
+char     *intern_str(intern_t *ip, const char *str);
+void      intern_stats(intern_t *ip, size_t *uniq, size_t *refs,
+                       size_t *saved);
+void      intern_free(intern_t *ip);
+
+#endif
+
+/* vim: set ts=2 sw=2 expandtab cino+=\:0 foldmethod=marker: */
@@ -0,0 +1,215 @@
+/*
+ * Copyright 2026 Gentoo Foundation
+ * Distributed under the terms of the GNU General Public License v2
+ */
+
+#include "main.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <xalloc.h>
+
+#include "array.h"
+#include "atom.h"
+#include "set.h"
+#include "matcher.h"
+
+typedef struct matcher_ent_ matcher_ent;
+struct matcher_ent_ {
+  atom_ctx *atom;
+  char     *src;       /* where the atom came from, may be NULL */
+};
+
+struct matcher_ {
+  hash_t *keyed;       /* CAT/PN -> array of matcher_ent */
+  array  *wild;        /* atoms that cannot be keyed on CAT/PN */
+  size_t  cnt;
+};
+
+matcher_t *matcher_new
+(
+  void
+)
+{
+  matcher_t *ret = xzalloc(sizeof(*ret));
+
+  ret->keyed = hash_new();
+  ret->wild  = array_new();
+
+  return ret;
+}
+
+/* adds the atom to the matcher, src is returned by matcher_match when
+ * this atom matches, returns false if the atom is invalid */
+bool matcher_add
+(
+  matcher_t  *m,
+  const char *atom,
+  const char *src
+)
+{
+  matcher_ent *ent;
+  array       *bucket;
+  atom_ctx    *a;
+  char         key[_Q_PATH_MAX];
+
+  if ((a = atom_explode(atom)) == NULL)
+    return false;
+
+  ent       = xmalloc(sizeof(*ent));
+  ent->atom = a;
+  ent->src  = src != NULL ? xstrdup(src) : NULL;
+
+  /* blockers match packages with other names too, and atoms without
+   * CATEGORY or PN match many, these are always tried */
+  if (a->CATEGORY == NULL ||
+      a->PN == NULL ||
+      a->blocker != ATOM_BL_NONE)
+  {
+    array_append(m->wild, ent);
+  }
+  else
+  {
+    snprintf(key, sizeof(key), "%s/%s", a->CATEGORY, a->PN);
+    bucket = hash_get(m->keyed, key);
+    if (bucket == NULL)
+    {
+      bucket   = array_new();
+      m->keyed = hash_add(m->keyed, key, bucket, NULL);
+    }
+    array_append(bucket, ent);
+  }
+  m->cnt++;
+
+  return true;
+}
+
+/* adds all atoms from the keys of the hash, using its values as source
+ * (like package_masks), returns the matcher, which is allocated when m
+ * is NULL */
+matcher_t *matcher_add_hash
+(
+  matcher_t *m,
+  hash_t    *atoms
+)
+{
+  array  *keys;
+  array  *vals;
+  char   *atom;
+  size_t  n;
+
+  if (m == NULL)
+    m = matcher_new();
+  if (atoms == NULL)
+    return m;
+
+  keys = hash_keys(atoms);
+  vals = hash_values(atoms);
+  array_for_each(keys, n, atom)
+    matcher_add(m, atom, array_get(vals, n));
+  array_free(keys);
+  array_free(vals);
+
+  return m;
+}
+
+/* returns the source of the first atom in the matcher that atom
+ * matches, or NULL if none does, when hit is not NULL it receives the
+ * matching atom, owned by the matcher
+ * the matcher is not modified, so this is safe to call concurrently */
+const char *matcher_match
+(
+  matcher_t      *m,
+  const atom_ctx *atom,
+  const atom_ctx **hit
+)
+{
+  matcher_ent *ent;
+  array       *bucket;
+  size_t       n;
+  char         key[_Q_PATH_MAX];
+
+  if (m == NULL ||
+      m->cnt == 0)
+    return NULL;
+
+  if (atom->CATEGORY != NULL &&
+      atom->PN != NULL &&
+      hash_size(m->keyed) != 0)
+  {
+    snprintf(key, sizeof(key), "%s/%s", atom->CATEGORY, atom->PN);
+    bucket = hash_get(m->keyed, key);
+    if (bucket != NULL)
+    {
+      array_for_each(bucket, n, ent)
+      {
+        if (atom_compare(atom, ent->atom) == EQUAL)
+        {
+          if (hit != NULL)
+            *hit = ent->atom;
+          return ent->src != NULL ? ent->src : "";
+        }
+      }
+    }
+  }
+
+  array_for_each(m->wild, n, ent)
+  {
+    if (atom_compare(atom, ent->atom) == EQUAL)
+    {
+      if (hit != NULL)
+        *hit = ent->atom;
+      return ent->src != NULL ? ent->src : "";
+    }
+  }
+
+  return NULL;
+}
+
+/* returns the number of atoms in the matcher */
+size_t matcher_size
+(
+  matcher_t *m
+)
+{
+  return m == NULL ? 0 : m->cnt;
+}
+
+static void matcher_ent_free
+(
+  void *priv
+)
+{
+  matcher_ent *ent = priv;
+
+  atom_implode(ent->atom);
+  free(ent->src);
+  free(ent);
+}
+
+static void matcher_bucket_free
+(
+  void *priv
+)
+{
+  array_deepfree(priv, matcher_ent_free);
+}
+
+void matcher_free
+(
+  matcher_t *m
+)
+{
+  array *buckets;
+
+  if (m == NULL)
+    return;
+
+  buckets = hash_values(m->keyed);
+  array_deepfree(buckets, matcher_bucket_free);
+  hash_free(m->keyed);
+  array_deepfree(m->wild, matcher_ent_free);
+  free(m);
+}
+
+/* vim: set ts=2 sw=2 expandtab cino+=\:0 foldmethod=marker: */
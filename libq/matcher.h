@@ -0,0 +1,28 @@
+/*
+ * Copyright 2026 Gentoo Foundation
+ * Distributed under the terms of the GNU General Public License v2
+ */
+
+#ifndef _MATCHER_H
+#define _MATCHER_H 1
+
+#include <stdbool.h>
+
+#include "atom.h"
+#include "set.h"
+
+/* a list of atoms (e.g. package.mask), compiled such that matching a
+ * package against all of them only has to look at the atoms for its
+ * CATEGORY/PN, and those that can't be keyed on that */
+typedef struct matcher_ matcher_t;
+matcher_t  *matcher_new(void);
+bool        matcher_add(matcher_t *m, const char *atom, const char *src);
+matcher_t  *matcher_add_hash(matcher_t *m, hash_t *atoms);
+const char *matcher_match(matcher_t *m, const atom_ctx *atom,
+                          const atom_ctx **hit);
+size_t      matcher_size(matcher_t *m);
+void        matcher_free(matcher_t *m);
+
+#endif
+
+/* vim: set ts=2 sw=2 expandtab cino+=\:0 foldmethod=marker: */
@@ -16,6 +16,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <xalloc.h>
+#if defined(__linux__)
+# include <stdint.h>
+# include <sys/syscall.h>
+#endif
 
 #include "scandirat.h"
 
@@ -75,6 +79,116 @@ scandirat(int dir_fd, const char *dir, struct dirent ***dirlist,
 
 #endif
 
+#if defined(__linux__) && defined(SYS_getdents64)
+/* the kernel's record, glibc doesn't expose it */
+struct scandir_dirent64 {
+	uint64_t       d_ino;
+	int64_t        d_off;
+	unsigned short d_reclen;
+	unsigned char  d_type;
+	char           d_name[];
+};
+#endif
+
+static int
+scandir_name_compar(const void *l, const void *r)
+{
+	return strcmp(*(const char **)l, *(const char **)r);
+}
+
+/* appends name to the list in *names, the list and the name are
+ * allocated from a */
+static void
+scandir_name_add(arena_t *a, char ***names, size_t *len, size_t *size,
+		const char *name)
+{
+	char **nlist;
+
+	if (*len == *size) {
+		/* the old list is simply abandoned in the arena */
+		*size = *size == 0 ? 64 : *size * 2;
+		nlist = arena_alloc(a, sizeof(nlist[0]) * *size);
+		if (*len > 0)
+			memcpy(nlist, *names, sizeof(nlist[0]) * *len);
+		*names = nlist;
+	}
+	(*names)[(*len)++] = arena_strdup(a, name);
+}
+
+/* takes a snapshot of the names in dir, relative to dir_fd, without
+ * . and .., and without any other name starting with a dot unless
+ * hidden is set
+ * all memory is taken from a, hence is released with it, on Linux the
+ * entries are read in bulk using getdents64, such that no DIR needs to
+ * be allocated either
+ * returns the number of names, or -1 when dir cannot be read */
+int
+scandirat_names(arena_t *a, int dir_fd, const char *dir, bool hidden,
+		bool sorted, char ***names)
+{
+	char **ret = NULL;
+	size_t retlen = 0;
+	size_t retsize = 0;
+	const char *name;
+	int fd;
+#if defined(__linux__) && defined(SYS_getdents64)
+	union {
+		char                    buf[32 * 1024];
+		struct scandir_dirent64 align;
+	} d;
+	struct scandir_dirent64 *de;
+	long n;
+	long off;
+#else
+	DIR *dirp;
+	struct dirent *de;
+#endif
+
+	fd = openat(dir_fd, dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd == -1)
+		return -1;
+
+#if defined(__linux__) && defined(SYS_getdents64)
+	while ((n = syscall(SYS_getdents64, fd, d.buf, sizeof(d.buf))) > 0) {
+		for (off = 0; off < n; off += de->d_reclen) {
+			de = (struct scandir_dirent64 *)(d.buf + off);
+			name = de->d_name;
+			if (name[0] == '.' &&
+				(!hidden ||
+				 name[1] == '\0' ||
+				 (name[1] == '.' && name[2] == '\0')))
+				continue;
+			scandir_name_add(a, &ret, &retlen, &retsize, name);
+		}
+	}
+	close(fd);
+	if (n < 0)
+		return -1;
+#else
+	if ((dirp = fdopendir(fd)) == NULL) {
+		close(fd);
+		return -1;
+	}
+	while ((de = readdir(dirp)) != NULL) {
+		name = de->d_name;
+		if (name[0] == '.' &&
+			(!hidden ||
+			 name[1] == '\0' ||
+			 (name[1] == '.' && name[2] == '\0')))
+			continue;
+		scandir_name_add(a, &ret, &retlen, &retsize, name);
+	}
+	/* closes underlying fd */
+	closedir(dirp);
+#endif
+
+	if (sorted && retlen > 1)
+		qsort(ret, retlen, sizeof(ret[0]), scandir_name_compar);
+
+	*names = ret;
+	return (int)retlen;
+}
+
 void
 scandir_free(struct dirent **de, int cnt)
 {
@@ -15,6 +15,8 @@
 #include <fcntl.h>
 #include <dirent.h>
 
+#include "arena.h"
+
 #if !defined(HAVE_SCANDIRAT)
 int scandirat(
 		int dir_fd, const char *dir, struct dirent ***dirlist,
@@ -23,6 +25,9 @@ int scandirat(
 #endif
 
 void scandir_free(struct dirent **de, int cnt);
+int scandirat_names(
+		arena_t *a, int dir_fd, const char *dir, bool hidden, bool sorted,
+		char ***names);
 int filter_hidden(const struct dirent *de);
 int filter_self_parent(const struct dirent *de);
 
@@ -21,15 +21,24 @@
 
 typedef struct setelem_ set_elem_t;
 struct setelem_ {
-  char         *name;
+  char         *name;  /* NULL for an empty slot */
   unsigned int  hash;  /* FNV1a32 */
   void         *val;
-  set_elem_t   *next;
 };
 
-#define _SET_HASH_SIZE 128
+/* open addressing using Robin Hood probing: an element that is further
+ * away from its home slot takes the place of one that is closer to
+ * its, which keeps probe sequences short, such that lookups can stop
+ * as soon as they meet an element that is closer to home than the key
+ * would be at that point
+ * the table is a power of two in size, and grows when it is filled for
+ * more than SET_MAX_LOAD percent; it is allocated on first insert, for
+ * many sets are created that never see any elements */
+#define SET_MIN_SIZE  8
+#define SET_MAX_LOAD  80
 struct set_ {
-  set_elem_t *buckets[_SET_HASH_SIZE];
+  set_elem_t *slots;
+  size_t      size;
   size_t      len;
 };
 
@@ -42,6 +51,99 @@ fnv1a32(const char *s)
   return ret;
 }
 
+/* distance of the element in slot pos from its home slot */
+#define SET_DIST(Q,H,P)  (((P) - ((H) & ((Q)->size - 1))) & ((Q)->size - 1))
+
+/* puts elem in the table, which must have room for it, returns the
+ * slot elem ended up in */
+static set_elem_t *set_place
+(
+  set_t      *q,
+  set_elem_t  elem
+)
+{
+  set_elem_t *ret  = NULL;
+  size_t      mask = q->size - 1;
+  size_t      pos  = elem.hash & mask;
+  size_t      dist = 0;
+  size_t      edist;
+
+  for (;; pos = (pos + 1) & mask, dist++)
+  {
+    set_elem_t *w = &q->slots[pos];
+
+    if (w->name == NULL)
+    {
+      *w = elem;
+      return ret == NULL ? w : ret;
+    }
+
+    edist = SET_DIST(q, w->hash, pos);
+    if (edist < dist)
+    {
+      /* take from the rich, continue with the displaced element */
+      set_elem_t t = *w;
+      *w   = elem;
+      elem = t;
+      dist = edist;
+      if (ret == NULL)
+        ret = w;
+    }
+  }
+}
+
+/* makes sure there is room for one more element */
+static void set_reserve
+(
+  set_t *q
+)
+{
+  set_elem_t *old = q->slots;
+  size_t      osz = q->size;
+  size_t      i;
+
+  if (q->size != 0 &&
+      (q->len + 1) * 100 <= q->size * SET_MAX_LOAD)
+    return;
+
+  q->size  = osz == 0 ? SET_MIN_SIZE : osz * 2;
+  q->slots = xzalloc(sizeof(q->slots[0]) * q->size);
+  for (i = 0; i < osz; i++)
+    if (old[i].name != NULL)
+      set_place(q, old[i]);
+  free(old);
+}
+
+/* returns the slot holding name, or NULL if absent */
+static set_elem_t *set_find
+(
+  set_t        *q,
+  const char   *name,
+  unsigned int  hash
+)
+{
+  size_t mask;
+  size_t pos;
+  size_t dist;
+
+  if (q == NULL ||
+      q->len == 0)
+    return NULL;
+
+  mask = q->size - 1;
+  for (pos = hash & mask, dist = 0; ; pos = (pos + 1) & mask, dist++)
+  {
+    set_elem_t *w = &q->slots[pos];
+
+    if (w->name == NULL ||
+        SET_DIST(q, w->hash, pos) < dist)
+      return NULL;
+    if (w->hash == hash &&
+        strcmp(w->name, name) == 0)
+      return w;
+  }
+}
+
 /* create a set */
 set_t *set_new
 (
@@ -58,27 +160,17 @@ set_t *set_add
   const char *key
 )
 {
-  set_elem_t *ll = xzalloc(sizeof(*ll));
-  set_elem_t *w;
-  int         pos;
+  set_elem_t elem;
 
   if (s == NULL)
     s = set_new();
 
-  ll->name = xstrdup(key);
-  ll->hash = fnv1a32(ll->name);
+  elem.name = xstrdup(key);
+  elem.hash = fnv1a32(elem.name);
+  elem.val  = NULL;
 
-  pos = ll->hash % _SET_HASH_SIZE;
-  if (s->buckets[pos] == NULL)
-  {
-    s->buckets[pos] = ll;
-  }
-  else
-  {
-    for (w = s->buckets[pos]; w->next != NULL; w = w->next)
-      ;
-    w->next = ll;
-  }
+  set_reserve(s);
+  set_place(s, elem);
 
   s->len++;
   return s;
@@ -92,49 +184,25 @@ set_t *set_add_unique
   bool       *unique
 )
 {
-  set_elem_t  *ll;
-  set_elem_t  *w;
+  set_elem_t   elem;
   unsigned int hash;
-  int          pos;
   bool         uniq = false;
 
   if (q == NULL)
     q = set_new();
 
   hash = fnv1a32(name);
-  pos  = hash % _SET_HASH_SIZE;
-
-  if (q->buckets[pos] == NULL)
+  if (set_find(q, name, hash) == NULL)
   {
-    q->buckets[pos] = ll = xzalloc(sizeof(*ll));
+    elem.name = xstrdup(name);
+    elem.hash = hash;
+    elem.val  = NULL;
 
-    ll->name = xstrdup(name);
-    ll->hash = hash;
+    set_reserve(q);
+    set_place(q, elem);
 
     uniq = true;
   }
-  else
-  {
-    ll = NULL;
-    for (w = q->buckets[pos]; w != NULL; ll = w, w = w->next)
-    {
-      if (w->hash == hash &&
-          strcmp(w->name, name) == 0)
-      {
-        uniq = false;
-        break;
-      }
-    }
-    if (w == NULL)
-    {
-      ll = ll->next = xzalloc(sizeof(*ll));
-
-      ll->name = xstrdup(name);
-      ll->hash = hash;
-
-      uniq = true;
-    }
-  }
 
   if (uniq)
     q->len++;
@@ -196,32 +264,14 @@ const char *set_get
   const char *name
 )
 {
-  set_elem_t   *w;
-  const char   *found;
-  unsigned int  hash;
-  int           pos;
+  set_elem_t *w;
 
   if (q == NULL)
     return NULL;
 
-  hash = fnv1a32(name);
-  pos  = hash % _SET_HASH_SIZE;
+  w = set_find(q, name, fnv1a32(name));
 
-  found = NULL;
-  if (q->buckets[pos] != NULL)
-  {
-    for (w = q->buckets[pos]; w != NULL; w = w->next)
-    {
-      if (w->hash == hash &&
-          strcmp(w->name, name) == 0)
-      {
-        found = w->name;
-        break;
-      }
-    }
-  }
-
-  return found;
+  return w == NULL ? NULL : w->name;
 }
 
 /* remove elem from a set. matches ->name and frees name,item, returns
@@ -236,54 +286,35 @@ void *set_delete
   bool       *removed
 )
 {
-  set_elem_t  *ll;
-  set_elem_t  *w;
-  void        *ret;
-  unsigned int hash;
-  int          pos;
-  bool         rmd;
+  set_elem_t *w;
+  void       *ret = NULL;
+  size_t      mask;
+  size_t      pos;
+  size_t      next;
 
-  if (q == NULL)
+  w = q == NULL ? NULL : set_find(q, s, fnv1a32(s));
+  if (w != NULL)
   {
-    if (removed != NULL)
-      *removed = false;
-    return NULL;
-  }
+    ret = w->val;
+    free(w->name);
+
+    /* shift the elements that follow back towards their home slot,
+     * which keeps lookups correct without leaving tombstones */
+    mask = q->size - 1;
+    pos  = w - q->slots;
+    for (next = (pos + 1) & mask;
+         q->slots[next].name != NULL &&
+         SET_DIST(q, q->slots[next].hash, next) > 0;
+         pos = next, next = (next + 1) & mask)
+      q->slots[pos] = q->slots[next];
+    q->slots[pos].name = NULL;
+    q->slots[pos].val  = NULL;
 
-  hash = fnv1a32(s);
-  pos  = hash % _SET_HASH_SIZE;
-
-  ret = NULL;
-  rmd = false;
-  if (q->buckets[pos] != NULL)
-  {
-    ll = NULL;
-    for (w = q->buckets[pos]; w != NULL; ll = w, w = w->next)
-    {
-      if (w->hash == hash &&
-          strcmp(w->name, s) == 0)
-      {
-        if (ll == NULL)
-        {
-          q->buckets[pos] = w->next;
-        }
-        else
-        {
-          ll->next = w->next;
-        }
-        ret = w->val;
-        free(w->name);
-        free(w);
-        rmd = true;
-        break;
-      }
-    }
+    q->len--;
   }
 
-  if (rmd)
-    q->len--;
   if (removed != NULL)
-    *removed = rmd;
+    *removed = w != NULL;
   return ret;
 }
 
@@ -301,24 +332,17 @@ void clear_set
   set_t *q
 )
 {
-  set_elem_t *w;
-  set_elem_t *e;
-  int         i;
+  size_t i;
 
   if (q == NULL)
     return;
 
-  for (i = 0; i < _SET_HASH_SIZE; i++)
-  {
-    for (w = q->buckets[i]; w != NULL; w = e)
-    {
-      e = w->next;
-      free(w->name);
-      free(w);
-    }
-    q->buckets[i] = NULL;
-  }
-  q->len = 0;
+  for (i = 0; i < q->size; i++)
+    free(q->slots[i].name);
+  free(q->slots);
+  q->slots = NULL;
+  q->size  = 0;
+  q->len   = 0;
 }
 
 /* clear and free a set */
@@ -335,13 +359,12 @@ void set_free(set_t *q)
 static void
 set_print(const set_t *q)
 {
-  set_elem_t *w;
-  int         i;
+  size_t i;
 
-  for (i = 0; i < _SET_HASH_SIZE; i++)
+  for (i = 0; i < q->size; i++)
   {
-    for (w = q->buckets[i]; w != NULL; w = w->next)
-      puts(w->name);
+    if (q->slots[i].name != NULL)
+      puts(q->slots[i].name);
   }
 }
 #endif
@@ -364,49 +387,32 @@ hash_t *hash_add
   void      **prevval
 )
 {
-  set_elem_t  *ll;
+  set_elem_t   elem;
   set_elem_t  *w;
   unsigned int hash;
-  int          pos;
 
   if (q == NULL)
     q = hash_new();
 
   hash = fnv1a32(key);
-  pos  = hash % _SET_HASH_SIZE;
 
   if (prevval != NULL)
     *prevval = NULL;
-  if (q->buckets[pos] == NULL)
+  if ((w = set_find(q, key, hash)) != NULL)
   {
-    q->buckets[pos] = ll = xzalloc(sizeof(*ll));
-    ll->name = xstrdup(key);
-    ll->hash = hash;
-    ll->val  = val;
-  }
-  else
-  {
-    ll = NULL;
-    for (w = q->buckets[pos]; w != NULL; ll = w, w = w->next)
-    {
-      if (w->hash == hash &&
-          strcmp(w->name, key) == 0)
-      {
-        if (prevval != NULL)
-          *prevval = w->val;
-        w->val = val;
-        return q;
-      }
-    }
-    if (w == NULL)
-    {
-      ll = ll->next = xzalloc(sizeof(*ll));
-      ll->name = xstrdup(key);
-      ll->hash = hash;
-      ll->val  = val;
-    }
+    if (prevval != NULL)
+      *prevval = w->val;
+    w->val = val;
+    return q;
   }
 
+  elem.name = xstrdup(key);
+  elem.hash = hash;
+  elem.val  = val;
+
+  set_reserve(q);
+  set_place(q, elem);
+
   q->len++;
   return q;
 }
@@ -419,27 +425,14 @@ void *hash_get
   const char *key
 )
 {
-  set_elem_t  *w;
-  unsigned int hash;
-  int          pos;
+  set_elem_t *w;
 
   if (q == NULL)
     return NULL;
 
-  hash = fnv1a32(key);
-  pos  = hash % _SET_HASH_SIZE;
-
-  if (q->buckets[pos] != NULL)
-  {
-    for (w = q->buckets[pos]; w != NULL; w = w->next)
-    {
-      if (w->hash == hash &&
-          strcmp(w->name, key) == 0)
-        return w->val;
-    }
-  }
+  w = set_find(q, key, fnv1a32(key));
 
-  return NULL;
+  return w == NULL ? NULL : w->val;
 }
 
 void *hash_delete_chk
@@ -457,18 +450,17 @@ array *hash_keys
   hash_t *h
 )
 {
-  array      *ret;
-  set_elem_t *w;
-  size_t      i;
+  array  *ret;
+  size_t  i;
 
   if (h == NULL)
     return NULL;
 
   ret = array_new();
-  for (i = 0; i < _SET_HASH_SIZE; i++)
+  for (i = 0; i < h->size; i++)
   {
-    for (w = h->buckets[i]; w != NULL; w = w->next)
-      array_append(ret, w->name);
+    if (h->slots[i].name != NULL)
+      array_append(ret, h->slots[i].name);
   }
 
   return ret;
@@ -479,18 +471,17 @@ array *hash_values
   hash_t *h
 )
 {
-  array      *ret;
-  set_elem_t *w;
-  size_t      i;
+  array  *ret;
+  size_t  i;
 
   if (h == NULL)
     return NULL;
 
   ret = array_new();
-  for (i = 0; i < _SET_HASH_SIZE; i++)
+  for (i = 0; i < h->size; i++)
   {
-    for (w = h->buckets[i]; w != NULL; w = w->next)
-      array_append(ret, w->val);
+    if (h->slots[i].name != NULL)
+      array_append(ret, h->slots[i].val);
   }
 
   return ret;
@@ -501,7 +492,7 @@ size_t hash_size
   hash_t *h
 )
 {
-  return h->len;
+  return h == NULL ? 0 : h->len;
 }
 
 void hash_clear
@@ -520,4 +511,271 @@ void hash_free
   set_free((set_t *)h);
 }
 
+/* integer keyed variant {{{ */
+/* same scheme as above, but since there are no strings to compare or
+ * free, the keys live in the slots directly; a slot is in use when its
+ * hash has the top bit set, which is never used for the home slot */
+typedef struct isetelem_ iset_elem_t;
+struct isetelem_ {
+  uint64_t      hi;
+  uint64_t      lo;
+  unsigned int  hash;  /* 0 for an empty slot */
+  void         *val;
+};
+
+struct iset_ {
+  iset_elem_t *slots;
+  size_t       size;
+  size_t       len;
+};
+
+#define ISET_USED  0x80000000U
+
+static unsigned int
+iset_hash(uint64_t hi, uint64_t lo)
+{
+  /* murmur3 finaliser over both halves, inodes tend to be sequential
+   * so their low bits need spreading over the whole word */
+  uint64_t h = lo ^ (hi * 0x9e3779b97f4a7c15ULL);
+
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+
+  return (unsigned int)h | ISET_USED;
+}
+
+static iset_elem_t *iset_place
+(
+  iset_t      *q,
+  iset_elem_t  elem
+)
+{
+  iset_elem_t *ret  = NULL;
+  size_t       mask = q->size - 1;
+  size_t       pos  = elem.hash & mask;
+  size_t       dist = 0;
+  size_t       edist;
+
+  for (;; pos = (pos + 1) & mask, dist++)
+  {
+    iset_elem_t *w = &q->slots[pos];
+
+    if (w->hash == 0)
+    {
+      *w = elem;
+      return ret == NULL ? w : ret;
+    }
+
+    edist = SET_DIST(q, w->hash, pos);
+    if (edist < dist)
+    {
+      iset_elem_t t = *w;
+      *w   = elem;
+      elem = t;
+      dist = edist;
+      if (ret == NULL)
+        ret = w;
+    }
+  }
+}
+
+static void iset_reserve
+(
+  iset_t *q
+)
+{
+  iset_elem_t *old = q->slots;
+  size_t       osz = q->size;
+  size_t       i;
+
+  if (q->size != 0 &&
+      (q->len + 1) * 100 <= q->size * SET_MAX_LOAD)
+    return;
+
+  q->size  = osz == 0 ? SET_MIN_SIZE : osz * 2;
+  q->slots = xzalloc(sizeof(q->slots[0]) * q->size);
+  for (i = 0; i < osz; i++)
+    if (old[i].hash != 0)
+      iset_place(q, old[i]);
+  free(old);
+}
+
+static iset_elem_t *iset_find
+(
+  iset_t       *q,
+  uint64_t      hi,
+  uint64_t      lo,
+  unsigned int  hash
+)
+{
+  size_t mask;
+  size_t pos;
+  size_t dist;
+
+  if (q == NULL ||
+      q->len == 0)
+    return NULL;
+
+  mask = q->size - 1;
+  for (pos = hash & mask, dist = 0; ; pos = (pos + 1) & mask, dist++)
+  {
+    iset_elem_t *w = &q->slots[pos];
+
+    if (w->hash == 0 ||
+        SET_DIST(q, w->hash, pos) < dist)
+      return NULL;
+    if (w->hash == hash &&
+        w->lo == lo &&
+        w->hi == hi)
+      return w;
+  }
+}
+
+iset_t *iset_new
+(
+  void
+)
+{
+  return xzalloc(sizeof(iset_t));
+}
+
+/* inserts the (hi,lo) key if it isn't present yet, unique is set to
+ * whether that happened */
+iset_t *iset_add_unique
+(
+  iset_t   *q,
+  uint64_t  hi,
+  uint64_t  lo,
+  bool     *unique
+)
+{
+  iset_elem_t  elem;
+  unsigned int hash;
+  bool         uniq = false;
+
+  if (q == NULL)
+    q = iset_new();
+
+  hash = iset_hash(hi, lo);
+  if (iset_find(q, hi, lo, hash) == NULL)
+  {
+    elem.hi   = hi;
+    elem.lo   = lo;
+    elem.hash = hash;
+    elem.val  = NULL;
+
+    iset_reserve(q);
+    iset_place(q, elem);
+
+    q->len++;
+    uniq = true;
+  }
+
+  if (unique != NULL)
+    *unique = uniq;
+  return q;
+}
+
+bool iset_contains
+(
+  iset_t   *q,
+  uint64_t  hi,
+  uint64_t  lo
+)
+{
+  return iset_find(q, hi, lo, iset_hash(hi, lo)) != NULL;
+}
+
+size_t iset_size
+(
+  iset_t *q
+)
+{
+  return q == NULL ? 0 : q->len;
+}
+
+void iset_clear
+(
+  iset_t *q
+)
+{
+  if (q == NULL)
+    return;
+
+  free(q->slots);
+  q->slots = NULL;
+  q->size  = 0;
+  q->len   = 0;
+}
+
+void iset_free
+(
+  iset_t *q
+)
+{
+  if (q == NULL)
+    return;
+
+  iset_clear(q);
+  free(q);
+}
+
+/* like hash_add: store val under (hi,lo), replacing and returning via
+ * prevval any previous value */
+ihash_t *ihash_add
+(
+  ihash_t   *q,
+  uint64_t   hi,
+  uint64_t   lo,
+  void      *val,
+  void     **prevval
+)
+{
+  iset_elem_t  elem;
+  iset_elem_t *w;
+  unsigned int hash;
+
+  if (q == NULL)
+    q = iset_new();
+
+  hash = iset_hash(hi, lo);
+
+  if (prevval != NULL)
+    *prevval = NULL;
+  if ((w = iset_find(q, hi, lo, hash)) != NULL)
+  {
+    if (prevval != NULL)
+      *prevval = w->val;
+    w->val = val;
+    return q;
+  }
+
+  elem.hi   = hi;
+  elem.lo   = lo;
+  elem.hash = hash;
+  elem.val  = val;
+
+  iset_reserve(q);
+  iset_place(q, elem);
+
+  q->len++;
+  return q;
+}
+
+void *ihash_get
+(
+  ihash_t  *q,
+  uint64_t  hi,
+  uint64_t  lo
+)
+{
+  iset_elem_t *w = iset_find(q, hi, lo, iset_hash(hi, lo));
+
+  return w == NULL ? NULL : w->val;
+}
+/* }}} */
+
 /* vim: set ts=2 sw=2 expandtab cino+=\:0 foldmethod=marker: */
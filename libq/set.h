@@ -7,6 +7,7 @@
 #define _SET_H 1
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <unistd.h>
 
 #include "array.h"
@@ -38,6 +39,24 @@ size_t  hash_size(hash_t *h);
 void    hash_clear(hash_t *h);
 void    hash_free(hash_t *h);
 
+/* integer keyed set/dict, keys are 128-bits wide to hold pairs such
+ * as (st_dev, st_ino) without conversion to string */
+typedef struct iset_ iset_t;
+iset_t *iset_new(void);
+iset_t *iset_add_unique(iset_t *s, uint64_t hi, uint64_t lo, bool *unique);
+bool    iset_contains(iset_t *s, uint64_t hi, uint64_t lo);
+size_t  iset_size(iset_t *s);
+void    iset_clear(iset_t *s);
+void    iset_free(iset_t *s);
+typedef struct iset_ ihash_t;
+#define ihash_new()            iset_new()
+ihash_t *ihash_add(ihash_t *h, uint64_t hi, uint64_t lo,
+                   void *val, void **prevval);
+void    *ihash_get(ihash_t *h, uint64_t hi, uint64_t lo);
+#define ihash_size(H)          iset_size(H)
+#define ihash_clear(H)         iset_clear(H)
+#define ihash_free(H)          iset_free(H)
+
 /* backwards compat aliases and funcs */
 typedef struct set_ set;
 #define create_set(X)          set_new(X)
@@ -12,14 +12,18 @@
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <ctype.h>
 #include <xalloc.h>
 
-#if defined(ENABLE_GPKG) || defined(ENABLE_GTREE)
+#if defined(ENABLE_GPKG) || defined(ENABLE_GTREE) || \
+    defined(HAVE_LIBARCHIVE)
 # include <archive.h>
 # include <archive_entry.h>
 #endif
 
+#include "arena.h"
+#include "intern.h"
 #include "atom.h"
 #include "eat_file.h"
 #include "hash.h"
@@ -27,6 +31,7 @@
 #include "scandirat.h"
 #include "set.h"
 #include "tree.h"
+#include "xmkdir.h"
 #include "xpak.h"
 
 /* 2026 rewrite
@@ -83,7 +88,25 @@ struct tree_ {
   char          *path;
   char          *repo;
   array         *cats;         /* list of tree_cat_ctx pointers */
+  arena_t       *arena;        /* backing store for cats, pkgs and meta */
+  intern_t      *strs;         /* pool for meta values shared by pkgs */
+  uint64_t       keys;         /* meta keys parsers retain */
   array         *srctrees;     /* in case of TREE_MERGED */
+  void          *vdbidx;       /* mapped VDB index, if any */
+  size_t         vdbidx_len;
+  char          *gtidx;        /* gtree caches.idx contents */
+  array         *gtidx_ents;   /* sorted CAT/PN keys into gtidx */
+  set_t         *gtloaded;     /* CAT/PN decoded from caches.pack */
+  off_t          gtpack_off;   /* start of caches.pack in the container */
+  size_t         gtpack_len;
+  void          *md5memo;      /* mapped md5-cache validation memo */
+  size_t         md5memo_len;
+  struct tree_md5memo_ent *md5memo_new;  /* validated during this run */
+  size_t         md5memo_nnew;
+  size_t         md5memo_snew;
+  bool           md5memo_read; /* not a bitfield, set concurrently */
+  hash_t        *eclasses;     /* eclass name -> md5 digest of its file */
+  enum tree_validate validate;
   int            portroot_fd;
   enum {
     TREE_UNSET = 0,
@@ -95,12 +118,15 @@ struct tree_ {
     TREE_MERGED,
   }              type;
   bool           cats_complete:1;
+  bool           parallel:1;   /* populate category caches concurrently */
+  bool           gtidx_read:1;
 };
 
 struct tree_cat_ {
   tree_ctx      *tree;
   char          *name;
   array         *pkgs;         /* list of tree_pkg_ctx pointers */
+  struct timespec mtime;       /* of the directory when read */
   bool           pkgs_complete:1;
 };
 
@@ -114,8 +140,158 @@ struct tree_pkg_ {
   bool           meta_complete:1;
   bool           cache_invalid:1;
   bool           binpkg_gpkg:1;
+  bool           vdb_indexed:1;
 };
 
+/* see tree_set_validation */
+static enum tree_validate tree_validate_default = TREE_VALIDATE_MEMO;
+
+static const char *tree_meta_key_name[] = {
+  "unknown",
+  TREE_META_KEYS(TREE_META_KEY_NAME)
+};
+
+/* values practically unique to each package, pooling these would only
+ * grow the intern table without saving anything */
+static const bool tree_meta_unique[TREE_META_MAX_KEYS] = {
+  [Q_CONTENTS]    = true,
+  [Q_BUILD_ID]    = true,
+  [Q_PATH]        = true,
+  [Q_MD5]         = true,
+  [Q_SHA1]        = true,
+  [Q_SIZE]        = true,
+  [Q__md5_]       = true,
+};
+
+/* stores a meta value in the tree, values that are likely to be shared
+ * between packages (SLOT, LICENSE, KEYWORDS, IUSE, dependencies, ...)
+ * are interned, hence meta values must never be modified */
+static char *tree_meta_memdup
+(
+  tree_ctx   *tree,
+  size_t      key,
+  const char *val,
+  size_t      len
+)
+{
+  if (key < TREE_META_MAX_KEYS &&
+      tree_meta_unique[key])
+    return arena_memdup(tree->arena, val, len);
+  return intern_mem(tree->strs, val, len);
+}
+
+static char *tree_meta_strdup
+(
+  tree_ctx   *tree,
+  size_t      key,
+  const char *val
+)
+{
+  return tree_meta_memdup(tree, key, val, strlen(val));
+}
+
+/* whether parsers should retain the value for key, see tree_set_keys */
+static inline bool tree_meta_wanted
+(
+  tree_ctx *tree,
+  size_t    key
+)
+{
+  return (tree->keys & ((uint64_t)1 << key)) != 0;
+}
+
+/* key dispatch for all cache parsers: the key names from
+ * TREE_META_KEYS are hashed on their length and first and last
+ * character, which yields distinct slots for all of them, so a lookup
+ * costs a single hash and memcmp; C doesn't allow to compute this from
+ * the string literals at compile time, so the table is filled in on
+ * first use, should a new key collide, it is simply stored in the next
+ * slot, which keeps lookups correct */
+#define TREE_META_HASH_SIZE 64
+#define TREE_META_HASH(K,L) \
+  (((L) * 9 + \
+    (unsigned char)(K)[0] * 7 + \
+    (unsigned char)(K)[(L) - 1] * 2) & (TREE_META_HASH_SIZE - 1))
+#define TREE_META_KEY_LEN(E)  sizeof(#E) - 1,
+
+static const size_t tree_meta_key_len[] = {
+  0,
+  TREE_META_KEYS(TREE_META_KEY_LEN)
+};
+static unsigned char tree_meta_hash[TREE_META_HASH_SIZE];
+
+static void tree_meta_hash_init(void)
+{
+  size_t k;
+  size_t h;
+
+  if (tree_meta_hash[TREE_META_HASH(tree_meta_key_name[Q_SLOT],
+                                    tree_meta_key_len[Q_SLOT])] != 0)
+    return;  /* done before */
+
+  for (k = Q_UNKNOWN + 1; k < TREE_META_MAX_KEYS; k++)
+  {
+    for (h = TREE_META_HASH(tree_meta_key_name[k], tree_meta_key_len[k]);
+         tree_meta_hash[h] != Q_UNKNOWN;
+         h = (h + 1) & (TREE_META_HASH_SIZE - 1))
+      ;
+    tree_meta_hash[h] = (unsigned char)k;
+  }
+}
+
+/* returns the meta key named by the len bytes at key, or Q_UNKNOWN */
+static size_t tree_meta_key
+(
+  const char *key,
+  size_t      len
+)
+{
+  size_t h;
+  size_t k;
+
+  if (len == 0)
+    return Q_UNKNOWN;
+
+  for (h = TREE_META_HASH(key, len);
+       (k = tree_meta_hash[h]) != Q_UNKNOWN;
+       h = (h + 1) & (TREE_META_HASH_SIZE - 1))
+  {
+    if (tree_meta_key_len[k] == len &&
+        memcmp(tree_meta_key_name[k], key, len) == 0)
+      return k;
+  }
+
+  return Q_UNKNOWN;
+}
+
+/* the variables ebuilds assign that we (can) retrieve from them */
+#define TREE_META_EBUILD_KEYS \
+  (TREE_KEY(BDEPEND) | TREE_KEY(CDEPEND) | TREE_KEY(DEPEND) | \
+   TREE_KEY(DESCRIPTION) | TREE_KEY(EAPI) | TREE_KEY(HOMEPAGE) | \
+   TREE_KEY(IDEPEND) | TREE_KEY(IUSE) | TREE_KEY(KEYWORDS) | \
+   TREE_KEY(LICENSE) | TREE_KEY(PDEPEND) | TREE_KEY(PROPERTIES) | \
+   TREE_KEY(RDEPEND) | TREE_KEY(REQUIRED_USE) | TREE_KEY(RESTRICT) | \
+   TREE_KEY(SLOT) | TREE_KEY(SRC_URI))
+
+/* stores val for key in pkg, unless it is unknown, already set, or not
+ * wanted by the caller */
+static void tree_pkg_meta_store
+(
+  tree_ctx     *tree,
+  tree_pkg_ctx *pkg,
+  size_t        key,
+  const char   *val,
+  size_t        len
+)
+{
+  if (key == Q_UNKNOWN ||
+      pkg->meta[key] != NULL ||
+      !tree_meta_wanted(tree, key))
+    return;
+
+  pkg->meta[key] = tree_meta_memdup(tree, key, val, len);
+}
+
 #ifdef ENABLE_GTREE
 static tree_ctx *tree_new_gtree
 (
@@ -150,7 +326,9 @@ static tree_ctx *tree_new_gtree
     return NULL;
   }
 
-  if (strcmp(archive_entry_pathname(entry), "gtree-1") != 0)
+  /* gtree-2 is gtree-1 plus an index for random access */
+  if (strcmp(archive_entry_pathname(entry), "gtree-1") != 0 &&
+      strcmp(archive_entry_pathname(entry), "gtree-2") != 0)
   {
     if (!quiet)
       warn("could not open gtree '/%s': not a gtree container", ctx->path);
@@ -207,228 +385,1439 @@ static int tree_gtree_close_cb
   (void)a;
   (void)cctx;
 
-  /* noop */
-  return ARCHIVE_OK;
+  /* noop */
+  return ARCHIVE_OK;
+}
+
+/* returns the category named name from the cache, creating it when it
+ * doesn't exist yet */
+static tree_cat_ctx *tree_gtree_get_cat
+(
+  tree_ctx   *tree,
+  const char *name
+)
+{
+  tree_cat_ctx *cat;
+  size_t        n;
+
+  if (tree->cats == NULL)
+    tree->cats = array_new();
+
+  array_for_each(tree->cats, n, cat)
+  {
+    if (strcmp(cat->name, name) == 0)
+      return cat;
+  }
+
+  cat       = arena_zalloc(tree->arena, sizeof(*cat));
+  cat->name = arena_strdup(tree->arena, name);
+  cat->tree = tree;
+  cat->pkgs = array_new();
+  array_append(tree->cats, cat);
+
+  return cat;
+}
+
+/* parses the contents of a caches/{CAT}/{PF} member into a new pkg in
+ * cat, data is modified in the process */
+static tree_pkg_ctx *tree_gtree_read_cache
+(
+  tree_cat_ctx   *cat,
+  atom_ctx       *atom,
+  char           *data
+)
+{
+  char          buf[_Q_PATH_MAX];
+  tree_ctx     *tree    = cat->tree;
+  tree_pkg_ctx *pkg;
+  char         *nexttok = NULL;
+  char         *p;
+
+  /* we point to the ebuild, so it looks like md5-cache */
+  snprintf(buf, sizeof(buf), "%s/ebuilds/%s/%s/%s.ebuild",
+           tree->path, atom->CATEGORY, atom->PN, atom->PF);
+
+  pkg = arena_zalloc(tree->arena, sizeof(*pkg));
+  pkg->name = arena_strdup(tree->arena, atom->PN);
+  pkg->path = arena_strdup(tree->arena, buf);
+  pkg->atom = atom;
+  pkg->cat  = cat;
+  array_append(cat->pkgs, pkg);
+
+  /* entries are strictly single line, starting with KEY= (no
+   * whitespace) */
+  for (p = strtok_r(data, "=", &nexttok);
+       p != NULL;
+       p = strtok_r(NULL, "=", &nexttok))
+  {
+    char *key = p;
+
+    /* always advance to end of line */
+    p = strtok_r(NULL, "\n", &nexttok);
+    if (p == NULL)
+      break;  /* end of input */
+
+    tree_pkg_meta_store(tree, pkg, tree_meta_key(key, strlen(key)),
+                        p, strlen(p));
+  }
+
+  pkg->meta_complete = true;
+
+  return pkg;
+}
+
+/* full reads of a gtree are pipelined: the decoder decompresses and
+ * unpacks the repo.tar stream into a ring of large buffers, handing
+ * each filled buffer to a task that parses the cache entries from it
+ * into the tree, these tasks run one after the other, in order, while
+ * the decoder continues with the next buffer */
+#define TREE_GTREE_BLKSIZE    (1024 * 1024)
+#define TREE_GTREE_RING_SLOTS 8
+#define TREE_GTREE_SLOT_SIZE  (256 * 1024)
+
+struct tree_gtree_ring {
+  tree_ctx     *tree;
+  tree_cat_ctx *cat;                               /* parser state */
+  char         *bufs[TREE_GTREE_RING_SLOTS];
+  size_t        lens[TREE_GTREE_RING_SLOTS];
+  size_t        sizs[TREE_GTREE_RING_SLOTS];
+  size_t        head;                              /* slots filled */
+};
+
+/* parses a ring slot, a sequence of "caches/{CAT}/{PF}\0{data}\0" */
+static void tree_gtree_parse_slot
+(
+  struct tree_gtree_ring *ring,
+  char                   *buf,
+  size_t                  len
+)
+{
+  char          key[_Q_PATH_MAX];
+  tree_ctx     *tree = ring->tree;
+  atom_ctx     *atom;
+  char         *end  = buf + len;
+  char         *name;
+  char         *data;
+
+  while (buf < end)
+  {
+    name  = buf;
+    buf  += strlen(buf) + 1;
+    data  = buf;
+    buf  += strlen(buf) + 1;
+
+    atom = atom_explode(name + (sizeof("caches/") - 1));
+
+    if (ring->cat == NULL ||
+        strcmp(ring->cat->name, atom->CATEGORY) != 0)
+    {
+      ring->cat = tree_gtree_get_cat(tree, atom->CATEGORY);
+      /* not yet, but will be */
+      ring->cat->pkgs_complete = true;
+    }
+
+    if (tree->gtloaded != NULL)
+    {
+      snprintf(key, sizeof(key), "%s/%s", atom->CATEGORY, atom->PN);
+      if (set_contains(tree->gtloaded, key))
+      {
+        atom_implode(atom);
+        continue;
+      }
+    }
+
+    tree_gtree_read_cache(ring->cat, atom, data);
+  }
+}
+
+/* hands the current slot over to the parser, and makes the next slot
+ * current, waiting for the parser to release it if necessary, without
+ * OpenMP this simply parses the slot in place */
+static void tree_gtree_ring_push
+(
+  struct tree_gtree_ring *ring
+)
+{
+  size_t  slot = ring->head % TREE_GTREE_RING_SLOTS;
+  char   *buf  = ring->bufs[slot];
+  size_t  len  = ring->lens[slot];
+
+  (void)buf;  /* unused without OpenMP */
+  (void)len;
+
+#pragma omp task firstprivate(ring, buf, len) \
+  depend(inout: ring->cat) depend(in: ring->bufs[slot])
+  tree_gtree_parse_slot(ring, buf, len);
+
+  ring->head++;
+  slot = ring->head % TREE_GTREE_RING_SLOTS;
+
+#pragma omp taskwait depend(inout: ring->bufs[slot])
+  ring->lens[slot] = 0;
+}
+
+/* decompression stage: unpacks the cache entries from inner, when
+ * called from a parallel region, the entries are parsed in tasks */
+static void tree_gtree_decode
+(
+  struct tree_gtree_ring *ring,
+  struct archive         *inner
+)
+{
+  struct archive_entry *entry;
+  tree_ctx             *tree        = ring->tree;
+  bool                  foundcaches = false;
+  size_t                slot;
+  size_t                nlen;
+  size_t                dlen;
+  size_t                need;
+  char                 *p;
+
+  while (archive_read_next_header(inner, &entry) == ARCHIVE_OK)
+  {
+    const char *fname = archive_entry_pathname(entry);
+
+    if (fname == NULL)
+      continue;
+
+    if (tree->repo == NULL &&
+        strcmp(fname, "repository") == 0)
+    {
+      /* fill in repo, so it can be used when requested */
+      dlen = archive_entry_size(entry);
+      tree->repo = xmalloc(dlen + 1);
+      archive_read_data(inner, tree->repo, dlen);
+      tree->repo[dlen] = '\0';
+    }
+    else if (strncmp(fname, "caches/", sizeof("caches/") - 1) == 0)
+    {
+      foundcaches = true;
+
+      slot = ring->head % TREE_GTREE_RING_SLOTS;
+      nlen = strlen(fname) + 1;
+      dlen = archive_entry_size(entry);
+      need = ring->lens[slot] + nlen + dlen + 1;
+      if (need > ring->sizs[slot])
+      {
+        ring->sizs[slot] = need > TREE_GTREE_SLOT_SIZE ?
+                           need : TREE_GTREE_SLOT_SIZE;
+        ring->bufs[slot] = xrealloc(ring->bufs[slot], ring->sizs[slot]);
+      }
+
+      p = ring->bufs[slot] + ring->lens[slot];
+      memcpy(p, fname, nlen);
+      p += nlen;
+      if (archive_read_data(inner, p, dlen) != (la_ssize_t)dlen)
+        continue;
+      p[dlen] = '\0';
+      ring->lens[slot] = need;
+
+      if (need >= TREE_GTREE_SLOT_SIZE)
+        tree_gtree_ring_push(ring);
+    }
+    else if (foundcaches)
+    {
+      break;  /* stop searching if we processed all cache entries */
+    }
+  }
+
+  slot = ring->head % TREE_GTREE_RING_SLOTS;
+  if (ring->lens[slot] > 0)
+    tree_gtree_ring_push(ring);
+
+#pragma omp taskwait
+}
+
+static int tree_foreach_pkg_gtree
+(
+  tree_ctx       *tree
+)
+{
+  struct archive           *outer;
+  struct archive           *inner;
+  struct archive_entry     *entry;
+  struct tree_gtree_cb_ctx  cb_ctx;
+  struct tree_gtree_ring    ring;
+  size_t                    n;
+  int                       fd;
+
+  fd = openat(tree->portroot_fd, tree->path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return 1;
+
+  outer = archive_read_new();
+  archive_read_support_format_all(outer);  /* don't see why not */
+  if (archive_read_open_fd(outer, fd, TREE_GTREE_BLKSIZE) != ARCHIVE_OK)
+  {
+    warn("unable to read gtree container: %s",
+         archive_error_string(outer));
+    archive_read_free(outer);
+    close(fd);
+    return 1;
+  }
+
+  while (archive_read_next_header(outer, &entry) == ARCHIVE_OK)
+  {
+    const char *fname = archive_entry_pathname(entry);
+    if (fname == NULL)
+      continue;
+    if (strncmp(fname, "repo.tar", sizeof("repo.tar") - 1) == 0 &&
+        (fname[sizeof("repo.tar") - 1] == '.' ||
+         fname[sizeof("repo.tar") - 1] == '\0'))
+      break;
+    entry = NULL;
+  }
+  if (entry == NULL) {
+    archive_read_free(outer);
+    close(fd);
+    return 1;
+  }
+
+  /* we always read all cats, but directed queries may have decoded
+   * some packages already via the index, those we keep and skip here
+   * such that pointers handed out before remain valid */
+  if (tree->cats == NULL)
+    tree->cats = array_new();
+
+  /* use wrapper to read straight from this archive */
+  inner = archive_read_new();
+  archive_read_support_format_all(inner);
+  archive_read_support_filter_all(inner);
+  VAL_CLEAR(cb_ctx);
+  cb_ctx.archive = outer;
+  if (archive_read_open(inner, &cb_ctx, NULL,
+                        tree_gtree_read_cb,
+                        tree_gtree_close_cb) != ARCHIVE_OK)
+    warn("unable to read gtree data %s: %s", archive_entry_pathname(entry),
+         archive_error_string(inner));
+
+  VAL_CLEAR(ring);
+  ring.tree = tree;
+
+  /* the second thread runs the parse tasks, with just one thread the
+   * tasks run as soon as they are created */
+#pragma omp parallel num_threads(2)
+#pragma omp single
+  tree_gtree_decode(&ring, inner);
+
+  for (n = 0; n < TREE_GTREE_RING_SLOTS; n++)
+    free(ring.bufs[n]);
+
+  archive_read_free(inner);
+  archive_read_free(outer);
+  close(fd);
+
+  tree->cats_complete = true;
+
+  return 0;
+}
+
+/* gtree index {{{
+ * gtree-2 containers carry a sorted list of CAT/PN (caches.idx) that
+ * points into a series of independently compressed frames
+ * (caches.pack), such that directed lookups need not decode the whole
+ * of repo.tar */
+
+/* reads the repository name from the repo.tar member outer is
+ * positioned at, it is the first member so this is cheap */
+static void tree_gtree_read_repo
+(
+  tree_ctx       *tree,
+  struct archive *outer
+)
+{
+  struct tree_gtree_cb_ctx  cb_ctx;
+  struct archive           *inner;
+  struct archive_entry     *entry;
+  const char               *fname;
+  size_t                    len;
+
+  inner = archive_read_new();
+  archive_read_support_format_all(inner);
+  archive_read_support_filter_all(inner);
+  VAL_CLEAR(cb_ctx);
+  cb_ctx.archive = outer;
+  if (archive_read_open(inner, &cb_ctx, NULL,
+                        tree_gtree_read_cb,
+                        tree_gtree_close_cb) == ARCHIVE_OK &&
+      archive_read_next_header(inner, &entry) == ARCHIVE_OK &&
+      (fname = archive_entry_pathname(entry)) != NULL &&
+      strcmp(fname, "repository") == 0)
+  {
+    len = archive_entry_size(entry);
+    tree->repo = xmalloc(len + 1);
+    archive_read_data(inner, tree->repo, len);
+    tree->repo[len] = '\0';
+  }
+  archive_read_free(inner);
+}
+
+/* loads the index of the gtree, returns false if there is none */
+static bool tree_gtree_index_load
+(
+  tree_ctx *tree
+)
+{
+  struct archive       *outer;
+  struct archive_entry *entry;
+  char                 *p;
+  char                 *q;
+  size_t                len;
+  int                   fd;
+
+  if (tree->gtidx_read)
+    return tree->gtidx_ents != NULL;
+  tree->gtidx_read = true;
+
+  fd = openat(tree->portroot_fd, tree->path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return false;
+
+  outer = archive_read_new();
+  archive_read_support_format_all(outer);
+  if (archive_read_open_fd(outer, fd, BUFSIZ) != ARCHIVE_OK)
+  {
+    archive_read_free(outer);
+    close(fd);
+    return false;
+  }
+
+  /* members are ustar, data thus follows its header directly, and the
+   * uncompressed container allows skipping over repo.tar cheaply */
+  while (archive_read_next_header(outer, &entry) == ARCHIVE_OK)
+  {
+    const char *fname = archive_entry_pathname(entry);
+
+    if (fname == NULL)
+      continue;
+
+    if (strcmp(fname, "gtree-1") == 0)
+      break;  /* no index in this revision */
+    else if (tree->repo == NULL &&
+             strncmp(fname, "repo.tar", sizeof("repo.tar") - 1) == 0 &&
+             (fname[sizeof("repo.tar") - 1] == '.' ||
+              fname[sizeof("repo.tar") - 1] == '\0'))
+      tree_gtree_read_repo(tree, outer);
+    else if (strcmp(fname, "caches.idx") == 0)
+    {
+      len = archive_entry_size(entry);
+      tree->gtidx = xmalloc(len + 1);
+      if (archive_read_data(outer, tree->gtidx, len) != (la_ssize_t)len)
+        break;
+      tree->gtidx[len] = '\0';
+    }
+    else if (strcmp(fname, "caches.pack") == 0)
+    {
+      tree->gtpack_off = archive_read_header_position(outer) + 512;
+      tree->gtpack_len = archive_entry_size(entry);
+      break;
+    }
+  }
+
+  archive_read_free(outer);
+  close(fd);
+
+  if (tree->gtidx == NULL ||
+      tree->gtpack_off == 0)
+  {
+    free(tree->gtidx);
+    tree->gtidx = NULL;
+    return false;
+  }
+
+  /* each line is "CAT/PN OFFSET LENGTH", terminate the key such that
+   * the entries can be compared as strings */
+  tree->gtidx_ents = array_new();
+  for (p = tree->gtidx; p != NULL && *p != '\0'; p = q)
+  {
+    char *sp;
+
+    q = strchr(p, '\n');
+    if (q != NULL)
+      *q++ = '\0';
+    if ((sp = strchr(p, ' ')) == NULL)
+      continue;
+    *sp = '\0';
+    array_append(tree->gtidx_ents, p);
+  }
+
+  tree->gtloaded = set_new();
+
+  return true;
+}
+
+/* returns the position of the first index entry not sorting before key */
+static size_t tree_gtree_index_find
+(
+  tree_ctx   *tree,
+  const char *key
+)
+{
+  size_t lo = 0;
+  size_t hi = array_cnt(tree->gtidx_ents);
+  size_t mid;
+
+  while (lo < hi)
+  {
+    mid = lo + ((hi - lo) / 2);
+    if (strcmp(array_get(tree->gtidx_ents, mid), key) < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return lo;
+}
+
+/* decodes the frame of index entry n from the container open at fd,
+ * unless that was done before, returns the number of packages read
+ * a frame may hold more CAT/PNs than the one asked for, all of them
+ * are kept and recorded as loaded */
+static size_t tree_gtree_index_read
+(
+  tree_ctx *tree,
+  int       fd,
+  size_t    n
+)
+{
+  char                  key[_Q_PATH_MAX];
+  struct archive       *a;
+  struct archive_entry *entry;
+  const char           *ent  = array_get(tree->gtidx_ents, n);
+  char                 *end;
+  char                 *buf;
+  char                 *rbuf = NULL;
+  size_t                rlen = 0;
+  size_t                dlen;
+  size_t                ret  = 0;
+  uint64_t              off;
+  uint64_t              len;
+
+  if (set_contains(tree->gtloaded, ent))
+    return 0;
+  tree->gtloaded = set_add(tree->gtloaded, ent);
+
+  off = strtoull(ent + strlen(ent) + 1, &end, 10);
+  len = strtoull(end, NULL, 10);
+  if (len == 0 ||
+      off + len > tree->gtpack_len)
+    return 0;
+
+  buf = xmalloc(len);
+  if (pread(fd, buf, len, tree->gtpack_off + off) != (ssize_t)len)
+  {
+    free(buf);
+    return 0;
+  }
+
+  a = archive_read_new();
+  archive_read_support_format_all(a);
+  archive_read_support_filter_all(a);
+  if (archive_read_open_memory(a, buf, len) != ARCHIVE_OK)
+  {
+    warn("unable to read gtree frame for %s: %s",
+         ent, archive_error_string(a));
+    archive_read_free(a);
+    free(buf);
+    return 0;
+  }
+
+  while (archive_read_next_header(a, &entry) == ARCHIVE_OK)
+  {
+    const char *fname = archive_entry_pathname(entry);
+    atom_ctx   *atom;
+
+    if (fname == NULL ||
+        strncmp(fname, "caches/", sizeof("caches/") - 1) != 0)
+      continue;
+
+    dlen = archive_entry_size(entry);
+    if (dlen + 1 > rlen)
+    {
+      rlen = dlen + 1;
+      rbuf = xrealloc(rbuf, rlen);
+    }
+    if (archive_read_data(a, rbuf, dlen) != (la_ssize_t)dlen)
+      break;
+    rbuf[dlen] = '\0';
+
+    atom = atom_explode(fname + (sizeof("caches/") - 1));
+    snprintf(key, sizeof(key), "%s/%s", atom->CATEGORY, atom->PN);
+    tree->gtloaded = set_add_unique(tree->gtloaded, key, NULL);
+    tree_gtree_read_cache(tree_gtree_get_cat(tree, atom->CATEGORY),
+                          atom, rbuf);
+    ret++;
+  }
+
+  archive_read_free(a);
+  free(rbuf);
+  free(buf);
+
+  return ret;
+}
+/* }}} */
+#endif
+
+/* helper to delect valid category names from readdir */
+static int tree_filter_cat
+(
+  const struct dirent *de
+)
+{
+  int  i;
+  bool founddash;
+
+  /* PMS 3.1.1 */
+  founddash = false;
+  for (i = 0; de->d_name[i] != '\0'; i++)
+  {
+    switch (de->d_name[i])
+    {
+    case '_':
+      break;
+    case '-':
+      founddash = true;
+      /* fall through */
+    case '+':
+    case '.':
+      if (i)
+        break;
+      return 0;
+    default:
+      if ((de->d_name[i] >= 'A' &&
+           de->d_name[i] <= 'Z') ||
+          (de->d_name[i] >= 'a' &&
+           de->d_name[i] <= 'z') ||
+          (de->d_name[i] >= '0' &&
+           de->d_name[i] <= '9'))
+        break;
+      return 0;
+    }
+  }
+  if (!founddash &&
+      strcmp(de->d_name, "virtual") != 0)
+    return 0;
+
+  return i;
+}
+
+/* VDB index {{{
+ * The VDB consists of a directory per package, with a file per
+ * metadata key.  Discovering all packages and reading their SLOT,
+ * repository, etc. costs a lot of syscalls, hence we can keep a
+ * compact index of the keys most frequently used next to the VDB
+ * (a dotfile, so it is never mistaken for a category).  The index is
+ * mapped as a whole, and the strings in it are used directly as
+ * metadata values.
+ * The index is only valid when the set of categories and the mtimes
+ * of all category directories are still the same as when it was
+ * created, adding or removing a package always changes the category
+ * directory.  The mtime of the VDB directory itself cannot be used,
+ * for writing the index changes it.
+ * Layout, all integers in native byte order:
+ *   header
+ *   uint32_t keys[nkeys]                  offsets to key names
+ *   padding to a multiple of 8 bytes      for the int64_t in cats
+ *   struct tree_vdb_idx_cat cats[ncats]
+ *   uint32_t pkgs[npkgs][1 + nkeys]        offset to PF, then values
+ *   char strings[strsize]                  NUL-terminated strings
+ * string offsets are relative to the start of the strings area, absent
+ * values are recorded as TREE_VDB_IDX_NONE, the PF is never absent
+ * The index is only written on request (q -c), an outdated index is
+ * simply ignored, for reading the VDB must not modify it. */
+#define TREE_VDB_IDX_FILE    ".qindex"
+#define TREE_VDB_IDX_MAGIC   "qvdbidx"
+#define TREE_VDB_IDX_VERSION 2
+#define TREE_VDB_IDX_NONE    ((uint32_t)-1)
+
+/* keys stored in the index, i.e. all but the large CONTENTS and
+ * environment */
+#define TREE_VDB_IDX_KEYS(X) \
+  X(SLOT) \
+  X(repository) \
+  X(BUILD_ID) \
+  X(EAPI) \
+  X(KEYWORDS) \
+  X(LICENSE) \
+  X(IUSE) \
+  X(USE) \
+  X(DEPEND) \
+  X(RDEPEND) \
+  X(PDEPEND) \
+  X(BDEPEND) \
+  X(IDEPEND)
+
+#define TREE_VDB_IDX_KEY_ENUM(E)  Q_##E,
+#define TREE_VDB_IDX_KEY_FLAG(E)  [Q_##E] = true,
+static const enum tree_pkg_meta_keys tree_vdb_idx_keys[] = {
+  TREE_VDB_IDX_KEYS(TREE_VDB_IDX_KEY_ENUM)
+};
+static const bool tree_vdb_idx_key[TREE_META_MAX_KEYS] = {
+  TREE_VDB_IDX_KEYS(TREE_VDB_IDX_KEY_FLAG)
+};
+#define TREE_VDB_IDX_NKEYS ARRAY_SIZE(tree_vdb_idx_keys)
+
+struct tree_vdb_idx_hdr {
+  char     magic[8];
+  uint32_t version;
+  uint32_t nkeys;
+  uint32_t ncats;
+  uint32_t npkgs;
+  uint64_t strsize;
+};
+
+struct tree_vdb_idx_cat {
+  uint32_t name;
+  uint32_t npkgs;
+  int64_t  mtime_sec;
+  int64_t  mtime_nsec;
+};
+
+/* offset of the cats, aligned such that they can be used in place */
+#define TREE_VDB_IDX_CATS_OFF(NKEYS) \
+  ((sizeof(struct tree_vdb_idx_hdr) + (sizeof(uint32_t) * (NKEYS)) + 7) & \
+   ~(size_t)7)
+
+/* attempts to map the index for the VDB tree and populates the
+ * category and package caches from it, returns false if the index is
+ * absent or no longer valid, in which case nothing was changed */
+static bool tree_vdb_index_load
+(
+  tree_ctx *tree
+)
+{
+  char                     buf[_Q_PATH_MAX];
+  struct tree_vdb_idx_hdr *hdr;
+  struct tree_vdb_idx_cat *icats;
+  struct stat              sb;
+  struct dirent           *de;
+  DIR                     *dir;
+  uint32_t                *ikeys;
+  uint32_t                *ipkgs;
+  const char              *strs;
+  char                    *map;
+  size_t                   len;
+  size_t                   n;
+  size_t                   m;
+  size_t                   k;
+  int                      keymap[TREE_VDB_IDX_NKEYS];
+  int                      fd;
+
+  snprintf(buf, sizeof(buf), "%s/" TREE_VDB_IDX_FILE, tree->path);
+  if ((fd = openat(tree->portroot_fd, buf, O_RDONLY | O_CLOEXEC)) < 0)
+    return false;
+
+  if (fstat(fd, &sb) < 0 ||
+      sb.st_size < (off_t)sizeof(*hdr))
+  {
+    close(fd);
+    return false;
+  }
+
+  len = (size_t)sb.st_size;
+  /* meta values are never modified, so a read-only mapping does */
+  map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return false;
+
+  hdr = (struct tree_vdb_idx_hdr *)map;
+  if (memcmp(hdr->magic, TREE_VDB_IDX_MAGIC, sizeof(hdr->magic)) != 0 ||
+      hdr->version != TREE_VDB_IDX_VERSION ||
+      hdr->nkeys != TREE_VDB_IDX_NKEYS ||
+      len != TREE_VDB_IDX_CATS_OFF(hdr->nkeys) +
+             (sizeof(icats[0]) * hdr->ncats) +
+             (sizeof(ipkgs[0]) * (1 + hdr->nkeys) * hdr->npkgs) +
+             hdr->strsize ||
+      hdr->strsize == 0 ||
+      map[len - 1] != '\0')
+  {
+    munmap(map, len);
+    return false;
+  }
+
+  ikeys = (uint32_t *)(hdr + 1);
+  icats = (struct tree_vdb_idx_cat *)
+          (map + TREE_VDB_IDX_CATS_OFF(hdr->nkeys));
+  ipkgs = (uint32_t *)(icats + hdr->ncats);
+  strs  = (const char *)(ipkgs + ((1 + hdr->nkeys) * hdr->npkgs));
+
+  /* keys are stored by name, such that reordering the metadata keys
+   * doesn't silently produce garbage */
+  for (k = 0; k < TREE_VDB_IDX_NKEYS; k++)
+  {
+    if (ikeys[k] >= hdr->strsize ||
+        strcmp(strs + ikeys[k],
+               tree_meta_key_name[tree_vdb_idx_keys[k]]) != 0)
+    {
+      munmap(map, len);
+      return false;
+    }
+    keymap[k] = tree_vdb_idx_keys[k];
+  }
+
+  /* validate all categories are unmodified, and the data is sane */
+  for (n = 0, m = 0; n < hdr->ncats; n++)
+  {
+    m += icats[n].npkgs;
+    if (icats[n].name >= hdr->strsize)
+    {
+      munmap(map, len);
+      return false;
+    }
+    snprintf(buf, sizeof(buf), "%s/%s", tree->path, strs + icats[n].name);
+    if (fstatat(tree->portroot_fd, buf, &sb, 0) < 0 ||
+        icats[n].mtime_sec != (int64_t)sb.st_mtim.tv_sec ||
+        icats[n].mtime_nsec != (int64_t)sb.st_mtim.tv_nsec)
+    {
+      munmap(map, len);
+      return false;
+    }
+  }
+  if (m != hdr->npkgs)
+  {
+    munmap(map, len);
+    return false;
+  }
+
+  /* all categories we know of still exist, check no new ones were
+   * added, a single directory read */
+  if ((fd = openat(tree->portroot_fd, tree->path,
+                   O_RDONLY | O_CLOEXEC)) < 0 ||
+      (dir = fdopendir(fd)) == NULL)
+  {
+    if (fd >= 0)
+      close(fd);
+    munmap(map, len);
+    return false;
+  }
+  for (n = 0; (de = readdir(dir)) != NULL; )
+    if (tree_filter_cat(de) != 0)
+      n++;
+  closedir(dir);
+  if (n != hdr->ncats)
+  {
+    munmap(map, len);
+    return false;
+  }
+  for (n = 0; n < (1 + hdr->nkeys) * hdr->npkgs; n++)
+  {
+    /* values may be absent, the PF in front of them may not */
+    if ((ipkgs[n] != TREE_VDB_IDX_NONE ||
+         n % (1 + hdr->nkeys) == 0) &&
+        ipkgs[n] >= hdr->strsize)
+    {
+      munmap(map, len);
+      return false;
+    }
+  }
+
+  /* all good, construct the caches */
+  tree->vdbidx     = map;
+  tree->vdbidx_len = len;
+  tree->cats       = array_new();
+  for (n = 0; n < hdr->ncats; n++)
+  {
+    tree_cat_ctx *cat = arena_zalloc(tree->arena, sizeof(*cat));
+
+    cat->name             = arena_strdup(tree->arena, strs + icats[n].name);
+    cat->tree             = tree;
+    cat->pkgs             = array_new();
+    cat->pkgs_complete    = true;
+    cat->mtime.tv_sec     = (time_t)icats[n].mtime_sec;
+    cat->mtime.tv_nsec    = (long)icats[n].mtime_nsec;
+    array_append(tree->cats, cat);
+
+    for (m = 0; m < icats[n].npkgs; m++, ipkgs += 1 + hdr->nkeys)
+    {
+      tree_pkg_ctx *pkg = arena_zalloc(tree->arena, sizeof(*pkg));
+
+      snprintf(buf, sizeof(buf), "%s/%s/%s",
+               tree->path, cat->name, strs + ipkgs[0]);
+      pkg->atom        = atom_explode_cat(strs + ipkgs[0], cat->name);
+      pkg->name        = arena_strdup(tree->arena, pkg->atom->PN);
+      pkg->path        = arena_strdup(tree->arena, buf);
+      pkg->cat         = cat;
+      pkg->vdb_indexed = true;
+      for (k = 0; k < TREE_VDB_IDX_NKEYS; k++)
+        if (ipkgs[1 + k] != TREE_VDB_IDX_NONE)
+          pkg->meta[keymap[k]] = (char *)strs + ipkgs[1 + k];
+
+      array_append(cat->pkgs, pkg);
+    }
+  }
+  tree->cats_complete = true;
+
+  return true;
+}
+
+/* helper for tree_vdb_index_write to add a string to the strings area,
+ * identical strings are only stored once */
+static uint32_t tree_vdb_index_str
+(
+  hash_t    **strmap,
+  array      *strs,
+  uint64_t   *strsize,
+  const char *str
+)
+{
+  uint64_t *off;
+  void     *dummy;
+
+  if (str == NULL)
+    return TREE_VDB_IDX_NONE;
+
+  off = hash_get(*strmap, str);
+  if (off == NULL)
+  {
+    off   = xmalloc(sizeof(*off));
+    *off  = *strsize;
+    *strmap = hash_add(*strmap, str, off, &dummy);
+    array_append(strs, (void *)str);
+    *strsize += strlen(str) + 1;
+  }
+
+  return (uint32_t)*off;
+}
+
+/* writes the index for a VDB tree that was fully traversed, this is
+ * done atomically, a failure to write it is not an error, just a
+ * missed opportunity */
+static bool tree_vdb_index_write
+(
+  tree_ctx *tree
+)
+{
+  char                     buf[_Q_PATH_MAX];
+  char                     tmp[_Q_PATH_MAX];
+  struct tree_vdb_idx_hdr  hdr;
+  struct tree_vdb_idx_cat *icats;
+  tree_cat_ctx            *cat;
+  tree_pkg_ctx            *pkg;
+  hash_t                  *strmap  = NULL;
+  array                   *strs;
+  uint32_t                *ipkgs;
+  uint32_t                *ip;
+  uint32_t                 ikeys[TREE_VDB_IDX_NKEYS];
+  static const char        pad[8];
+  size_t                   padlen;
+  char                    *str;
+  FILE                    *f;
+  size_t                   n;
+  size_t                   m;
+  size_t                   k;
+  size_t                   npkgs   = 0;
+  int                      fd;
+  bool                     ret     = false;
+
+  /* only when we have seen everything, and noticed the mtimes of what
+   * we saw (we cannot trust the current ones) */
+  if (tree->type != TREE_VDB ||
+      !tree->cats_complete)
+    return false;
+  array_for_each(tree->cats, n, cat)
+  {
+    if (!cat->pkgs_complete ||
+        (cat->mtime.tv_sec == 0 &&
+         cat->mtime.tv_nsec == 0))
+      return false;
+    npkgs += array_cnt(cat->pkgs);
+  }
+
+  strs = array_new();
+
+  VAL_CLEAR(hdr);
+  memcpy(hdr.magic, TREE_VDB_IDX_MAGIC, sizeof(hdr.magic));
+  hdr.version    = TREE_VDB_IDX_VERSION;
+  hdr.nkeys      = TREE_VDB_IDX_NKEYS;
+  hdr.ncats      = array_cnt(tree->cats);
+  hdr.npkgs      = npkgs;
+
+  for (k = 0; k < TREE_VDB_IDX_NKEYS; k++)
+    ikeys[k] = tree_vdb_index_str(&strmap, strs, &hdr.strsize,
+                                  tree_meta_key_name[tree_vdb_idx_keys[k]]);
+
+  icats = xzalloc(sizeof(icats[0]) * (hdr.ncats + 1));
+  ip = ipkgs = xmalloc(sizeof(ipkgs[0]) * (1 + TREE_VDB_IDX_NKEYS) *
+                       (npkgs + 1));
+  array_for_each(tree->cats, n, cat)
+  {
+    icats[n].name       = tree_vdb_index_str(&strmap, strs, &hdr.strsize,
+                                             cat->name);
+    icats[n].npkgs      = array_cnt(cat->pkgs);
+    icats[n].mtime_sec  = (int64_t)cat->mtime.tv_sec;
+    icats[n].mtime_nsec = (int64_t)cat->mtime.tv_nsec;
+
+    array_for_each(cat->pkgs, m, pkg)
+    {
+      *ip++ = tree_vdb_index_str(&strmap, strs, &hdr.strsize,
+                                 tree_pkg_get_pf_name(pkg));
+      for (k = 0; k < TREE_VDB_IDX_NKEYS; k++)
+      {
+        enum tree_pkg_meta_keys key = tree_vdb_idx_keys[k];
+
+        str = tree_pkg_meta(pkg, key);
+        *ip++ = tree_vdb_index_str(&strmap, strs, &hdr.strsize, str);
+      }
+    }
+  }
+
+  snprintf(buf, sizeof(buf), "%s/" TREE_VDB_IDX_FILE, tree->path);
+  snprintf(tmp, sizeof(tmp), "%s/" TREE_VDB_IDX_FILE ".%d",
+           tree->path, (int)getpid());
+  fd = openat(tree->portroot_fd, tmp,
+              O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+  if (fd >= 0)
+  {
+    if ((f = fdopen(fd, "w")) != NULL)
+    {
+      padlen = TREE_VDB_IDX_CATS_OFF(TREE_VDB_IDX_NKEYS) -
+               (sizeof(hdr) + sizeof(ikeys));
+      ret = fwrite(&hdr, sizeof(hdr), 1, f) == 1 &&
+            fwrite(ikeys, sizeof(ikeys), 1, f) == 1 &&
+            (padlen == 0 || fwrite(pad, padlen, 1, f) == 1);
+      if (hdr.ncats > 0)
+        ret &= fwrite(icats, sizeof(icats[0]), hdr.ncats, f) == hdr.ncats;
+      if (npkgs > 0)
+        ret &= fwrite(ipkgs, sizeof(ipkgs[0]) * (1 + TREE_VDB_IDX_NKEYS),
+                      npkgs, f) == npkgs;
+      array_for_each(strs, n, str)
+        ret &= fwrite(str, strlen(str) + 1, 1, f) == 1;
+      ret &= fclose(f) == 0;
+    }
+    else
+    {
+      close(fd);
+    }
+
+    if (!ret ||
+        renameat(tree->portroot_fd, tmp, tree->portroot_fd, buf) != 0)
+    {
+      unlinkat(tree->portroot_fd, tmp, 0);
+      ret = false;
+    }
+  }
+
+  free(icats);
+  free(ipkgs);
+  array_free(strs);
+  if (strmap != NULL)
+  {
+    array *offs = hash_values(strmap);
+    array_deepfree(offs, NULL);
+    hash_free(strmap);
+  }
+
+  return ret;
+}
+/* }}} */
+
+/* md5-cache validation memo {{{
+ * Validating an md5-cache entry means hashing the ebuild it was
+ * generated from, which for a full scan of a repository doubles the
+ * amount of files read.  Since ebuilds rarely change, we remember for
+ * each ebuild (identified by inode, size and mtime) that it was found
+ * to match the cache entry (identified the same way).  When both are
+ * still the same, the entry is trusted without hashing.  The memo is
+ * kept in the user's cache directory ($XDG_CACHE_HOME/portage-utils, or
+ * ~/.cache/portage-utils), named after the device and inode of the
+ * tree, such that the tree itself is never written to.
+ * Layout, all integers in native byte order:
+ *   header
+ *   struct tree_md5memo_ent ents[nents]   sorted on ebuild inode */
+#define TREE_MD5MEMO_DIR     "portage-utils"
+#define TREE_MD5MEMO_MAGIC   "qmd5memo"
+#define TREE_MD5MEMO_VERSION 1
+
+struct tree_md5memo_hdr {
+  char     magic[8];
+  uint32_t version;
+  uint32_t nents;
+};
+
+struct tree_md5memo_ent {
+  uint64_t eb_ino;
+  uint64_t eb_size;
+  int64_t  eb_mtime;        /* nanoseconds */
+  uint64_t md_ino;
+  uint64_t md_size;
+  int64_t  md_mtime;
+};
+
+static void tree_md5memo_set
+(
+  struct tree_md5memo_ent *ent,
+  const struct stat       *ebst,
+  const struct stat       *mdst
+)
+{
+  ent->eb_ino   = (uint64_t)ebst->st_ino;
+  ent->eb_size  = (uint64_t)ebst->st_size;
+  ent->eb_mtime = (int64_t)ebst->st_mtim.tv_sec * 1000000000 +
+                  ebst->st_mtim.tv_nsec;
+  ent->md_ino   = (uint64_t)mdst->st_ino;
+  ent->md_size  = (uint64_t)mdst->st_size;
+  ent->md_mtime = (int64_t)mdst->st_mtim.tv_sec * 1000000000 +
+                  mdst->st_mtim.tv_nsec;
+}
+
+static int tree_md5memo_compar
+(
+  const void *l,
+  const void *r
+)
+{
+  const struct tree_md5memo_ent *left  = l;
+  const struct tree_md5memo_ent *right = r;
+
+  return left->eb_ino < right->eb_ino ? -1 :
+         left->eb_ino > right->eb_ino ?  1 : 0;
+}
+
+/* stores the directory holding the memo in dir, and the memo itself in
+ * file, returns false when there is no place to keep it */
+static bool tree_md5memo_path
+(
+  tree_ctx *tree,
+  char     *dir,
+  size_t    dirlen,
+  char     *file,
+  size_t    filelen
+)
+{
+  const char  *cache = getenv("XDG_CACHE_HOME");
+  const char  *home;
+  struct stat  st;
+
+  if (cache != NULL && cache[0] == '/')
+    snprintf(dir, dirlen, "%s/" TREE_MD5MEMO_DIR, cache);
+  else if ((home = getenv("HOME")) != NULL && home[0] == '/')
+    snprintf(dir, dirlen, "%s/.cache/" TREE_MD5MEMO_DIR, home);
+  else
+    return false;
+
+  if (fstatat(tree->portroot_fd, tree->path, &st, 0) < 0)
+    return false;
+
+  snprintf(file, filelen, "%s/md5memo-%llx-%llx", dir,
+           (unsigned long long)st.st_dev, (unsigned long long)st.st_ino);
+  return true;
+}
+
+static void tree_md5memo_load
+(
+  tree_ctx *tree
+)
+{
+  struct tree_md5memo_hdr *hdr;
+  struct stat              sb;
+  char                     dir[_Q_PATH_MAX];
+  char                     buf[_Q_PATH_MAX];
+  void                    *map;
+  int                      fd;
+
+  tree->md5memo_read = true;
+
+  if (!tree_md5memo_path(tree, dir, sizeof(dir), buf, sizeof(buf)))
+    return;
+  fd = open(buf, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return;
+
+  if (fstat(fd, &sb) < 0 ||
+      sb.st_size < (off_t)sizeof(*hdr))
+  {
+    close(fd);
+    return;
+  }
+
+  map = mmap(NULL, (size_t)sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return;
+
+  hdr = map;
+  if (memcmp(hdr->magic, TREE_MD5MEMO_MAGIC, sizeof(hdr->magic)) != 0 ||
+      hdr->version != TREE_MD5MEMO_VERSION ||
+      (size_t)sb.st_size != sizeof(*hdr) +
+                            (sizeof(struct tree_md5memo_ent) * hdr->nents))
+  {
+    munmap(map, (size_t)sb.st_size);
+    return;
+  }
+
+  tree->md5memo     = map;
+  tree->md5memo_len = (size_t)sb.st_size;
+}
+
+/* returns whether the ebuild was validated against this cache entry
+ * before */
+static bool tree_md5memo_check
+(
+  tree_ctx          *tree,
+  const struct stat *ebst,
+  const struct stat *mdst
+)
+{
+  struct tree_md5memo_hdr *hdr;
+  struct tree_md5memo_ent *ents;
+  struct tree_md5memo_ent  needle;
+  struct tree_md5memo_ent *ent;
+
+  if (!tree->md5memo_read)
+  {
+#ifdef _OPENMP
+#pragma omp critical (tree_md5memo)
+#endif
+    if (!tree->md5memo_read)
+      tree_md5memo_load(tree);
+  }
+
+  if (tree->md5memo == NULL)
+    return false;
+
+  hdr  = tree->md5memo;
+  ents = (struct tree_md5memo_ent *)(hdr + 1);
+  tree_md5memo_set(&needle, ebst, mdst);
+  ent  = bsearch(&needle, ents, hdr->nents, sizeof(ents[0]),
+                 tree_md5memo_compar);
+
+  return ent != NULL &&
+         memcmp(ent, &needle, sizeof(needle)) == 0;
 }
 
-static int tree_foreach_pkg_gtree
+/* records the ebuild to match the cache entry, or when mdst is NULL,
+ * that it doesn't match (anymore) */
+static void tree_md5memo_add
 (
-  tree_ctx       *tree
+  tree_ctx          *tree,
+  const struct stat *ebst,
+  const struct stat *mdst
 )
 {
-  char                      buf[_Q_PATH_MAX];
-  tree_cat_ctx             *cat         = NULL;
-  tree_pkg_ctx             *pkg         = NULL;
-  atom_ctx                 *atom        = NULL;
-  struct archive           *outer;
-  struct archive           *inner;
-  struct archive_entry     *entry;
-  char                     *p;
-  char                     *rbuf        = NULL;
-  struct tree_gtree_cb_ctx  cb_ctx;
-  bool                      foundcaches = false;
-  size_t                    len;
-  size_t                    rlen        = 0;
-  int                       ret         = 0;
-  int                       fd;
-
-  fd = openat(tree->portroot_fd, tree->path, O_RDONLY | O_CLOEXEC);
-  if (fd < 0)
-    return 1;
+  struct stat none;
 
-  outer = archive_read_new();
-  archive_read_support_format_all(outer);  /* don't see why not */
-  if (archive_read_open_fd(outer, fd, BUFSIZ) != ARCHIVE_OK)
+  if (mdst == NULL)
   {
-    warn("unable to read gtree container: %s",
-         archive_error_string(outer));
-    archive_read_free(outer);
-    return 1;
+    /* a zeroed cache identity serves as tombstone */
+    VAL_CLEAR(none);
+    mdst = &none;
   }
 
-  while (archive_read_next_header(outer, &entry) == ARCHIVE_OK)
+#ifdef _OPENMP
+#pragma omp critical (tree_md5memo)
+#endif
   {
-    const char *fname = archive_entry_pathname(entry);
-    if (fname == NULL)
-      continue;
-    if (strncmp(fname, "repo.tar", sizeof("repo.tar") - 1) == 0 &&
-        (fname[sizeof("repo.tar") - 1] == '.' ||
-         fname[sizeof("repo.tar") - 1] == '\0'))
-      break;
-    entry = NULL;
-  }
-  if (entry == NULL) {
-    archive_read_free(outer);
-    return 1;
+    if (tree->md5memo_nnew == tree->md5memo_snew)
+    {
+      tree->md5memo_snew = tree->md5memo_snew == 0 ?
+                           1024 : tree->md5memo_snew * 2;
+      tree->md5memo_new  = xrealloc(tree->md5memo_new,
+                                    sizeof(tree->md5memo_new[0]) *
+                                    tree->md5memo_snew);
+    }
+    tree_md5memo_set(&tree->md5memo_new[tree->md5memo_nnew++], ebst, mdst);
   }
+}
 
-  /* must be empty, we always read all cats */
-  tree->cats = array_new();
+/* merges the entries validated during this run into the memo on disk,
+ * failure is fine, e.g. when there is no writable cache directory */
+static void tree_md5memo_write
+(
+  tree_ctx *tree
+)
+{
+  struct tree_md5memo_hdr  hdr;
+  struct tree_md5memo_ent *ents;
+  struct tree_md5memo_ent *old     = NULL;
+  size_t                   nold    = 0;
+  size_t                   nents;
+  size_t                   i;
+  size_t                   j;
+  char                     dir[_Q_PATH_MAX];
+  char                     buf[_Q_PATH_MAX];
+  char                     tmp[_Q_PATH_MAX];
+  FILE                    *f;
+  int                      fd;
+  bool                     ret;
+
+  if (tree->md5memo_nnew == 0)
+    return;
 
-  /* use wrapper to read straight from this archive */
-  inner = archive_read_new();
-  archive_read_support_format_all(inner);
-  archive_read_support_filter_all(inner);
-  VAL_CLEAR(cb_ctx);
-  cb_ctx.archive = outer;
-  if (archive_read_open(inner, &cb_ctx, NULL,
-                        tree_gtree_read_cb,
-                        tree_gtree_close_cb) != ARCHIVE_OK)
-    warn("unable to read gtree data %s: %s", archive_entry_pathname(entry),
-         archive_error_string(inner));
+  /* stable, such that the last verdict for an ebuild wins */
+  for (i = 1; i < tree->md5memo_nnew; i++)
+  {
+    struct tree_md5memo_ent ent = tree->md5memo_new[i];
+    for (j = i;
+         j > 0 && tree->md5memo_new[j - 1].eb_ino > ent.eb_ino;
+         j--)
+      tree->md5memo_new[j] = tree->md5memo_new[j - 1];
+    tree->md5memo_new[j] = ent;
+  }
 
-  while (archive_read_next_header(inner, &entry) == ARCHIVE_OK)
+  if (!tree->md5memo_read)
+    tree_md5memo_load(tree);
+  if (tree->md5memo != NULL)
   {
-    const char *fname = archive_entry_pathname(entry);
+    nold = ((struct tree_md5memo_hdr *)tree->md5memo)->nents;
+    old  = (struct tree_md5memo_ent *)
+           ((struct tree_md5memo_hdr *)tree->md5memo + 1);
+  }
 
-    if (fname == NULL)
+  /* merge, new entries replace old ones for the same ebuild */
+  ents  = xmalloc(sizeof(ents[0]) * (nold + tree->md5memo_nnew));
+  nents = 0;
+  for (i = 0, j = 0; i < nold || j < tree->md5memo_nnew; )
+  {
+    if (j == tree->md5memo_nnew ||
+        (i < nold && old[i].eb_ino < tree->md5memo_new[j].eb_ino))
+    {
+      ents[nents++] = old[i++];
       continue;
+    }
+    if (i < nold &&
+        old[i].eb_ino == tree->md5memo_new[j].eb_ino)
+      i++;
+    /* of multiple verdicts for an ebuild, only take the last, and
+     * drop it altogether if that was a tombstone */
+    if (j + 1 == tree->md5memo_nnew ||
+        tree->md5memo_new[j + 1].eb_ino != tree->md5memo_new[j].eb_ino)
+    {
+      if (tree->md5memo_new[j].md_ino != 0 ||
+          tree->md5memo_new[j].md_mtime != 0)
+        ents[nents++] = tree->md5memo_new[j];
+    }
+    j++;
+  }
 
-    if (tree->repo == NULL &&
-        strcmp(fname, "repository") == 0)
+  VAL_CLEAR(hdr);
+  memcpy(hdr.magic, TREE_MD5MEMO_MAGIC, sizeof(hdr.magic));
+  hdr.version = TREE_MD5MEMO_VERSION;
+  hdr.nents   = (uint32_t)nents;
+
+  fd = -1;
+  if (tree_md5memo_path(tree, dir, sizeof(dir), buf, sizeof(buf)) &&
+      mkdir_p(dir, 0755) == 0 &&
+      snprintf(tmp, sizeof(tmp), "%s.%d",
+               buf, (int)getpid()) < (int)sizeof(tmp))
+    fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+  if (fd >= 0)
+  {
+    ret = false;
+    if ((f = fdopen(fd, "w")) != NULL)
     {
-      /* fill in repo, so it can be used when requested */
-      len = archive_entry_size(entry);
-      tree->repo = xmalloc(len + 1);
-      archive_read_data(inner, tree->repo, len);
-      tree->repo[len] = '\0';
+      ret = fwrite(&hdr, sizeof(hdr), 1, f) == 1 &&
+            fwrite(ents, sizeof(ents[0]), nents, f) == nents;
+      ret &= fclose(f) == 0;
     }
-    else if (strncmp(fname, "caches/", sizeof("caches/") - 1) == 0)
+    else
     {
-      char *nexttok = NULL;
+      close(fd);
+    }
 
-      foundcaches = true;
-      fname += sizeof("caches/") - 1;
-      atom = atom_explode(fname);
+    if (!ret || rename(tmp, buf) != 0)
+      unlink(tmp);
+  }
 
-      if (cat == NULL ||
-          strcmp(cat->name, atom->CATEGORY) != 0)
-      {
-        cat = xzalloc(sizeof(*cat));
-        cat->name = xstrdup(atom->CATEGORY);
-        cat->tree = tree;
-        cat->pkgs = array_new();
+  free(ents);
+}
+/* }}} */
+
+/* eclass digests {{{
+ * The _eclasses_ key of a cache entry lists the md5 digest of each
+ * eclass the ebuild inherited when the entry was generated.  Since
+ * most packages inherit the same handful of eclasses, the digests are
+ * computed once per tree (lazily) and shared by all packages, such
+ * that validating the entries costs one hash per eclass in use. */
+
+/* returns the md5 digest of the named eclass in this tree, an empty
+ * string if the eclass doesn't exist here */
+static const char *tree_eclass_md5
+(
+  tree_ctx   *tree,
+  const char *name
+)
+{
+  const char *ret;
+  char        buf[_Q_PATH_MAX];
+  char        md5[MD5_DIGEST_LENGTH + 1];
+  size_t      flen;
+  void       *prev;
+
+#pragma omp critical (tree_eclass)
+  ret = tree->eclasses == NULL ? NULL : hash_get(tree->eclasses, name);
+  if (ret != NULL)
+    return ret;
 
-        array_append(tree->cats, cat);
-        /* not yet, but will be */
-        cat->pkgs_complete = true;
-      }
+  /* hash outside the lock, worst case an eclass is hashed twice */
+  snprintf(buf, sizeof(buf), "%s/eclass/%s.eclass", tree->path, name);
+  if (hash_multiple_file_at(tree->portroot_fd, buf,
+                            md5, NULL, NULL, NULL,
+                            NULL, &flen, HASH_MD5) == 0)
+    ret = arena_memdup(tree->arena, md5, MD5_DIGEST_LENGTH);
+  else
+    ret = "";
 
-      /* we point to the ebuild, so it looks like md5-cache */
-      snprintf(buf, sizeof(buf), "%s/ebuilds/%s/%s/%s.ebuild",
-               tree->path, atom->CATEGORY, atom->PN, atom->PF);
+#pragma omp critical (tree_eclass)
+  {
+    prev = NULL;
+    if (tree->eclasses == NULL)
+      tree->eclasses = hash_new();
+    tree->eclasses = hash_add(tree->eclasses, name, (void *)ret, &prev);
+    if (prev != NULL)
+      tree->eclasses = hash_add(tree->eclasses, name, prev, NULL);
+  }
 
-      pkg = xzalloc(sizeof(*pkg));
-      pkg->name = xstrdup(atom->PN);
-      pkg->path = xstrdup(buf);
-      pkg->atom = atom;
-      pkg->cat  = cat;
-      array_append(cat->pkgs, pkg);
+  return prev != NULL ? prev : ret;
+}
 
-      /* ok, we're in business */
-      len = archive_entry_size(entry);
-      if (len + 1 > rlen)
-      {
-        rlen = len + 1;
-        rbuf = xrealloc(rbuf, rlen);
-      }
-      rbuf[len] = '\0';
-      archive_read_data(inner, rbuf, len);
-
-      /* entries are strictly single line, starting with KEY= (no
-       * whitespace) */
-      for (p = strtok_r(rbuf, "=", &nexttok);
-           p != NULL;
-           p = strtok_r(NULL, "=", &nexttok))
-      {
-        char *key = p;
+/* checks the eclass digests recorded in an _eclasses_ value, which is
+ * a tab separated list of name and digest pairs, against the eclasses
+ * in this tree; eclasses this tree doesn't have (e.g. inherited from a
+ * master repository) cannot be checked, and are assumed unchanged */
+static bool tree_eclasses_valid
+(
+  tree_ctx   *tree,
+  const char *eclasses
+)
+{
+  const char *p;
+  const char *q;
+  const char *md5;
+  char        name[256];
 
-        /* always advance to end of line */
-        p = strtok_r(NULL, "\n", &nexttok);
-        if (p == NULL)
-          break;  /* end of input */
+  if (eclasses == NULL)
+    return true;
 
-        switch (key[0])
-        {
-        case '_':
-#define keycmp(P,K) \
-          if (strcmp(&P[1], &(#K)[1]) == 0) \
-          { \
-            if (pkg->meta[Q_##K] == NULL) \
-              pkg->meta[Q_##K] = xstrdup(p); \
-            continue; \
-          }
-          keycmp(key, _eclasses_);
-          break;
-        case 'B':
-          keycmp(key, BDEPEND);
-          keycmp(key, BUILD_ID);
-          break;
-        case 'C':
-          keycmp(key, CDEPEND);
-          keycmp(key, CONTENTS);
-          break;
-        case 'D':
-          keycmp(key, DEFINED_PHASES);
-          keycmp(key, DEPEND);
-          keycmp(key, DESCRIPTION);
-          break;
-        case 'E':
-          keycmp(key, EAPI);
-          keycmp(key, EPREFIX);
-          break;
-        case 'I':
-          keycmp(key, IDEPEND);
-          keycmp(key, INHERITED);
-          keycmp(key, IUSE);
-          break;
-        case 'K':
-          keycmp(key, KEYWORDS);
-          break;
-        case 'L':
-          keycmp(key, LICENSE);
-          break;
-        case 'P':
-          keycmp(key, PATH);
-          keycmp(key, PDEPEND);
-          keycmp(key, PROPERTIES);
-          keycmp(key, PROVIDE);
-          break;
-        case 'R':
-          keycmp(key, RDEPEND);
-          keycmp(key, REQUIRED_USE);
-          keycmp(key, RESTRICT);
-          break;
-        case 'S':
-          keycmp(key, SIZE);
-          keycmp(key, SLOT);
-          keycmp(key, SRC_URI);
-          break;
-        case 'U':
-          keycmp(key, USE);
-          break;
-#undef keycmp
-        default:
-          /* don't care/unknown */
-          break;
-        }
-      }
+  for (p = eclasses; *p != '\0'; p = *q == '\0' ? q : q + 1)
+  {
+    q = strchr(p, '\t');
+    if (q == NULL ||
+        (size_t)(q - p) >= sizeof(name))
+      return false;
+    memcpy(name, p, q - p);
+    name[q - p] = '\0';
 
-      pkg->meta_complete = true;
-    }
-    else if (foundcaches)
+    /* the digest */
+    p = q + 1;
+    q = strchr(p, '\t');
+    if (q == NULL)
+      q = p + strlen(p);
+
+    md5 = tree_eclass_md5(tree, name);
+    if (*md5 == '\0')
+      continue;
+    if ((size_t)(q - p) != MD5_DIGEST_LENGTH ||
+        strncasecmp(md5, p, MD5_DIGEST_LENGTH) != 0)
     {
-      break;  /* stop searching if we processed all cache entries */
+      IF_DEBUG(warn("eclass %s changed since cache generation", name));
+      return false;
     }
   }
 
-  free(rbuf);
-
-  tree->cats_complete = true;
-
-  return ret;
+  return true;
 }
-#endif
+/* }}} */
 
 /* opens the tree at path inside portroot and returns a tree object
  * ready for traversing packages or NULL if an error occurred for which
@@ -460,6 +1849,11 @@ tree_ctx *tree_new
   }
 
   ret = xzalloc(sizeof(*ret));
+  ret->arena       = arena_new(0);
+  ret->strs        = intern_new(ret->arena);
+  ret->keys        = TREE_KEYS_ALL;
+  ret->validate    = tree_validate_default;
+  tree_meta_hash_init();
   ret->portroot_fd = open(portroot, O_RDONLY | O_PATH);
   if (ret->portroot_fd == -1) {
     if (!quiet)
@@ -522,10 +1916,20 @@ tree_ctx *tree_new
     }
 
     ret->type = TREE_VDB;
+
+    tree_vdb_index_load(ret);
     break; /* }}} */
   case TREETYPE_BINPKG: /* {{{ */
     {
+      static const char *pkgsfiles[] = {
+        "Packages",
+#ifdef HAVE_LIBARCHIVE
+        "Packages.zst",
+        "Packages.gz",
+#endif
+      };
       char   buf[_Q_PATH_MAX];
+      size_t n;
 
       if (!S_ISDIR(st.st_mode))
       {
@@ -537,17 +1941,27 @@ tree_ctx *tree_new
 
       ret->type = TREE_BINPKGS;
 
-      snprintf(buf, sizeof(buf), "%s/Packages", path);
-      if (fstatat(ret->portroot_fd, buf, &st, 0) == 0 &&
-          S_ISREG(st.st_mode))
+      /* use the most recently written Packages file, preferring the
+       * uncompressed one when equally fresh */
+      for (n = 0; n < sizeof(pkgsfiles) / sizeof(pkgsfiles[0]); n++)
       {
+        struct stat pst;
+
+        snprintf(buf, sizeof(buf), "%s/%s", path, pkgsfiles[n]);
+        if (fstatat(ret->portroot_fd, buf, &pst, 0) != 0 ||
+            !S_ISREG(pst.st_mode))
+          continue;
+        if (ret->type == TREE_PACKAGES &&
+            (pst.st_mtim.tv_sec < st.st_mtim.tv_sec ||
+             (pst.st_mtim.tv_sec == st.st_mtim.tv_sec &&
+              pst.st_mtim.tv_nsec <= st.st_mtim.tv_nsec)))
+          continue;
+
+        st = pst;
         free(ret->path);
         ret->path = xstrdup(buf);
         ret->type = TREE_PACKAGES;
       }
-
-      /* TODO: we can read the Packages.gz file too, need to elevate
-       * zlib check in configure, to unpack it */
     }
     break; /* }}} */
   case TREETYPE_GTREE: /* {{{ */
@@ -618,24 +2032,90 @@ tree_ctx *tree_merge
   return ret;
 }
 
-/* helper to free up resources held by a package */
+/* enables or disables concurrent population of the category caches
+ * during traversals, this is mostly beneficial for trees on storage
+ * with high latency (e.g. NFS), results are still delivered in the
+ * same order as without */
+void tree_set_parallel
+(
+  tree_ctx *tree,
+  bool      parallel
+)
+{
+  if (tree == NULL)
+    return;
+
+  tree->parallel = parallel;
+}
+
+/* selects how md5-cache entries of ebuild trees are validated:
+ * - TREE_VALIDATE_MEMO: hash the ebuild unless the memo says the
+ *   unchanged ebuild was found to match the unchanged entry before
+ * - TREE_VALIDATE_TRUST: assume all entries are up to date
+ * - TREE_VALIDATE_FULL: always hash, refreshing the memo for all
+ *   ebuilds seen
+ * when tree is NULL, the default for trees opened hereafter is set */
+void tree_set_validation
+(
+  tree_ctx          *tree,
+  enum tree_validate mode
+)
+{
+  tree_ctx *t;
+  size_t    n;
+
+  if (tree == NULL)
+  {
+    tree_validate_default = mode;
+    return;
+  }
+
+  tree->validate = mode;
+  if (tree->type == TREE_MERGED)
+    array_for_each(tree->srctrees, n, t)
+      tree_set_validation(t, mode);
+}
+
+/* limits the meta keys the cache parsers (md5-cache, gtree, Packages,
+ * xpak) retain to keys, a bitmask of TREE_KEY values, such that values
+ * the caller won't look at aren't copied at all; tree_pkg_meta returns
+ * NULL for keys outside this set, except for the keys the tree needs
+ * itself (SLOT, repository, PATH, BUILD_ID and the cache's _md5_ and
+ * _eclasses_) */
+void tree_set_keys
+(
+  tree_ctx *tree,
+  uint64_t  keys
+)
+{
+  tree_ctx *t;
+  size_t    n;
+
+  if (tree == NULL)
+    return;
+
+  tree->keys = keys |
+               TREE_KEY(SLOT) | TREE_KEY(repository) | TREE_KEY(PATH) |
+               TREE_KEY(BUILD_ID) | TREE_KEY(_md5_) | TREE_KEY(_eclasses_);
+
+  if (tree->type == TREE_MERGED)
+    array_for_each(tree->srctrees, n, t)
+      tree_set_keys(t, keys);
+}
+
+/* helper to free up resources held by a package, the package itself,
+ * its strings and meta live in the tree's arena, only the atom is
+ * allocated separately */
 static void tree_pkg_close
 (
   tree_pkg_ctx *pkg
 )
 {
-  enum tree_pkg_meta_keys k;
-
   if (pkg == NULL)
     return;
 
   if (pkg->atom != NULL)
     atom_implode(pkg->atom);
-  for (k = Q_UNKNOWN; k < TREE_META_MAX_KEYS; k++)
-    free(pkg->meta[k]);
-  free(pkg->path);
-  free(pkg->name);
-  free(pkg);
 }
 
 /* helper to free up resources held by a category */
@@ -648,9 +2128,6 @@ static void tree_cat_close
     return;
 
   array_deepfree(cat->pkgs, (array_free_cb *)tree_pkg_close);
-
-  free(cat->name);
-  free(cat);
 }
 
 /* close and free up resources held by this tree context and its
@@ -663,8 +2140,37 @@ void tree_close
   if (tree == NULL)
     return;
 
+  if (tree->type == TREE_EBUILD)
+    tree_md5memo_write(tree);
+  if (tree->md5memo != NULL)
+    munmap(tree->md5memo, tree->md5memo_len);
+  free(tree->md5memo_new);
+  hash_free(tree->eclasses);
+
   array_deepfree(tree->cats, (array_free_cb *)tree_cat_close);
 
+  if (tree->arena != NULL)
+  {
+    size_t uniq;
+    size_t refs;
+    size_t saved;
+
+    intern_stats(tree->strs, &uniq, &refs, &saved);
+    DBG("tree %s: arena used %zu bytes, peak %zu bytes, "
+        "%zu meta values in %zu unique strings (%.1fx), %zu bytes saved",
+        tree->path, arena_used(tree->arena), arena_peak(tree->arena),
+        refs, uniq, uniq == 0 ? 0.0 : (double)refs / (double)uniq, saved);
+    intern_free(tree->strs);
+    arena_free(tree->arena);
+  }
+
+  if (tree->vdbidx != NULL)
+    munmap(tree->vdbidx, tree->vdbidx_len);
+
+  free(tree->gtidx);
+  array_free(tree->gtidx_ents);
+  set_free(tree->gtloaded);
+
   free(tree->path);
   free(tree->repo);
 
@@ -704,9 +2210,11 @@ static bool tree_pkg_vdb_eat
 static bool tree_pkg_md5_read
 (
   tree_pkg_ctx *pkg,
-  char         *path
+  char         *path,
+  struct stat  *st
 )
 {
+  tree_ctx   *tree    = pkg->cat->tree;
   char       *data;
   char       *nexttok = NULL;
   char       *p;
@@ -714,9 +2222,15 @@ static bool tree_pkg_md5_read
   int         fd;
   bool        ret;
 
-  if ((fd = openat(pkg->cat->tree->portroot_fd, path, O_RDONLY, 0)) < 0)
+  if ((fd = openat(tree->portroot_fd, path, O_RDONLY, 0)) < 0)
     return false;
 
+  if (fstat(fd, st) < 0)
+  {
+    close(fd);
+    return false;
+  }
+
   data = NULL;
   len  = 0;
   ret  = eat_file_fd(fd, &data, &len);
@@ -744,71 +2258,8 @@ static bool tree_pkg_md5_read
     if (p == NULL)
       break;  /* end of input */
 
-    switch (key[0])
-    {
-    case '_':
-#define keycmp(P,K) \
-      if (strcmp(&P[1], &(#K)[1]) == 0) \
-      { \
-        if (pkg->meta[Q_##K] == NULL) \
-          pkg->meta[Q_##K] = xstrdup(p); \
-        continue; \
-      }
-      keycmp(key, _eclasses_);
-      keycmp(key, _md5_);
-      break;
-    case 'B':
-      keycmp(key, BDEPEND);
-      keycmp(key, BUILD_ID);
-      break;
-    case 'C':
-      keycmp(key, CDEPEND);
-      keycmp(key, CONTENTS);
-      break;
-    case 'D':
-      keycmp(key, DEFINED_PHASES);
-      keycmp(key, DEPEND);
-      keycmp(key, DESCRIPTION);
-      break;
-    case 'E':
-      keycmp(key, EAPI);
-      keycmp(key, EPREFIX);
-      break;
-    case 'I':
-      keycmp(key, IDEPEND);
-      keycmp(key, INHERITED);
-      keycmp(key, IUSE);
-      break;
-    case 'K':
-      keycmp(key, KEYWORDS);
-      break;
-    case 'L':
-      keycmp(key, LICENSE);
-      break;
-    case 'P':
-      keycmp(key, PATH);
-      keycmp(key, PDEPEND);
-      keycmp(key, PROPERTIES);
-      keycmp(key, PROVIDE);
-      break;
-    case 'R':
-      keycmp(key, RDEPEND);
-      keycmp(key, REQUIRED_USE);
-      keycmp(key, RESTRICT);
-      break;
-    case 'S':
-      keycmp(key, SIZE);
-      keycmp(key, SLOT);
-      keycmp(key, SRC_URI);
-      break;
-    case 'U':
-      keycmp(key, USE);
-      break;
-    default:
-      /* don't care/unknown */
-      break;
-#undef keycmp
-    }
+    tree_pkg_meta_store(tree, pkg, tree_meta_key(key, strlen(key)),
+                        p, strlen(p));
   }
 
   free(data);
@@ -822,94 +2273,54 @@ static bool tree_pkg_ebuild_read
   tree_pkg_ctx *pkg
 )
 {
+  tree_ctx   *tree = pkg->cat->tree;
+  char       *data;
   char       *p;
   char       *q;
   char       *w;
   char      **key;
   size_t      len;
+  size_t      k;
   int         fd;
   bool        esc;
   bool        findnl;
   bool        ret;
 
-  if ((fd = openat(pkg->cat->tree->portroot_fd, pkg->path, O_RDONLY, 0)) < 0)
+  if ((fd = openat(tree->portroot_fd, pkg->path, O_RDONLY, 0)) < 0)
     return false;
 
-  p   = NULL;
-  len = 0;
-  ret = eat_file_fd(fd, &p, &len);
+  data = NULL;
+  len  = 0;
+  ret  = eat_file_fd(fd, &data, &len);
   close(fd);
 
   if (!ret)
     return false;
 
+  p = data;
+
   do
   {
     /* leading whitespace is allowed */
     while (isspace((int)*p))
       p++;
     q = p;
-    while (*p >= 'A' &&
-           *p <= 'Z')
+    while ((*p >= 'A' &&
+            *p <= 'Z') ||
+           *p == '_')
       p++;
 
     key = NULL;
     if (q < p &&
         *p == '=')
     {
-      *p++ = '\0';
       /* match variable against which ones we look for */
-      switch (q[0])
-      {
-      case 'B':
-#define keycmp(P,K) \
-        if (strcmp(&P[1], &(#K)[1]) == 0) \
-        { \
-          key = &pkg->meta[Q_##K]; \
-          break; \
-        }
-        keycmp(q, BDEPEND);
-        break;
-      case 'C':
-        keycmp(q, CDEPEND);
-        break;
-      case 'D':
-        keycmp(q, DEPEND);
-        keycmp(q, DESCRIPTION);
-        break;
-      case 'E':
-        keycmp(q, EAPI);
-        break;
-      case 'H':
-        keycmp(q, HOMEPAGE);
-        break;
-      case 'I':
-        keycmp(q, IDEPEND);
-        keycmp(q, IUSE);
-        break;
-      case 'K':
-        keycmp(q, KEYWORDS);
-        break;
-      case 'L':
-        keycmp(q, LICENSE);
-        break;
-      case 'P':
-        keycmp(q, PDEPEND);
-        break;
-      case 'R':
-        keycmp(q, RDEPEND);
-        keycmp(q, REQUIRED_USE);
-        keycmp(q, RESTRICT);
-        break;
-      case 'S':
-        keycmp(q, SLOT);
-        keycmp(q, SRC_URI);
-        break;
-      default:
-        /* don't care/unknown */
-        break;
-#undef keycmp
-      }
+      k = tree_meta_key(q, p - q);
+      *p++ = '\0';
+      if (k != Q_UNKNOWN &&
+          (TREE_META_EBUILD_KEYS & ((uint64_t)1 << k)) != 0 &&
+          tree_meta_wanted(tree, k))
+        key = &pkg->meta[k];
     }
 
     findnl = true;
@@ -948,7 +2359,8 @@ static bool tree_pkg_ebuild_read
             }
 
             /* collapse sequences of spaces */
-            if (*w != ' ' ||
+            if (w == q + 1 ||
+                w[-1] != ' ' ||
                 *p != ' ')
               *w++ = *p++;
             else
@@ -978,7 +2390,7 @@ static bool tree_pkg_ebuild_read
       }
       *p++ = '\0';
       if (*key == NULL)  /* ignore secondary assignments (perhaps if/else) */
-        *key = xstrdup(q);
+        *key = tree_meta_strdup(tree, key - pkg->meta, q);
     }
 
     if (findnl &&
@@ -988,86 +2400,39 @@ static bool tree_pkg_ebuild_read
   while (p != NULL &&
          *p != '\0');
 
+  free(data);
+
   return true;
 }
 
+/* the keys taken from a binpkg's own metadata, the others either mean
+ * something else here, e.g. SIZE is the installed size, not the size
+ * of the binpkg, or are not meant to be used from it, like BUILD_ID,
+ * which must come from the Packages file or file name instead */
+#define TREE_META_XPAK_KEYS \
+  (TREE_KEY(BDEPEND) | TREE_KEY(CDEPEND) | TREE_KEY(CONTENTS) | \
+   TREE_KEY(DEFINED_PHASES) | TREE_KEY(DEPEND) | TREE_KEY(DESCRIPTION) | \
+   TREE_KEY(EAPI) | TREE_KEY(EPREFIX) | TREE_KEY(HOMEPAGE) | \
+   TREE_KEY(IDEPEND) | TREE_KEY(INHERITED) | TREE_KEY(IUSE) | \
+   TREE_KEY(KEYWORDS) | TREE_KEY(PDEPEND) | TREE_KEY(PROPERTIES) | \
+   TREE_KEY(PROVIDE) | TREE_KEY(RDEPEND) | TREE_KEY(REQUIRED_USE) | \
+   TREE_KEY(RESTRICT) | TREE_KEY(repository) | TREE_KEY(SLOT) | \
+   TREE_KEY(SRC_URI) | TREE_KEY(USE))
+
 static void tree_pkg_xpak_read_cb
 (
     void *ctx,
     char *pathname,
-    int   pathname_len,
-    int   data_offset,
-    int   data_len,
-    char *data)
-{
-  tree_pkg_ctx  *pkg = ctx;
-  char         **key = NULL;
-
-  if (pathname_len < 3)
-    return;
-
-  switch (pathname[0])
-  {
-  case 'B':
-#define keycmp(P,K) \
-    if (pathname_len == sizeof(#K) - 1 && \
-        memcmp(&P[1], &(#K)[1], pathname_len - 1) == 0) \
-    { \
-      key = &pkg->meta[Q_##K]; \
-      break; \
-    }
-    keycmp(pathname, BDEPEND);
-    break;
-  case 'C':
-    keycmp(pathname, CDEPEND);
-    keycmp(pathname, CONTENTS);
-    break;
-  case 'D':
-    keycmp(pathname, DEFINED_PHASES);
-    keycmp(pathname, DEPEND);
-    keycmp(pathname, DESCRIPTION);
-    break;
-  case 'E':
-    keycmp(pathname, EAPI);
-    keycmp(pathname, EPREFIX);
-    break;
-  case 'H':
-    keycmp(pathname, HOMEPAGE);
-    break;
-  case 'I':
-    keycmp(pathname, IDEPEND);
-    keycmp(pathname, INHERITED);
-    keycmp(pathname, IUSE);
-    break;
-  case 'K':
-    keycmp(pathname, KEYWORDS);
-    break;
-  case 'P':
-    keycmp(pathname, PDEPEND);
-    keycmp(pathname, PROPERTIES);
-    keycmp(pathname, PROVIDE);
-    break;
-  case 'R':
-    keycmp(pathname, RDEPEND);
-    keycmp(pathname, REQUIRED_USE);
-    keycmp(pathname, RESTRICT);
-    break;
-  case 'r':
-    keycmp(pathname, repository);
-    break;
-  case 'S':
-    keycmp(pathname, SLOT);
-    keycmp(pathname, SRC_URI);
-    break;
-  case 'U':
-    keycmp(pathname, USE);
-    break;
-#undef keycmp
-  }
+    int   pathname_len,
+    int   data_offset,
+    int   data_len,
+    char *data)
+{
+  tree_pkg_ctx *pkg = ctx;
+  size_t        key = tree_meta_key(pathname, (size_t)pathname_len);
 
-  /* don't overwrite entries */
-  if (key == NULL ||
-      *key != NULL)
+  if (key == Q_UNKNOWN ||
+      (TREE_META_XPAK_KEYS & ((uint64_t)1 << key)) == 0)
     return;
 
   /* trim whitespace (mostly trailing newline) */
@@ -1075,9 +2440,9 @@ static void tree_pkg_xpak_read_cb
          isspace((int)data[data_offset + data_len - 1]))
     data_len--;
 
-  /* copy the entry into the meta */
-  *key = xmemdup(data + data_offset, data_len + 1);
-  (*key)[data_len] = '\0';
+  /* copy the entry into the meta, existing entries are retained */
+  tree_pkg_meta_store(pkg->cat->tree, pkg, key,
+                      data + data_offset, data_len);
 }
 
 static bool tree_pkg_binpkg_read
@@ -1175,10 +2540,13 @@ static bool tree_pkg_binpkg_read
     /* xpak_process closes the input fd */
   }
 
-  /* get some numbers to emulate Packages for convenience */
-  if (pkg->meta[Q_SIZE] == NULL ||
-      pkg->meta[Q_MD5] == NULL ||
-      pkg->meta[Q_SHA1] == NULL)
+  /* get some numbers to emulate Packages for convenience, this means
+   * hashing the entire file, so only when asked for */
+  if ((pkg->cat->tree->keys &
+       (TREE_KEY(SIZE) | TREE_KEY(MD5) | TREE_KEY(SHA1))) != 0 &&
+      (pkg->meta[Q_SIZE] == NULL ||
+       pkg->meta[Q_MD5] == NULL ||
+       pkg->meta[Q_SHA1] == NULL))
   {
     char   md5[MD5_DIGEST_LENGTH + 1];
     char   sha1[SHA1_DIGEST_LENGTH + 1];
@@ -1192,14 +2560,14 @@ static bool tree_pkg_binpkg_read
                               NULL, &flen, HASH_MD5 | HASH_SHA1) == 0)
     {
       if (pkg->meta[Q_MD5] == NULL)
-        pkg->meta[Q_MD5] = xstrdup(md5);
+        pkg->meta[Q_MD5] = arena_strdup(pkg->cat->tree->arena, md5);
       if (pkg->meta[Q_SHA1] == NULL)
-        pkg->meta[Q_SHA1] = xstrdup(sha1);
+        pkg->meta[Q_SHA1] = arena_strdup(pkg->cat->tree->arena, sha1);
 
       if (pkg->meta[Q_SIZE] == NULL)
       {
         snprintf(md5, sizeof(md5), "%zu", flen);
-        pkg->meta[Q_SIZE] = xstrdup(md5);
+        pkg->meta[Q_SIZE] = arena_strdup(pkg->cat->tree->arena, md5);
       }
     }
     /* fd is closed by hash_multiple_file_fd */
@@ -1208,14 +2576,11 @@ static bool tree_pkg_binpkg_read
   return true;
 }
 
-static const char *tree_meta_key_name[] = {
-  "unknown",
-  TREE_META_KEYS(TREE_META_KEY_NAME)
-};
-
 /* returns the value for the given metadata key, or NULL if absent
  * all values returned are strings, the caller should copy the strings
- * before modifying them */
+ * before modifying them, for most values are shared between packages
+ * of the same tree, which in turn means that equal pointers imply
+ * equal values (as long as the tree is open) */
 char *tree_pkg_meta
 (
   tree_pkg_ctx           *pkg,
@@ -1235,6 +2600,11 @@ char *tree_pkg_meta
   if (key == Q_PATH)
     return pkg->path;
 
+  /* the VDB index knows for sure if a key it covers is absent */
+  if (pkg->vdb_indexed &&
+      tree_vdb_idx_key[key])
+    return pkg->meta[key];
+
   if (pkg->meta[key] == NULL &&
       !pkg->meta_complete)
   {
@@ -1245,39 +2615,60 @@ char *tree_pkg_meta
     case TREE_EBUILD: /* {{{ */
       if (!pkg->cache_invalid)
       {
-        char      buf[_Q_PATH_MAX];
-        atom_ctx *atom = tree_pkg_atom(pkg, false);
+        char        buf[_Q_PATH_MAX];
+        atom_ctx   *atom = tree_pkg_atom(pkg, false);
+        struct stat mdst;
+        struct stat ebst;
 
         /* attempt to read the cache file from the location it should be */
         snprintf(buf, sizeof(buf), "%s/metadata/md5-cache/%s/%s",
                  tree->path, atom->CATEGORY, atom->PF);
-        if (tree_pkg_md5_read(pkg, buf))
+        if (tree_pkg_md5_read(pkg, buf, &mdst))
         {
           char   *mdmd5;
           char    srcmd5[MD5_DIGEST_LENGTH + 1];
           size_t  flen;
-          int     k;
+          bool    memo;
+          bool    valid = false;
 
           /* in this case a cache entry exists, however, it may be
            * out of date, for that we need to check the md5 hashes
            * with the ebuild/eclass files, obviously when the source
            * ebuild doesn't exist, we never get here */
 
-          if (hash_multiple_file_at(tree->portroot_fd, pkg->path,
-                                    srcmd5, NULL, NULL, NULL,
-                                    NULL, &flen, HASH_MD5) == 0)
+          if (tree->validate == TREE_VALIDATE_TRUST)
           {
-            mdmd5 = pkg->meta[Q__md5_];
+            pkg->meta_complete = true;
+            break;
+          }
 
-            /* TODO: eclass compares */
+          /* avoid hashing when we validated this before */
+          memo = fstatat(tree->portroot_fd, pkg->path, &ebst, 0) == 0;
+          if (memo &&
+              tree->validate == TREE_VALIDATE_MEMO &&
+              tree_md5memo_check(tree, &ebst, &mdst))
+          {
+            valid = true;
+          }
+          else if (hash_multiple_file_at(tree->portroot_fd, pkg->path,
+                                         srcmd5, NULL, NULL, NULL,
+                                         NULL, &flen, HASH_MD5) == 0)
+          {
+            mdmd5 = pkg->meta[Q__md5_];
+            valid = mdmd5 != NULL &&
+                    memcmp(mdmd5, srcmd5, MD5_DIGEST_LENGTH) == 0;
+            /* the memo only covers the ebuild, eclasses are checked
+             * each time, which is cheap for their digests are shared */
+            if (memo)
+              tree_md5memo_add(tree, &ebst, valid ? &mdst : NULL);
+          }
 
-            /* is this a valid cache? use it! */
-            if (mdmd5 != NULL &&
-                memcmp(mdmd5, srcmd5, MD5_DIGEST_LENGTH) == 0)
-            {
-              pkg->meta_complete = true;
-              break;
-            }
+          /* is this a valid cache? use it! */
+          if (valid &&
+              tree_eclasses_valid(tree, pkg->meta[Q__eclasses_]))
+          {
+            pkg->meta_complete = true;
+            break;
           }
 
           IF_DEBUG(warn("%s/%s has invalid md5-cache entry",
@@ -1285,8 +2676,6 @@ char *tree_pkg_meta
 
           /* we read the meta, but apparently it was wrong, so clear
            * whatever we read */
-          for (k = Q_UNKNOWN; k < TREE_META_MAX_KEYS; k++)
-            free(pkg->meta[k]);
           VAL_CLEAR(pkg->meta);
         }
 
@@ -1304,8 +2693,13 @@ char *tree_pkg_meta
       break; /* }}} */
     case TREE_VDB: /* {{{ */
       {
-        size_t len;
-        tree_pkg_vdb_eat(pkg, tree_meta_key_name[key], &pkg->meta[key], &len);
+        char   *buf = NULL;
+        size_t  len = 0;
+        /* an empty file still yields a (blank) buffer */
+        tree_pkg_vdb_eat(pkg, tree_meta_key_name[key], &buf, &len);
+        if (buf != NULL)
+          pkg->meta[key] = tree_meta_strdup(tree, key, buf);
+        free(buf);
       }
       break; /* }}} */
     case TREE_BINPKGS:
@@ -1368,10 +2762,15 @@ atom_ctx *tree_pkg_atom
          * need to split it up in SLOT and SUBSLOT for atom_format to
          * behave properly, this may be redundant but this probably
          * isn't much of an issue performance wise (on top of doing it
-         * in atom_explode when given as input) */
+         * in atom_explode when given as input)
+         * meta values are shared, so SLOT is copied rather than split
+         * in place, SUBSLOT can simply point into the original */
         if ((p = strchr(pkg->atom->SLOT, '/')) != NULL)
         {
-          *p++ = '\0';
+          pkg->atom->SLOT = arena_memdup(pkg->cat->tree->arena,
+                                         pkg->atom->SLOT,
+                                         p - pkg->atom->SLOT);
+          p++;
         }
         else
         {
@@ -1464,47 +2863,28 @@ static int tree_pkg_compar
   }
 }
 
-/* helper to delect valid category names from readdir */
-static int tree_filter_cat
+/* comparator function for packages from multiple categories, orders
+ * on category name first, like tree_foreach_pkg does when sorted, then
+ * falls back to tree_pkg_compar */
+static int tree_pkg_cat_compar
 (
-  const struct dirent *de
+  const void *d,
+  const void *q
 )
 {
-  int  i;
-  bool founddash;
+  tree_pkg_ctx *data  = *(tree_pkg_ctx **)d;
+  tree_pkg_ctx *query = *(tree_pkg_ctx **)q;
+  int           ret;
 
-  /* PMS 3.1.1 */
-  founddash = false;
-  for (i = 0; de->d_name[i] != '\0'; i++)
+  if (data != NULL &&
+      query != NULL)
   {
-    switch (de->d_name[i])
-    {
-    case '_':
-      break;
-    case '-':
-      founddash = true;
-      /* fall through */
-    case '+':
-    case '.':
-      if (i)
-        break;
-      return 0;
-    default:
-      if ((de->d_name[i] >= 'A' &&
-           de->d_name[i] <= 'Z') ||
-          (de->d_name[i] >= 'a' &&
-           de->d_name[i] <= 'z') ||
-          (de->d_name[i] >= '0' &&
-           de->d_name[i] <= '9'))
-        break;
-      return 0;
-    }
+    ret = tree_cat_compar(&data->cat, &query->cat);
+    if (ret != 0)
+      return ret;
   }
-  if (!founddash &&
-      strcmp(de->d_name, "virtual") != 0)
-    return 0;
 
-  return i;
+  return tree_pkg_compar(d, q);
 }
 
 /* helper to delect valid package names from readdir */
@@ -1553,7 +2933,10 @@ static int tree_filter_pkg
 }
 
 /* iterates over the given category in its tree, invoking the callback
- * function for packages matching the query */
+ * function for packages matching the query
+ * when the callback asks to stop while the category is being read, the
+ * read is finished such that the cache is complete, without invoking
+ * the callback anymore */
 static int tree_cat_foreach_pkg
 (
   tree_cat_ctx   *cat,
@@ -1604,7 +2987,8 @@ static int tree_cat_foreach_pkg
         if (tree_pkg_compar(&pkg, &nref) == 0)
           ret |= callback(pkg, priv);
       }
-      while (++elem < array_cnt(cat->pkgs) &&
+      while (!(ret & TREE_FOREACH_STOP) &&
+             ++elem < array_cnt(cat->pkgs) &&
              (pkg = array_get(cat->pkgs, elem)) != NULL &&
              strcmp(nref->name, pkg->name) == 0);
 
@@ -1627,7 +3011,11 @@ static int tree_cat_foreach_pkg
       array_sort(cat->pkgs, tree_pkg_compar);
 
     array_for_each(cat->pkgs, n, pkg)
+    {
       ret |= callback(pkg, priv);
+      if (ret & TREE_FOREACH_STOP)
+        break;
+    }
 
     return ret;
   }
@@ -1734,9 +3122,9 @@ static int tree_cat_foreach_pkg
               !S_ISREG(sb.st_mode))
             continue;
 
-          pkg       = xzalloc(sizeof(*pkg));
-          pkg->name = xstrdup(pn);
-          pkg->path = xstrdup(buf);
+          pkg       = arena_zalloc(tree->arena, sizeof(*pkg));
+          pkg->name = arena_strdup(tree->arena, pn);
+          pkg->path = arena_strdup(tree->arena, buf);
           pkg->cat  = cat;
 
           if (cat->pkgs == NULL)
@@ -1745,6 +3133,7 @@ static int tree_cat_foreach_pkg
           mfound = true;
 
           if (!sorted &&
+              !(ret & TREE_FOREACH_STOP) &&
               (!filterpn ||
                tree_pkg_compar(&pkg, &nref) == 0))
             ret |= callback(pkg, priv);
@@ -1855,15 +3244,16 @@ static int tree_cat_foreach_pkg
                 memcmp(de->d_name + (nlen - (sizeof(".xpak") - 1)),
                        ".xpak", (sizeof(".xpak") - 1)) == 0)
             {
-              pkg       = xzalloc(sizeof(*pkg));
+              pkg       = arena_zalloc(tree->arena, sizeof(*pkg));
               pkg->atom = atom_explode_cat(de->d_name, cat->name);
-              pkg->name = xstrdup(pkg->atom->PN);
-              pkg->path = xstrdup(buf);
+              pkg->name = arena_strdup(tree->arena, pkg->atom->PN);
+              pkg->path = arena_strdup(tree->arena, buf);
               pkg->cat  = cat;
 
               array_append(cat->pkgs, pkg);
 
               if (!sorted &&
+                  !(ret & TREE_FOREACH_STOP) &&
                   (!filterpn ||
                    tree_pkg_compar(&pkg, &nref) == 0))
                 ret |= callback(pkg, priv);
@@ -1872,16 +3262,17 @@ static int tree_cat_foreach_pkg
                      memcmp(de->d_name + (nlen - (sizeof(".gpkg.tar") - 1)),
                             ".gpkg.tar", (sizeof(".gpkg.tar") - 1)) == 0)
             {
-              pkg              = xzalloc(sizeof(*pkg));
+              pkg              = arena_zalloc(tree->arena, sizeof(*pkg));
               pkg->atom        = atom_explode_cat(de->d_name, cat->name);
-              pkg->name        = xstrdup(pkg->atom->PN);
-              pkg->path        = xstrdup(buf);
+              pkg->name        = arena_strdup(tree->arena, pkg->atom->PN);
+              pkg->path        = arena_strdup(tree->arena, buf);
               pkg->cat         = cat;
               pkg->binpkg_gpkg = true;
 
               array_append(cat->pkgs, pkg);
 
               if (!sorted &&
+                  !(ret & TREE_FOREACH_STOP) &&
                   (!filterpn ||
                    tree_pkg_compar(&pkg, &nref) == 0))
                 ret |= callback(pkg, priv);
@@ -1897,15 +3288,16 @@ static int tree_cat_foreach_pkg
               memcmp(de->d_name + (nlen - (sizeof(".tbz2") - 1)),
                      ".tbz2", (sizeof(".tbz2") - 1)) == 0)
           {
-            pkg       = xzalloc(sizeof(*pkg));
+            pkg       = arena_zalloc(tree->arena, sizeof(*pkg));
             pkg->atom = atom_explode_cat(de->d_name, cat->name);
-            pkg->name = xstrdup(pkg->atom->PN);
-            pkg->path = xstrdup(buf);
+            pkg->name = arena_strdup(tree->arena, pkg->atom->PN);
+            pkg->path = arena_strdup(tree->arena, buf);
             pkg->cat  = cat;
 
             array_append(cat->pkgs, pkg);
 
             if (!sorted &&
+                !(ret & TREE_FOREACH_STOP) &&
                 (!filterpn ||
                  tree_pkg_compar(&pkg, &nref) == 0))
               ret |= callback(pkg, priv);
@@ -1914,16 +3306,17 @@ static int tree_cat_foreach_pkg
                    memcmp(de->d_name + (nlen - (sizeof(".gpkg.tar") - 1)),
                           ".gpkg.tar", (sizeof(".gpkg.tar") - 1)) == 0)
           {
-            pkg              = xzalloc(sizeof(*pkg));
+            pkg              = arena_zalloc(tree->arena, sizeof(*pkg));
             pkg->atom        = atom_explode_cat(de->d_name, cat->name);
-            pkg->name        = xstrdup(pkg->atom->PN);
-            pkg->path        = xstrdup(buf);
+            pkg->name        = arena_strdup(tree->arena, pkg->atom->PN);
+            pkg->path        = arena_strdup(tree->arena, buf);
             pkg->cat         = cat;
             pkg->binpkg_gpkg = true;
 
             array_append(cat->pkgs, pkg);
 
             if (!sorted &&
+                !(ret & TREE_FOREACH_STOP) &&
                 (!filterpn ||
                  tree_pkg_compar(&pkg, &nref) == 0))
               ret |= callback(pkg, priv);
@@ -1960,6 +3353,9 @@ static int tree_cat_foreach_pkg
       len = snprintf(buf, sizeof(buf), "%s/%s", tree->path, cat->name);
       if ((catfd = openat(tree->portroot_fd, buf, O_RDONLY | O_CLOEXEC)) < 0)
         return 0;
+      /* record the state we're about to see for the VDB index */
+      if (fstat(catfd, &sb) == 0)
+        cat->mtime = sb.st_mtim;
       if ((catdir = fdopendir(catfd)) == NULL)
       {
         close(catfd);
@@ -1992,52 +3388,514 @@ static int tree_cat_foreach_pkg
             !S_ISDIR(sb.st_mode))
           continue;
 
-        pkg       = xzalloc(sizeof(*pkg));
-        pkg->atom = atom_explode_cat(de->d_name, cat->name);
-        pkg->name = xstrdup(pkg->atom->PN);
-        pkg->path = xstrdup(buf);
-        pkg->cat  = cat;
+        pkg       = arena_zalloc(tree->arena, sizeof(*pkg));
+        pkg->atom = atom_explode_cat(de->d_name, cat->name);
+        pkg->name = arena_strdup(tree->arena, pkg->atom->PN);
+        pkg->path = arena_strdup(tree->arena, buf);
+        pkg->cat  = cat;
+
+        array_append(cat->pkgs, pkg);
+
+        if (!sorted &&
+            !(ret & TREE_FOREACH_STOP) &&
+            (!filterpn ||
+             tree_pkg_compar(&pkg, &nref) == 0))
+          ret |= callback(pkg, priv);
+      }
+
+      closedir(catdir);
+
+      cat->pkgs_complete = true;
+
+      if (sorted)
+      {
+        /* recurse, now use the built cache */
+        ret = tree_cat_foreach_pkg(cat, callback, priv, sorted, query);
+      }
+
+      return ret;
+    }
+    break; /* }}} */
+#ifdef ENABLE_GTREE
+  case TREE_GTREE: /* {{{ */
+    {
+      char   key[_Q_PATH_MAX];
+      size_t keylen;
+      size_t n;
+      size_t cnt = 0;
+      int    fd;
+
+      /* we only get here for directed queries, a full read of the
+       * gtree completes all categories */
+      if (!tree_gtree_index_load(tree))
+        return 0;
+
+      if (filterpn)
+        keylen = snprintf(key, sizeof(key), "%s/%s", cat->name, query->PN);
+      else
+        keylen = snprintf(key, sizeof(key), "%s/", cat->name);
+
+      fd = openat(tree->portroot_fd, tree->path, O_RDONLY | O_CLOEXEC);
+      if (fd < 0)
+        return 0;
+
+      for (n = tree_gtree_index_find(tree, key);
+           n < array_cnt(tree->gtidx_ents);
+           n++)
+      {
+        const char *ent = array_get(tree->gtidx_ents, n);
+
+        if (filterpn ?
+            strcmp(ent, key) != 0 :
+            strncmp(ent, key, keylen) != 0)
+          break;
+        cnt += tree_gtree_index_read(tree, fd, n);
+      }
+
+      close(fd);
+
+      if (!filterpn)
+        cat->pkgs_complete = true;
+      else if (cnt == 0)
+        return 0;
+
+      /* recurse, now use the built cache */
+      return tree_cat_foreach_pkg(cat, callback, priv, sorted, query);
+    }
+    break; /* }}} */
+#endif
+  default:
+    return 0;
+  }
+
+  /* unreachable */
+  return 0;
+}
+
+/* returns whether the category is excluded from traversal by skip,
+ * which holds the TREE_MATCH_VIRTUAL and TREE_MATCH_ACCT flags for the
+ * categories to leave out */
+static bool tree_cat_skipped
+(
+  const char *name,
+  int         skip
+)
+{
+  if (skip & TREE_MATCH_VIRTUAL &&
+      strcmp(name, "virtual") == 0)
+    return true;
+  if (skip & TREE_MATCH_ACCT &&
+      strncmp(name, "acct-", sizeof("acct-") - 1) == 0)
+    return true;
+  return false;
+}
+
+/* reads the categories of a directory based tree into its cache,
+ * invoking the callback function for packages matching the query in
+ * each category as it is found, unless callback is NULL, categories
+ * excluded by skip are listed, but not traversed */
+static int tree_read_cats
+(
+  tree_ctx       *tree,
+  tree_pkg_cb     callback,
+  void           *priv,
+  const atom_ctx *query,
+  int             skip
+)
+{
+  tree_cat_ctx  *cat;
+  tree_cat_ctx   needle;
+  DIR           *dir;
+  int            fd;
+  int            ret     = 0;
+  bool           domatch = tree->cats != NULL;
+
+  fd = openat(tree->portroot_fd, tree->path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return 0;
+  dir = fdopendir(fd);
+  if (dir == NULL)
+  {
+    close(fd);
+    return 0;
+  }
+
+  if (tree->cats == NULL)
+    tree->cats = array_new();
+
+  VAL_CLEAR(needle);
+  while (true)
+  {
+    struct dirent *de = readdir(dir);
+
+    if (de == NULL)
+      break;
+
+    if (tree_filter_cat(de) == 0)
+      continue;
+
+    cat = NULL;
+    if (domatch)
+    {
+      needle.name = de->d_name;
+      cat = array_binsearch(tree->cats, &needle, tree_cat_compar, NULL);
+    }
+
+    if (cat == NULL)
+    {
+      cat       = arena_zalloc(tree->arena, sizeof(*cat));
+      cat->name = arena_strdup(tree->arena, de->d_name);
+      cat->tree = tree;
+      array_append(tree->cats, cat);
+    }
+
+    /* after a stop, keep listing such that the cache is complete */
+    if (callback != NULL &&
+        !(ret & TREE_FOREACH_STOP) &&
+        !tree_cat_skipped(cat->name, skip))
+      ret |= tree_cat_foreach_pkg(cat, callback, priv, false, query);
+  }
+
+  tree->cats_complete = true;
+
+  closedir(dir);
+
+  return ret;
+}
+
+/* callback for tree_cat_foreach_pkg which does nothing, such that
+ * traversing a category merely populates its cache */
+static int tree_prefetch_cb
+(
+  tree_pkg_ctx *pkg,
+  void         *priv
+)
+{
+  (void)pkg;
+  (void)priv;
+
+  return 0;
+}
+
+/* populates the package caches for all categories in cats that aren't
+ * complete yet, nor excluded by skip, using a worker per category
+ * this is safe because a category traversal only touches its own
+ * cache, the tree is only used for reading (portroot_fd, path) */
+static void tree_prefetch_cats
+(
+  array          *cats,
+  const atom_ctx *query,
+  int             skip
+)
+{
+  size_t n;
+  size_t cnt = array_cnt(cats);
+
+  if (cnt < 2)
+    return;
+
+#pragma omp parallel for schedule(dynamic)
+  for (n = 0; n < cnt; n++)
+  {
+    tree_cat_ctx *cat = array_get(cats, n);
+
+    if (cat->pkgs_complete ||
+        tree_cat_skipped(cat->name, skip))
+      continue;
+    /* directed queries for ebuild trees only probe a single directory
+     * per category, a full scan would cost more than it would save */
+    if (query != NULL &&
+        query->PN != NULL &&
+        cat->tree->type == TREE_EBUILD)
+      continue;
+
+    tree_cat_foreach_pkg(cat, tree_prefetch_cb, NULL, false, NULL);
+  }
+}
+
+/* Packages {{{
+ * The Packages file consists of blocks of "KEY: value" lines separated
+ * by empty lines, the first block being a header.  The file (or its
+ * compressed variant) is parsed while it is read, line by line, such
+ * that it never needs to be kept in memory as a whole. */
+#define TREE_PACKAGES_BUFSIZE (64 * 1024)
+
+struct tree_packages_ctx {
+  tree_ctx     *tree;
+  tree_pkg_ctx *pkg;         /* NULL while in the header */
+  size_t        rootlen;     /* length of the directory of Packages */
+  char         *cpv;
+};
+
+/* finishes the block for the current package, adding it to the tree
+ * if it could be identified */
+static void tree_packages_finish
+(
+  struct tree_packages_ctx *pc
+)
+{
+  tree_ctx     *tree = pc->tree;
+  tree_pkg_ctx *pkg  = pc->pkg;
+  tree_cat_ctx *cat;
+  tree_cat_ctx  needle;
+  char          pth[_Q_PATH_MAX];
+  size_t        len;
+
+  /* create atom from the path if we have it, else use cpv */
+  if (pkg->meta[Q_PATH] != NULL)
+  {
+    char *pn     = strrchr(pkg->meta[Q_PATH], '/');
+    char *catend = strchr(pkg->meta[Q_PATH], '/');
+
+    if (pn == NULL) /* implies catend == NULL */
+      return;  /* have no version or anything, skip this */
+
+    /* construct full path */
+    snprintf(pth, sizeof(pth), "%.*s/%s",
+             (int)pc->rootlen, tree->path, pkg->meta[Q_PATH]);
+    pkg->path = arena_strdup(tree->arena, pth);
+
+    snprintf(pth, sizeof(pth), "%.*s",
+             (int)(catend - pkg->meta[Q_PATH]), pkg->meta[Q_PATH]);
+    pkg->atom = atom_explode_cat(pn + 1, pth);
+
+    len = strlen(pkg->meta[Q_PATH]);
+    if (len > sizeof(".gpkg.tar") - 1 &&
+        memcmp(pkg->meta[Q_PATH] + len - (sizeof(".gpkg.tar") - 1),
+               ".gpkg.tar", sizeof(".gpkg.tar") - 1) == 0)
+      pkg->binpkg_gpkg = true;
+  }
+  else if (pc->cpv != NULL)
+  {
+    /* this might be an old repo or something, so compute the
+     * path assuming it's from the base in PN/PF.tbz2 */
+    snprintf(pth, sizeof(pth), "%.*s/%s.tbz2",
+             (int)pc->rootlen, tree->path, pc->cpv);
+    pkg->path = arena_strdup(tree->arena, pth);
+    pkg->atom = atom_explode(pc->cpv);
+  }
+  else
+  {
+    return;  /* have no version or anything, skip this */
+  }
+  pkg->name = arena_strdup(tree->arena, pkg->atom->PN);
+
+  /* BUILD_ID sanity */
+  if (pkg->atom->BUILDID == 0 &&
+      pkg->meta[Q_BUILD_ID] != NULL)
+    pkg->atom->BUILDID = atoi(pkg->meta[Q_BUILD_ID]);
+
+  /* find category for this package */
+  VAL_CLEAR(needle);
+  needle.name = pkg->atom->CATEGORY;
+  cat = array_binsearch(tree->cats, &needle, tree_cat_compar, NULL);
+
+  if (cat == NULL)
+  {
+    cat = arena_zalloc(tree->arena, sizeof(*cat));
+    cat->name = arena_strdup(tree->arena, pkg->atom->CATEGORY);
+    cat->tree = tree;
+    array_append(tree->cats, cat);
+  }
+  if (cat->pkgs == NULL)
+    cat->pkgs = array_new();
+
+  pkg->cat = cat;
+  array_append(cat->pkgs, pkg);
+  pc->pkg = NULL;
+}
+
+/* processes a single line (without its newline) */
+static void tree_packages_line
+(
+  struct tree_packages_ctx *pc,
+  char                     *line,
+  size_t                    len
+)
+{
+  char   *k;
+  char   *v;
+  size_t  key;
+
+  if (len == 0)
+  {
+    /* empty line, finish a block */
+    if (pc->pkg != NULL)
+    {
+      tree_packages_finish(pc);
+      if (pc->pkg != NULL)
+        VAL_CLEAR(*pc->pkg);  /* skipped, reuse it */
+    }
+    if (pc->pkg == NULL)
+      pc->pkg = arena_zalloc(pc->tree->arena, sizeof(*pc->pkg));
+    free(pc->cpv);
+    pc->cpv = NULL;
+    return;
+  }
+
+  /* don't attempt to do anything with the header, which we
+   * ignore/not store anything of currently */
+  if (pc->pkg == NULL)
+    return;
+
+  v = memchr(line, ':', len);
+  if (v == NULL)
+    return;
+  *v++ = '\0';
+  line[len] = '\0';
+  k = rmspace(line);
+  v = rmspace(v);
+
+  key = tree_meta_key(k, strlen(k));
+  /* Packages uses a few names of its own */
+  if (key == Q_UNKNOWN)
+  {
+    if (strcmp(k, "CPV") == 0)
+    {
+      free(pc->cpv);
+      pc->cpv = xstrdup(v);
+    }
+    else if (strcmp(k, "DESC") == 0)
+      key = Q_DESCRIPTION;
+    else if (strcmp(k, "REPO") == 0)
+      key = Q_repository;
+  }
+  tree_pkg_meta_store(pc->tree, pc->pkg, key, v, strlen(v));
+}
+
+/* reads the Packages file (possibly compressed) the tree points to,
+ * populating the category and package caches */
+static bool tree_packages_read
+(
+  tree_ctx *tree
+)
+{
+  struct tree_packages_ctx  pc;
+  tree_cat_ctx             *cat;
+#ifdef HAVE_LIBARCHIVE
+  struct archive           *a = NULL;
+  struct archive_entry     *entry;
+#endif
+  char                     *buf;
+  char                     *p;
+  char                     *nl;
+  size_t                    bufsize = TREE_PACKAGES_BUFSIZE;
+  size_t                    fill    = 0;
+  size_t                    n;
+  ssize_t                   rd;
+  int                       fd;
+
+  fd = openat(tree->portroot_fd, tree->path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return false;
+
+#ifdef HAVE_LIBARCHIVE
+  /* anything but the plain file is compressed, let libarchive figure
+   * out which compression is used */
+  p = strrchr(tree->path, '/');
+  if (strcmp(p == NULL ? tree->path : p + 1, "Packages") != 0)
+  {
+    a = archive_read_new();
+    archive_read_support_filter_all(a);
+    archive_read_support_format_raw(a);
+    if (archive_read_open_fd(a, fd, TREE_PACKAGES_BUFSIZE) != ARCHIVE_OK ||
+        archive_read_next_header(a, &entry) != ARCHIVE_OK)
+    {
+      warn("could not read %s: %s", tree->path, archive_error_string(a));
+      archive_read_free(a);
+      close(fd);
+      return false;
+    }
+  }
+#endif
+
+  VAL_CLEAR(pc);
+  pc.tree = tree;
+  p = strrchr(tree->path, '/');
+  pc.rootlen = p != NULL ? (size_t)(p - tree->path) : strlen(tree->path);
 
-        array_append(cat->pkgs, pkg);
+  tree->cats = array_new();
+  buf = xmalloc(bufsize);
 
-        if (!sorted &&
-            (!filterpn ||
-             tree_pkg_compar(&pkg, &nref) == 0))
-          ret |= callback(pkg, priv);
+  for (;;)
+  {
+    /* always leave room for a terminating NUL */
+#ifdef HAVE_LIBARCHIVE
+    if (a != NULL)
+    {
+      rd = archive_read_data(a, buf + fill, bufsize - fill - 1);
+      if (rd == ARCHIVE_RETRY)
+        continue;
+      if (rd < 0)
+      {
+        warn("could not read %s: %s", tree->path, archive_error_string(a));
+        break;
       }
-
-      closedir(catdir);
-
-      cat->pkgs_complete = true;
-
-      if (sorted)
+    }
+    else
+#endif
+    {
+      rd = read(fd, buf + fill, bufsize - fill - 1);
+      if (rd < 0)
       {
-        /* recurse, now use the built cache */
-        ret = tree_cat_foreach_pkg(cat, callback, priv, sorted, query);
+        if (errno == EINTR)
+          continue;
+        warnp("could not read %s", tree->path);
+        break;
       }
+    }
+    if (rd == 0)
+      break;
 
-      return ret;
+    fill += (size_t)rd;
+    p     = buf;
+    while ((nl = memchr(p, '\n', fill - (p - buf))) != NULL)
+    {
+      tree_packages_line(&pc, p, nl - p);
+      p = nl + 1;
     }
-    break; /* }}} */
-  default:
-    return 0;
+
+    /* retain the incomplete last line for the next round */
+    fill -= p - buf;
+    if (fill > 0 && p != buf)
+      memmove(buf, p, fill);
+    else if (fill == bufsize - 1)
+      buf = xrealloc(buf, bufsize *= 2);  /* single very long line */
   }
 
-  /* unreachable */
-  return 0;
+  /* a final block need not end with an empty line */
+  if (fill > 0)
+    tree_packages_line(&pc, buf, fill);
+  if (pc.pkg != NULL)
+    tree_packages_finish(&pc);
+
+  free(pc.cpv);
+  free(buf);
+#ifdef HAVE_LIBARCHIVE
+  if (a != NULL)
+    archive_read_free(a);
+#endif
+  close(fd);
+
+  array_for_each(tree->cats, n, cat)
+    cat->pkgs_complete = true;
+  tree->cats_complete = true;
+
+  return rd == 0;
 }
+/* }}} */
 
-/* iterates over the given tree, invoking the callback function for
- * packages matching the query, or all when absent
- * the sorted parameter ensures the callback sees packages in order
- * defined by atom_compare */
-int tree_foreach_pkg
+/* implementation of tree_foreach_pkg, categories matching skip (see
+ * tree_cat_skipped) are never opened, the return value retains
+ * TREE_FOREACH_STOP if the callback requested it */
+static int tree_foreach_pkg_int
 (
   tree_ctx       *tree,
   tree_pkg_cb     callback,
   void           *priv,
   bool            sorted,
-  const atom_ctx *query
+  const atom_ctx *query,
+  int             skip
 )
 {
   tree_cat_ctx *cat       = NULL;
@@ -2053,6 +3911,10 @@ int tree_foreach_pkg
       query->CATEGORY != NULL)
     filtercat = true;
 
+  if (filtercat &&
+      tree_cat_skipped(query->CATEGORY, skip))
+    return 0;
+
   if (filtercat &&
       tree->cats != NULL)
   {
@@ -2077,8 +3939,19 @@ int tree_foreach_pkg
     if (sorted)
       array_sort(tree->cats, tree_cat_compar);
 
+    /* delivering results below happens in the same order as it would
+     * without prefetching, only the I/O is done up front */
+    if (tree->parallel)
+      tree_prefetch_cats(tree->cats, query, skip);
+
     array_for_each(tree->cats, n, cat)
+    {
+      if (tree_cat_skipped(cat->name, skip))
+        continue;
       ret |= tree_cat_foreach_pkg(cat, callback, priv, sorted, query);
+      if (ret & TREE_FOREACH_STOP)
+        break;
+    }
 
     return ret;
   }
@@ -2101,8 +3974,8 @@ int tree_foreach_pkg
           !S_ISDIR(sb.st_mode))
         return 0;
 
-      cat       = xzalloc(sizeof(*cat));
-      cat->name = xstrdup(query->CATEGORY);
+      cat       = arena_zalloc(tree->arena, sizeof(*cat));
+      cat->name = arena_strdup(tree->arena, query->CATEGORY);
       cat->tree = tree;
 
       if (tree->cats == NULL)
@@ -2111,294 +3984,52 @@ int tree_foreach_pkg
 
       return tree_cat_foreach_pkg(cat, callback, priv, sorted, query);
     }
-    else
+    else if (sorted ||
+             tree->parallel)
     {
-      tree_cat_ctx  needle;
-      DIR          *dir;
-      int           fd;
-      bool          domatch = tree->cats != NULL;
-
-      /* loop over directory and populate cache as side-effect, unless
-       * sort is requested, then populate first, sort and run from the
-       * cache afterwards */
-      fd = openat(tree->portroot_fd, tree->path, O_RDONLY | O_CLOEXEC);
-      if (fd < 0)
-        return 0;
-      dir = fdopendir(fd);
-      if (dir == NULL)
-      {
-        close(fd);
-        return 0;
-      }
-
-      if (tree->cats == NULL)
-        tree->cats = array_new();
-
-      VAL_CLEAR(needle);
-      while (true)
-      {
-        struct dirent *de = readdir(dir);
-
-        if (de == NULL)
-          break;
-
-        if (tree_filter_cat(de) == 0)
-          continue;
-
-        cat = NULL;
-        if (domatch)
-        {
-          needle.name = de->d_name;
-          cat = array_binsearch(tree->cats, &needle, tree_cat_compar, NULL);
-        }
+      /* populate first, then sort and/or fill the package caches
+       * concurrently and run from the cache afterwards */
+      tree_read_cats(tree, NULL, NULL, query, skip);
 
-        if (cat == NULL)
-        {
-          cat       = xzalloc(sizeof(*cat));
-          cat->name = xstrdup(de->d_name);
-          cat->tree = tree;
-          array_append(tree->cats, cat);
-        }
-
-        if (!sorted)
-          ret |= tree_cat_foreach_pkg(cat, callback, priv, sorted, query);
-      }
-
-      tree->cats_complete = true;
-
-      closedir(dir);
-
-      if (sorted)
-      {
-        /* recurse, now use the built cache */
-        ret = tree_foreach_pkg(tree, callback, priv, sorted, query);
-      }
-
-      return ret;
+      /* recurse, now use the built cache */
+      return tree_foreach_pkg_int(tree, callback, priv, sorted,
+                                  query, skip);
+    }
+    else
+    {
+      /* loop over directory and populate cache as side-effect */
+      return tree_read_cats(tree, callback, priv, query, skip);
     }
     break; /* }}} */
   case TREE_PACKAGES: /* {{{ */
-    {
-      tree_pkg_ctx      *pkg      = NULL;
-      tree_cat_ctx       needle;
-      char              *buf;
-      char              *k;
-      char              *v;
-      char              *cpv;
-      char              *nexttok;
-      size_t             len;
-      size_t             rootlen;
-      int                fd;
-      bool               eret;
-
-      fd = openat(tree->portroot_fd, tree->path, O_RDONLY | O_CLOEXEC);
-      if (fd < 0)
-        return 1;
-
-      buf  = NULL;
-      len  = 0;
-      eret = eat_file_fd(fd, &buf, &len);
-      close(fd);
-
-      if (!eret)
-        return 1;
-
-      k = strrchr(tree->path, '/');
-      if (k != NULL)
-        rootlen = k - tree->path;
-      else
-        rootlen = strlen(tree->path);
-
-      tree->cats = array_new();
-      VAL_CLEAR(needle);
-
-      for (k = strtok_r(buf, ":", &nexttok);
-           k != NULL;
-           k = strtok_r(NULL, ":", &nexttok))
-      {
-        k = rmspace(k);
-
-        v = strtok_r(NULL, "\n", &nexttok);
-        if (v == NULL)
-          break;
-        v = rmspace(v);
-
-        if (pkg == NULL)
-        {
-          /* don't attempt to do anything, this is the header which we
-           * ignore/not store anything of currently */
-        }
-        else
-        {
-          switch (k[0])
-          {
-          case 'B':
-#define keycmp(P,K) \
-            if (strcmp(&P[1], &(#K)[1]) == 0) \
-            { \
-              if (pkg->meta[Q_##K] == NULL) \
-                pkg->meta[Q_##K] = xstrdup(v); \
-              break; \
-            }
-            keycmp(k, BDEPEND);
-            keycmp(k, BUILD_ID);
-            break;
-          case 'C':
-            if (strcmp(&k[1], "PV") == 0)
-              cpv = v;
-            break;
-          case 'D':
-            keycmp(k, DEFINED_PHASES);
-            keycmp(k, DEPEND);
-            if (strcmp(&k[1], "ESC") == 0)
-            {
-              if (pkg->meta[Q_DESCRIPTION] == NULL)
-                pkg->meta[Q_DESCRIPTION] = xstrdup(v);
-              break;
-            }
-            break;
-          case 'E':
-            keycmp(k, EAPI);
-            break;
-          case 'I':
-            keycmp(k, IDEPEND);
-            keycmp(k, IUSE);
-            break;
-          case 'K':
-            keycmp(k, KEYWORDS);
-            break;
-          case 'L':
-            keycmp(k, LICENSE);
-            break;
-          case 'M':
-            keycmp(k, MD5);
-            break;
-          case 'P':
-            keycmp(k, PATH);
-            keycmp(k, PDEPEND);
-            break;
-          case 'R':
-            keycmp(k, RDEPEND);
-            if (strcmp(&k[1], "EPO") == 0)
-            {
-              if (pkg->meta[Q_repository] == NULL)
-                pkg->meta[Q_repository] = xstrdup(v);
-              break;
-            }
-            break;
-          case 'S':
-            keycmp(k, SHA1);
-            keycmp(k, SIZE);
-            keycmp(k, SLOT);
-            break;
-          case 'U':
-            keycmp(k, USE);
-            break;
-          default:
-            /* don't care/ignored */
-            break;
-          }
-        }
-
-        if (*nexttok == '\n')
-        {
-          /* double newline, finish a block */
-          if (pkg != NULL)
-          {
-            char pth[_Q_PATH_MAX];
-            /* create atom from the path if we have it, else use cpv */
-            if (pkg->meta[Q_PATH] != NULL)
-            {
-              char *pn     = strrchr(pkg->meta[Q_PATH], '/');
-              char *catend = strchr(pkg->meta[Q_PATH], '/');
-
-              if (pn == NULL) /* implies catend == NULL */
-              {
-                /* have no version or anything, skip this */
-                tree_pkg_close(pkg);
-                cpv = NULL;
-                pkg = xzalloc(sizeof(*pkg));
-                continue;
-              }
-
-              /* construct full path */
-              snprintf(pth, sizeof(pth), "%.*s/%s",
-                       (int)rootlen, tree->path, pkg->meta[Q_PATH]);
-              pkg->path = xstrdup(pth);
-
-              snprintf(pth, sizeof(pth), "%.*s",
-                       (int)(catend - pkg->meta[Q_PATH]), pkg->meta[Q_PATH]);
-              pkg->atom = atom_explode_cat(pn + 1, pth);
-
-              len = strlen(pkg->meta[Q_PATH]);
-              if (len > sizeof(".gpkg.tar") - 1 &&
-                  memcmp(pkg->meta[Q_PATH] + len - (sizeof(".gpkg.tar") - 1),
-                         ".gpkg.tar", sizeof(".gpkg.tar") - 1) == 0)
-                pkg->binpkg_gpkg = true;
-            }
-            else if (cpv != NULL)
-            {
-              /* this might be an old repo or something, so compute the
-               * path assuming it's from the base in PN/PF.tbz2 */
-              snprintf(pth, sizeof(pth), "%.*s/%s.tbz2",
-                       (int)rootlen, tree->path, cpv);
-              pkg->path = xstrdup(pth);
-              pkg->atom = atom_explode(cpv);
-            }
-            else
-            {
-              /* have no version or anything, skip this */
-              tree_pkg_close(pkg);
-              cpv = NULL;
-              pkg = xzalloc(sizeof(*pkg));
-              continue;
-            }
-            pkg->name = xstrdup(pkg->atom->PN);
-
-            /* BUILD_ID sanity */
-            if (pkg->atom->BUILDID == 0 &&
-                pkg->meta[Q_BUILD_ID] != NULL)
-              pkg->atom->BUILDID = atoi(pkg->meta[Q_BUILD_ID]);
-
-            /* find category for this package */
-            needle.name = pkg->atom->CATEGORY;
-            cat = array_binsearch(tree->cats, &needle, tree_cat_compar, NULL);
-
-            if (cat == NULL)
-            {
-              cat = xzalloc(sizeof(*cat));
-              cat->name = xstrdup(pkg->atom->CATEGORY);
-              cat->tree = tree;
-              array_append(tree->cats, cat);
-            }
-            if (cat->pkgs == NULL)
-              cat->pkgs = array_new();
-
-            pkg->cat = cat;
-            array_append(cat->pkgs, pkg);
-          }
-
-          /* prepare new package */
-          cpv = NULL;
-          pkg = xzalloc(sizeof(*pkg));
-        }
-      }
-
-      free(pkg);
-      free(buf);
-
-      array_for_each(tree->cats, len, cat)
-        cat->pkgs_complete = true;
-
-      tree->cats_complete = true;
+    if (!tree_packages_read(tree))
+      return 1;
 
-      /* ok, now do it for real */
-      return tree_foreach_pkg(tree, callback, priv, sorted, query);
-    }
+    /* ok, now do it for real */
+    return tree_foreach_pkg_int(tree, callback, priv, sorted, query, skip);
     break; /* }}} */
   case TREE_GTREE: /* {{{ */
 #ifdef ENABLE_GTREE
-    /* we don't optimise anything because reading a single file is fast
+    /* directed queries can use the index, if the gtree has one, and
+     * only decode the frames for the packages involved */
+    if (filtercat &&
+        tree_gtree_index_load(tree))
+    {
+      char   key[_Q_PATH_MAX];
+      size_t keylen;
+      size_t n;
+
+      keylen = snprintf(key, sizeof(key), "%s/", query->CATEGORY);
+      n      = tree_gtree_index_find(tree, key);
+      if (n >= array_cnt(tree->gtidx_ents) ||
+          strncmp(array_get(tree->gtidx_ents, n), key, keylen) != 0)
+        return 0;  /* no such category */
+
+      cat = tree_gtree_get_cat(tree, query->CATEGORY);
+      return tree_cat_foreach_pkg(cat, callback, priv, sorted, query);
+    }
+
+    /* for full scans we don't optimise anything because reading a single file is fast
      * enough, it just takes some memory, but any retrieval afterwards
      * comes straight from cache
      * gtree is designed to be efficient when doing dependency
@@ -2420,7 +4051,7 @@ int tree_foreach_pkg
      * slowness is virtually absent in that case */
     if (tree_foreach_pkg_gtree(tree) != 0)
       return 1;
-    return tree_foreach_pkg(tree, callback, priv, sorted, query);
+    return tree_foreach_pkg_int(tree, callback, priv, sorted, query, skip);
 #else
     return 0;
 #endif
@@ -2432,19 +4063,113 @@ int tree_foreach_pkg
   return 0;
 }
 
-/* callback for tree_foreach_pkg that appends the pkg to the array given
- * via priv */
+/* iterates over the given tree, invoking the callback function for
+ * packages matching the query, or all when absent
+ * the sorted parameter ensures the callback sees packages in order
+ * defined by atom_compare
+ * the callback can end the traversal by returning TREE_FOREACH_STOP,
+ * which isn't part of the returned value */
+int tree_foreach_pkg
+(
+  tree_ctx       *tree,
+  tree_pkg_cb     callback,
+  void           *priv,
+  bool            sorted,
+  const atom_ctx *query
+)
+{
+  return tree_foreach_pkg_int(tree, callback, priv, sorted, query, 0) &
+         ~TREE_FOREACH_STOP;
+}
+
+struct tree_match_ctx {
+  array *ret;
+  int    flags;
+};
+
+/* callback for tree_foreach_pkg_int that collects the matches in the
+ * array, applying the LATEST and FIRST flags on the way, packages are
+ * delivered sorted, so the latest version of a PN comes first */
 static int tree_match_atom_cb
 (
   tree_pkg_ctx *pkg,
   void         *priv
 )
 {
-  array *arr = priv;
+  struct tree_match_ctx *mc = priv;
+  tree_pkg_ctx          *last;
+
+  if (mc->flags & TREE_MATCH_LATEST &&
+      array_cnt(mc->ret) > 0)
+  {
+    last = array_get(mc->ret, array_cnt(mc->ret) - 1);
+    if (last->cat == pkg->cat &&
+        strcmp(last->name, pkg->name) == 0)
+      return 0;
+  }
 
-  array_append(arr, pkg);
+  array_append(mc->ret, pkg);
 
-  return 0;
+  return mc->flags & TREE_MATCH_FIRST ? TREE_FOREACH_STOP : 0;
+}
+
+/* populates the caches of all source trees of a merged tree, the
+ * categories of all trees are listed first, such that the workers can
+ * operate over categories from all trees at the same time */
+static void tree_prefetch_merged
+(
+  tree_ctx       *tree,
+  const atom_ctx *query,
+  int             skip
+)
+{
+  tree_ctx     *stree;
+  tree_cat_ctx *cat;
+  array        *cats = array_new();
+  size_t        cnt  = array_cnt(tree->srctrees);
+  size_t        n;
+  size_t        m;
+
+#pragma omp parallel for schedule(dynamic)
+  for (n = 0; n < cnt; n++)
+  {
+    tree_ctx *t = array_get(tree->srctrees, n);
+
+    if (!t->cats_complete &&
+        (t->type == TREE_EBUILD ||
+         t->type == TREE_VDB ||
+         t->type == TREE_BINPKGS))
+      tree_read_cats(t, NULL, NULL, query, skip);
+  }
+
+  array_for_each(tree->srctrees, n, stree)
+    array_for_each(stree->cats, m, cat)
+      array_append(cats, cat);
+
+  tree_prefetch_cats(cats, query, skip);
+
+  array_free(cats);
+}
+
+/* array_filter callback retaining only the first package seen for each
+ * CATEGORY/PN, priv points to the previously seen package */
+static bool tree_match_latest_cb
+(
+  void *elem,
+  void *priv
+)
+{
+  tree_pkg_ctx  *w   = elem;
+  tree_pkg_ctx **pre = priv;
+  bool           ret;
+
+  ret = *pre == NULL ||
+        tree_pkg_get_cat_name(*pre) != tree_pkg_get_cat_name(w) ||
+        strcmp(tree_pkg_atom(*pre, false)->PN,
+               tree_pkg_atom(w, false)->PN) != 0;
+  *pre = w;
+
+  return ret;
 }
 
 /* searches the given tree for packages matching the given atom, returns
@@ -2460,9 +4185,9 @@ array *tree_match_atom
 )
 {
   array        *ret    = array_new();
-  tree_pkg_ctx *w;
   size_t        n;
   bool          sorted = false;
+  int           skip;
 
   /* a note on the flags that we control the output results with:
    * - LATEST:  only return the best (latest version) match for each PN
@@ -2473,14 +4198,17 @@ array *tree_match_atom
    * - SORT:    return the results in sorted order, this is implied by
    *            LATEST and FIRST, and provided because the sort
    *            comparator is not exposed
-   * the flags are currently not supported by tree_foreach_pkg, so we
-   * manually fixup the array after traversal */
+   * all are applied during traversal: excluded categories are never
+   * opened, FIRST ends the traversal on the first match and LATEST
+   * only retains the first (best) version seen for each PN */
 
   if (flags & TREE_MATCH_FIRST  ||
       flags & TREE_MATCH_LATEST ||
       flags & TREE_MATCH_SORT   )
     sorted = true;
 
+  skip = ~flags & (TREE_MATCH_VIRTUAL | TREE_MATCH_ACCT);
+
   /* handle merged tree separately */
   if (tree->type == TREE_MERGED)
   {
@@ -2493,12 +4221,23 @@ array *tree_match_atom
      * - FIRST:  return the pkg from the first tree with a match
      * this allows to respect the order (e.g. VDB -> BINPKG -> TREE) of
      * preference without any extra checks from the caller */
+    if (tree->parallel &&
+        !(flags & TREE_MATCH_FIRST) &&
+        (atom == NULL ||
+         atom->CATEGORY == NULL))
+      tree_prefetch_merged(tree, atom, skip);
+
     array_for_each(tree->srctrees, n, stree)
     {
       match = tree_match_atom(stree, atom, flags);
       if (array_cnt(match) > 0)
       {
-        array_move(ret, match);
+        /* each tree returned its results in order, so retain that
+         * while pushing results from multiple trees */
+        if (sorted)
+          array_merge(ret, match, tree_pkg_cat_compar);
+        else
+          array_move(ret, match);
         array_free(match);
         if (flags & TREE_MATCH_FIRST)
           break;
@@ -2509,59 +4248,55 @@ array *tree_match_atom
       }
     }
 
-    /* need to re-sort because we pushed results from multiple trees */
-    if (sorted)
-      array_sort(ret, tree_pkg_compar);
-  }
-  else
-  {
-    tree_foreach_pkg(tree, tree_match_atom_cb, ret, sorted, atom);
-
-    if (!(flags & TREE_MATCH_VIRTUAL))
-    {
-      array_for_each_rev(ret, n, w)
-        if (strcmp(tree_pkg_get_cat_name(w), "virtual") == 0)
-          array_remove(ret, n);
-    }
-
-    if (!(flags & TREE_MATCH_ACCT))
-    {
-      array_for_each_rev(ret, n, w)
-        if (strncmp("acct-",
-                    tree_pkg_get_cat_name(w), sizeof("acct-") - 1) == 0)
-          array_remove(ret, n);
-    }
-
-    if (flags & TREE_MATCH_FIRST &&
+    /* each tree returned its latest, retain the best of those */
+    if (flags & TREE_MATCH_LATEST &&
         array_cnt(ret) > 1)
     {
-      /* a bit crude, we can optimise this later */
-      array *new = array_new();
-      array_append(new, array_get(ret, 0));
-      array_free(ret);
-      ret = new;
+      tree_pkg_ctx *pre = NULL;
+
+      array_filter(ret, tree_match_latest_cb, &pre);
     }
   }
-
-  if (flags & TREE_MATCH_LATEST)
+  else
   {
-    tree_pkg_ctx *suc;
+    struct tree_match_ctx mc;
+    bool                  parallel = tree->parallel;
 
-    array_for_each_rev(ret, n, w)
-    {
-      if (n == 0)
-        break;
-      suc = array_get(ret, n - 1);
-      if (tree_pkg_get_cat_name(suc) == tree_pkg_get_cat_name(w) &&
-          strcmp(tree_pkg_atom(suc, false)->PN,
-                 tree_pkg_atom(w, false)->PN) == 0)
-        array_remove(ret, n);
-    }
+    mc.ret   = ret;
+    mc.flags = flags;
+
+    /* prefetching all categories defeats stopping at the first hit */
+    if (flags & TREE_MATCH_FIRST)
+      tree->parallel = false;
+    tree_foreach_pkg_int(tree, tree_match_atom_cb, &mc, sorted, atom, skip);
+    tree->parallel = parallel;
   }
 
   return ret;
 }
 
+/* traverses the entire VDB tree and writes an index for it, which
+ * tree_new will use from then on for as long as it is valid, this is
+ * the only way the index gets written, reading the VDB never does
+ * returns true if the index was written successfully */
+bool tree_write_index
+(
+  tree_ctx *tree
+)
+{
+  if (tree == NULL ||
+      tree->type != TREE_VDB)
+    return false;
+
+  /* the index is current, nothing to do */
+  if (tree->vdbidx != NULL)
+    return true;
+
+  tree_foreach_pkg_fast(tree, tree_prefetch_cb, NULL, NULL);
+
+  return tree_vdb_index_write(tree);
+}
+
 /* reads metadata.xml next to an ebuild and produces a tree_metadata_xml
  * structure */
 tree_metadata_xml *tree_pkg_metadata
@@ -9,6 +9,7 @@
 #include <dirent.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #include "atom.h"
 #include "set.h"
@@ -22,8 +23,11 @@ struct tree_metadata_xml {
   array *email;
 };
 
-/* foreach pkg callback function signature */
+/* foreach pkg callback function signature, the return values of all
+ * invocations are or-ed together, including TREE_FOREACH_STOP ends
+ * the traversal after the current package */
 typedef int (tree_pkg_cb)(tree_pkg_ctx *, void *priv);
+#define TREE_FOREACH_STOP     (1<<30)
 
 /* these are the functional type of trees we can open, availability of
  * metadata and so on is determined automatically when feasible */
@@ -78,10 +82,26 @@ enum tree_pkg_meta_keys {
   TREE_META_MAX_KEYS
 };
 
+/* bitmask of meta keys for tree_set_keys, e.g.
+ * TREE_KEY(KEYWORDS) | TREE_KEY(IUSE) */
+#define TREE_KEY(K)     ((uint64_t)1 << Q_##K)
+#define TREE_KEYS_ALL   (~(uint64_t)0)
+
+enum tree_validate {
+  TREE_VALIDATE_MEMO = 0,
+  TREE_VALIDATE_TRUST,
+  TREE_VALIDATE_FULL,
+};
+
 tree_ctx           *tree_new(const char *portroot, const char *path,
                              enum tree_open_type type, bool quiet);
 tree_ctx           *tree_merge(tree_ctx *tree1, tree_ctx *tree2);
 void                tree_close(tree_ctx *tree);
+void                tree_set_parallel(tree_ctx *tree, bool parallel);
+void                tree_set_keys(tree_ctx *tree, uint64_t keys);
+void                tree_set_validation(tree_ctx *tree,
+                                        enum tree_validate mode);
+bool                tree_write_index(tree_ctx *tree);
 
 int                 tree_foreach_pkg(tree_ctx *tree, tree_pkg_cb callback,
                                      void *priv, bool sorted,
@@ -22,6 +22,7 @@
 #include "rmspace.h"
 #include "scandirat.h"
 #include "set.h"
+#include "tree.h"
 #include "xasprintf.h"
 
 /* variables to control runtime behavior */
@@ -54,6 +55,7 @@ array *overlay_src;
 static char *portedb;
 static char *eprefix;
 static char *accept_license;
+static char *md5cache_mode;
 
 #define STR_DEFAULT "built-in default"
 
@@ -845,6 +847,7 @@ env_vars vars_to_read[] = {
 	_Q_EVS(STR,  BINPKG_FORMAT,       binpkg_format,       true,  "gpkg")
 	_Q_EVS(STR,  Q_VDB,               portvdb,             true,  CONFIG_EPREFIX "var/db/pkg")
 	_Q_EVS(STR,  Q_EDB,               portedb,             true,  CONFIG_EPREFIX "var/cache/edb")
+	_Q_EVS(STR,  Q_MD5CACHE,          md5cache_mode,       true,  "memo")
 	{ NULL, 0, _Q_BOOL, { NULL }, 0, NULL, false, NULL, }
 
 #undef _Q_EV
@@ -1374,6 +1377,15 @@ int main(int argc, char **argv)
 
 	initialize_portage_env();
 
+	/* how much to trust md5-cache entries, memo only rehashes ebuilds
+	 * that changed since they were last found valid */
+	if (strcmp(md5cache_mode, "trust") == 0)
+		tree_set_validation(NULL, TREE_VALIDATE_TRUST);
+	else if (strcmp(md5cache_mode, "revalidate") == 0)
+		tree_set_validation(NULL, TREE_VALIDATE_FULL);
+	else if (strcmp(md5cache_mode, "memo") != 0)
+		warn("unknown Q_MD5CACHE mode '%s', using memo", md5cache_mode);
+
 	/* select or implicitly create overlay when given */
 	if (overlay != NULL)
 	{
@@ -30,13 +30,16 @@
 #include "atom.h"
 #include "basename.h"
 #include "eat_file.h"
+#include "hash.h"
 #include "human_readable.h"
+#include "matcher.h"
 #include "rmspace.h"
 #include "scandirat.h"
 #include "tree.h"
+#include "xasprintf.h"
 #include "xmkdir.h"
 
-#define Q_FLAGS "cij:oem" COMMON_FLAGS
+#define Q_FLAGS "cij:oemb" COMMON_FLAGS
 static struct option const q_long_opts[] = {
 	{"build-cache",   no_argument, NULL, 'c'},
 	{"install",       no_argument, NULL, 'i'},
@@ -44,15 +47,17 @@ static struct option const q_long_opts[] = {
 	{"overlays",      no_argument, NULL, 'o'},
 	{"envvar",        no_argument, NULL, 'e'},
 	{"masks",         no_argument, NULL, 'm'},
+	{"hash-bench",    no_argument, NULL, 'b'},
 	COMMON_LONG_OPTS
 };
 static const char * const q_opts_help[] = {
-	"(Re)Build ebuild/metadata cache for all available overlays",
+	"(Re)Build VDB index and ebuild/metadata cache for all overlays",
 	"Install symlinks for applets",
 	"Run minimalistic jobserver for given jobs",
 	"Print available overlays (read from repos.conf)",
 	"Print used variables and their found values",
 	"Print (package.)masks for the current profile",
+	"Print selected hash implementations and their throughput",
 	COMMON_OPTS_HELP
 };
 #define q_usage(ret) usage(ret, Q_FLAGS, q_long_opts, q_opts_help, NULL, lookup_applet_idx("q"))
@@ -119,7 +124,19 @@ struct q_cache_ctx {
 	size_t          cbufsiz;
 	size_t          cbuflen;
 	char            last_pkg[_Q_PATH_MAX];
+	struct archive *frame;       /* current caches.pack frame, if any */
+	int             packfd;
+	off_t           frameoff;
+	size_t          framelen;    /* uncompressed bytes in frame */
+	array          *framepkgs;   /* CAT/PN stored in frame */
+	array          *index;       /* caches.idx lines */
+	char            last_frame[_Q_PATH_MAX];
 };
+/* frames are closed at the first package boundary after this many
+ * (uncompressed) bytes, a frame per package compresses so poorly that
+ * caches.pack would be several times larger than the cache data in
+ * repo.tar, while decoding a frame of this size is still instant */
+#define Q_GTREE_FRAME_SIZE (64 * 1024)
 static int q_build_gtree_pkg_process_dir(struct q_cache_ctx *ctx,
 										 char               *path,
 										 char               *pbuf,
@@ -178,6 +195,34 @@ static int q_build_gtree_pkg_process_dir(struct q_cache_ctx *ctx,
 
 	return 0;
 }
+static void q_build_gtree_close_frame(struct q_cache_ctx *ctx)
+{
+	char   *line;
+	char   *pkg;
+	size_t  n;
+	off_t   end;
+
+	if (ctx->frame == NULL)
+		return;
+
+	archive_write_close(ctx->frame);
+	archive_write_free(ctx->frame);
+	ctx->frame = NULL;
+
+	/* all packages in the frame point to it */
+	end = lseek(ctx->packfd, 0, SEEK_CUR);
+	array_for_each(ctx->framepkgs, n, pkg) {
+		xasprintf(&line, "%s %lld %lld\n", pkg,
+				  (long long)ctx->frameoff, (long long)(end - ctx->frameoff));
+		array_append(ctx->index, line);
+	}
+	array_deepfree(ctx->framepkgs, NULL);
+	ctx->framepkgs = NULL;
+}
+static int q_build_gtree_index_compar(const void *l, const void *r)
+{
+	return strcmp(*(char **)l, *(char **)r);
+}
 static int q_build_gtree_cache_pkg(tree_pkg_ctx *pkg, void *priv)
 {
 	struct q_cache_ctx   *ctx   = priv;
@@ -188,6 +233,28 @@ static int q_build_gtree_cache_pkg(tree_pkg_ctx *pkg, void *priv)
 	char                 *qc;
 	size_t                qclen;
 
+	/* consecutive CAT/PNs are grouped in independently compressed
+	 * frames in caches.pack, such that readers can decode just what
+	 * they need, a CAT/PN never spans frames */
+	snprintf(buf, sizeof(buf), "%s/%s", atom->CATEGORY, atom->PN);
+	if (ctx->frame == NULL || strcmp(ctx->last_frame, buf) != 0) {
+		if (ctx->framelen >= Q_GTREE_FRAME_SIZE)
+			q_build_gtree_close_frame(ctx);
+		if (ctx->frame == NULL) {
+			ctx->frameoff  = lseek(ctx->packfd, 0, SEEK_CUR);
+			ctx->framelen  = 0;
+			ctx->framepkgs = array_new();
+			ctx->frame     = archive_write_new();
+			archive_write_set_format_ustar(ctx->frame);
+			archive_write_add_filter_gzip(ctx->frame);
+			/* no padding, frames are concatenated */
+			archive_write_set_bytes_in_last_block(ctx->frame, 1);
+			archive_write_open_fd(ctx->frame, ctx->packfd);
+		}
+		snprintf(ctx->last_frame, sizeof(ctx->last_frame), "%s", buf);
+		array_append(ctx->framepkgs, xstrdup(buf));
+	}
+
 	/* construct the common prefix */
 	snprintf(buf, sizeof(buf), "caches/%s/%s", atom->CATEGORY, atom->PF);
 
@@ -240,7 +307,10 @@ static int q_build_gtree_cache_pkg(tree_pkg_ctx *pkg, void *priv)
 	archive_entry_set_perm(entry, 0644);
 	archive_write_header(a, entry);
 	archive_write_data(a, ctx->cbuf, ctx->cbuflen);
+	archive_write_header(ctx->frame, entry);
+	archive_write_data(ctx->frame, ctx->cbuf, ctx->cbuflen);
 	archive_entry_free(entry);
+	ctx->framelen += 512 + ctx->cbuflen;
 
 	return 0;
 }
@@ -442,6 +512,7 @@ int q_main(int argc, char **argv)
 	bool print_overlays;
 	bool print_vars;
 	bool print_masks;
+	bool hash_benchmark;
 	const char *p;
 	const char *jobs;
 	APPLET func;
@@ -465,6 +536,7 @@ int q_main(int argc, char **argv)
 	print_overlays = false;
 	print_vars     = false;
 	print_masks    = false;
+	hash_benchmark = false;
 	while ((i = GETOPT_LONG(Q, q, "+")) != -1) {
 		switch (i) {
 		COMMON_GETOPTS_CASES(q)
@@ -475,6 +547,7 @@ int q_main(int argc, char **argv)
 		case 'o': print_overlays = true;   break;
 		case 'e': print_vars     = true;   break;
 		case 'm': print_masks    = true;   break;
+		case 'b': hash_benchmark = true;   break;
 		}
 	}
 
@@ -531,6 +604,9 @@ int q_main(int argc, char **argv)
 		return ret;
 	}
 
+	if (hash_benchmark)
+		return hash_bench(stdout);
+
 	if (print_overlays) {
 		char *overlay;
 		char *repo_name = NULL;
@@ -658,36 +734,34 @@ int q_main(int argc, char **argv)
 		char *mask;
 		size_t n;
 		int j;
-		bool match;
+		matcher_t *qatoms = NULL;
 		char *lastmfile = NULL;
 		long lastcbeg = 0;
 		long lastcend = 0;
 		char *buf = NULL;
 		size_t buflen = 0;
 		depend_atom *atom;
-		depend_atom *qatom;
 
 		masks = hash_keys(package_masks);
 		files = hash_values(package_masks);
 
+		/* compile the arguments once, rather than for every mask */
+		if (argc > optind) {
+			qatoms = matcher_new();
+			for (j = optind; j < argc; j++)
+				matcher_add(qatoms, argv[j], NULL);
+		}
+
 		array_for_each(masks, n, mask) {
 			if ((atom = atom_explode(mask)) == NULL)
 				continue;
 
-			match = true;
-			if (argc > optind) {
-				match = false;
-				for (j = optind; j < argc; j++) {
-					qatom = atom_explode(argv[j]);
-					if (qatom != NULL && atom_compare(atom, qatom) == EQUAL)
-						match = true;
-					atom_implode(qatom);
-					if (match)
-						break;
-				}
-			}
-			if (!match)
+			if (qatoms != NULL &&
+					matcher_match(qatoms, atom, NULL) == NULL)
+			{
+				atom_implode(atom);
 				continue;
+			}
 
 			if (verbose > 1) {
 				char *mfile = (char *)array_get(files, n);
@@ -751,15 +825,29 @@ int q_main(int argc, char **argv)
 
 		array_free(masks);
 		array_free(files);
+		matcher_free(qatoms);
 
 		return 0;
 	}
 
 	if (build_cache) {
+		tree_ctx *vdb;
+
+		/* the VDB index is a plain snapshot of what's installed, it is
+		 * ignored once outdated, until written again here */
+		if (verbose)
+			printf("building index for %s%s%s\n", BLUE, portvdb, NORM);
+		vdb = tree_new(portroot, portvdb, TREETYPE_VDB, true);
+		if (vdb != NULL) {
+			if (!tree_write_index(vdb))
+				warn("could not write index for VDB at %s", portvdb);
+			tree_close(vdb);
+		}
+
 #ifdef ENABLE_GTREE
 		/* traverse all overlays, create a cache for each
 		 * the cache basically is one giant tar with:
-		 * - gtree-1  (mandatory, first file ident)
+		 * - gtree-2  (mandatory, first file ident)
 		 * - repo.tar{compr}
 		 *   - repository
 		 *   - cache/CAT/PF  (extracted info from the ebuild)
@@ -770,6 +858,8 @@ int q_main(int argc, char **argv)
 		 *     + files/ (the directory from the tree)
 		 *   - eclasses/ (the directory from the tree)
 		 * - repo.tar{compr}.sig
+		 * - caches.idx (sorted CAT/PN offset length into caches.pack)
+		 * - caches.pack (concatenated compressed tars with caches/CAT/PF)
 		 * but all of them within are guaranteed to be consistent with
 		 * each other (it is one snapshot)
 		 * the cache is suitable for distribution
@@ -783,7 +873,9 @@ int q_main(int argc, char **argv)
 		 * small price to pay once the whole of the dep-resolving can be
 		 * done without questions of validity. */
 		char                 *overlay;
+		char                 *line;
 		size_t                n;
+		size_t                m;
 		tree_ctx             *t;
 		struct archive       *a;
 		struct archive_entry *entry;
@@ -794,6 +886,7 @@ int q_main(int argc, char **argv)
 		ssize_t               rlen;
 		int                   dfd;
 		int                   tfd;
+		int                   pfd;
 		int                   fd;
 
 		memset(&qcctx, 0, sizeof(qcctx));
@@ -844,7 +937,7 @@ int q_main(int argc, char **argv)
 			 * nothing should rely on that */
 			len = snprintf(buf, sizeof(buf), "portage-utils-" VERSION);
 			entry = archive_entry_new();
-			archive_entry_set_pathname(entry, "gtree-1");
+			archive_entry_set_pathname(entry, "gtree-2");
 			archive_entry_set_size(entry, len);
 			archive_entry_set_mtime(entry, qcctx.buildtime, 0);
 			archive_entry_set_filetype(entry, AE_IFREG);
@@ -872,6 +965,23 @@ int q_main(int argc, char **argv)
 			}
 			unlink(buf);  /* make invisible, drop on close */
 
+			/* same for the frames for caches.pack */
+			snprintf(buf, sizeof(buf),
+					 "%s/%s/metadata/gtree.XXXXXX", portroot, overlay);
+			pfd = mkstemp(buf);
+			if (pfd < 0) {
+				warnp("failed to open temp file");
+				close(tfd);
+				tree_close(t);
+				archive_write_close(a);
+				archive_write_free(a);
+				continue;
+			}
+			unlink(buf);
+			qcctx.packfd        = pfd;
+			qcctx.index         = array_new();
+			qcctx.last_frame[0] = '\0';
+
 			qcctx.archive = archive_write_new();
 			archive_write_set_format_ustar(qcctx.archive);
 			/* would love to use this:
@@ -899,6 +1009,7 @@ int q_main(int argc, char **argv)
 
 			/* add cache and ebuilds */
 			tree_foreach_pkg(t, q_build_gtree_cache_pkg, &qcctx, true, NULL);
+			q_build_gtree_close_frame(&qcctx);
 			qcctx.last_pkg[0] = '\0';
 			tree_foreach_pkg(t, q_build_gtree_ebuilds_pkg, &qcctx, true, NULL);
 
@@ -938,6 +1049,41 @@ int q_main(int argc, char **argv)
 			/* cleanup repo archive */
 			close(tfd);
 
+			/* the index, sorted such that it can be searched */
+			array_sort(qcctx.index, q_build_gtree_index_compar);
+			len = 0;
+			array_for_each(qcctx.index, m, line)
+				len += strlen(line);
+			entry = archive_entry_new();
+			archive_entry_set_pathname(entry, "caches.idx");
+			archive_entry_set_size(entry, len);
+			archive_entry_set_mtime(entry, qcctx.buildtime, 0);
+			archive_entry_set_filetype(entry, AE_IFREG);
+			archive_entry_set_perm(entry, 0644);
+			archive_write_header(a, entry);
+			array_for_each(qcctx.index, m, line)
+				archive_write_data(a, line, strlen(line));
+			archive_entry_free(entry);
+			array_deepfree(qcctx.index, NULL);
+			qcctx.index = NULL;
+
+			/* and the frames it points to */
+			if (fstat(pfd, &st) >= 0)
+			{
+				entry = archive_entry_new();
+				archive_entry_set_pathname(entry, "caches.pack");
+				archive_entry_set_size(entry, st.st_size);
+				archive_entry_set_mtime(entry, qcctx.buildtime, 0);
+				archive_entry_set_filetype(entry, AE_IFREG);
+				archive_entry_set_perm(entry, 0644);
+				archive_write_header(a, entry);
+				lseek(pfd, 0, SEEK_SET);
+				while ((rlen = read(pfd, buf, sizeof(buf))) > 0)
+					archive_write_data(a, buf, rlen);
+				archive_entry_free(entry);
+			}
+			close(pfd);
+
 			archive_write_close(a);
 			archive_write_free(a);
 
@@ -958,11 +1104,9 @@ int q_main(int argc, char **argv)
 		}
 
 		free(qcctx.cbuf);
+#endif
 
 		return 0;
-#else
-		err("gtree support not compiled in");
-#endif
 	}
 
 	if (run_jobserver) {
@@ -15,6 +15,9 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <xalloc.h>
+#ifdef _OPENMP
+# include <omp.h>
+#endif
 
 #include "array.h"
 #include "atom.h"
@@ -22,6 +25,7 @@
 #include "copy_file.h"
 #include "hash.h"
 #include "prelink.h"
+#include "set.h"
 #include "tree.h"
 #include "xasprintf.h"
 #include "xregex.h"
@@ -29,7 +33,7 @@
 #define QCHECK_FORMAT "%[CATEGORY]%[PN]"
 #define QCHECK_FORMAT_VERBOSE "%[CATEGORY]%[PF]"
 
-#define QCHECK_FLAGS "F:s:uABHTPp" COMMON_FLAGS
+#define QCHECK_FLAGS "F:s:uABHTPpj:" COMMON_FLAGS
 static struct option const qcheck_long_opts[] = {
 	{"format",          a_argument, NULL, 'F'},
 	{"skip",            a_argument, NULL, 's'},
@@ -40,6 +44,7 @@ static struct option const qcheck_long_opts[] = {
 	{"nomtime",        no_argument, NULL, 'T'},
 	{"skip-protected", no_argument, NULL, 'P'},
 	{"prelink",        no_argument, NULL, 'p'},
+	{"jobs",            a_argument, NULL, 'j'},
 	COMMON_LONG_OPTS
 };
 static const char * const qcheck_opts_help[] = {
@@ -52,11 +57,12 @@ static const char * const qcheck_opts_help[] = {
 	"Ignore differing file mtimes",
 	"Ignore files in CONFIG_PROTECT-ed paths",
 	"Undo prelink when calculating checksums",
+	"Check <arg> packages in parallel (0 for the number of CPUs)",
 	COMMON_OPTS_HELP
 };
 #define qcheck_usage(ret) usage(ret, QCHECK_FLAGS, qcheck_long_opts, qcheck_opts_help, NULL, lookup_applet_idx("qcheck"))
 
-#define qcprintf(fmt, args...) do { if (!state->bad_only) printf(fmt, ## args); } while (0)
+#define qcprintf(fmt, args...) do { if (!state->bad_only) fprintf(out, fmt, ## args); } while (0)
 
 struct qcheck_opt_state {
 	array *atoms;
@@ -69,14 +75,54 @@ struct qcheck_opt_state {
 	bool chk_config_protect;
 	bool undo_prelink;
 	const char *fmt;
+	int jobs;
+	array *pkgs;
+	set_t *pkgs_seen;     /* paths of pkgs, to collect each only once */
 };
 
+/* a package to check, everything needed from the tree is retrieved up
+ * front, such that packages can be checked concurrently without
+ * touching the tree, the report is written to out */
+struct qcheck_pkg {
+	char   *contents;
+	char   *eprefix;
+	char   *name;         /* the atom formatted for display */
+	char   *path;
+	int     portroot_fd;
+	FILE   *out;
+	char   *outbuf;
+	size_t  outlen;
+	int     ret;
+};
+
+static bool
+qcheck_pkg_init(
+		struct qcheck_opt_state *state,
+		tree_pkg_ctx *pkg_ctx,
+		struct qcheck_pkg *qp)
+{
+	memset(qp, 0, sizeof(*qp));
+
+	/* get CONTENTS from meta */
+	qp->contents = tree_pkg_meta(pkg_ctx, Q_CONTENTS);
+	if (qp->contents == NULL)
+		return false;
+
+	qp->name        = xstrdup(atom_format(state->fmt,
+				tree_pkg_atom(pkg_ctx, false)));
+	qp->path        = tree_pkg_get_path(pkg_ctx);
+	qp->portroot_fd = tree_pkg_get_portroot_fd(pkg_ctx);
+	if (!state->chk_config_protect)
+		qp->eprefix = tree_pkg_meta(pkg_ctx, Q_EPREFIX);
+
+	return true;
+}
+
 static int
-qcheck_cb(tree_pkg_ctx *pkg_ctx, void *priv)
+qcheck_pkg_check(struct qcheck_opt_state *state, struct qcheck_pkg *qp)
 {
-	struct qcheck_opt_state *state = priv;
 	struct stat              st;
-	depend_atom             *atom;
+	FILE                    *out                = qp->out;
 	FILE                    *fp_contents_update = NULL;
 	size_t                   num_files          = 0;
 	size_t                   num_files_ok       = 0;
@@ -85,25 +131,19 @@ qcheck_cb(tree_pkg_ctx *pkg_ctx, void *priv)
 	char                    *buffer;
 	char                    *line;
 	char                    *savep;
-	char                    *eprefix            = NULL;
+	char                    *eprefix            = qp->eprefix;
 	size_t                   eprefix_len        = 0;
 	int                      cp_argc;
 	int                      cpm_argc;
 	char                   **cp_argv;
 	char                   **cpm_argv;
-	int                      portroot_fd;
-
-	/* get CONTENTS from meta */
-	line = tree_pkg_meta(pkg_ctx, Q_CONTENTS);
-	if (line == NULL)
-		return EXIT_FAILURE;
+	int                      portroot_fd        = qp->portroot_fd;
+	contents_entry           ce;
 
-	atom        = tree_pkg_atom(pkg_ctx, false);
-	portroot_fd = tree_pkg_get_portroot_fd(pkg_ctx);
+	line = qp->contents;
 
 	qcprintf("%sing %s ...\n",
-		(state->qc_update ? "Updat" : "Check"),
-		atom_format(state->fmt, atom));
+		(state->qc_update ? "Updat" : "Check"), qp->name);
 
 	/* Open contents_update, if needed */
 	if (state->qc_update) {
@@ -128,7 +168,6 @@ qcheck_cb(tree_pkg_ctx *pkg_ctx, void *priv)
 		makeargv(config_protect, &cp_argc, &cp_argv);
 		makeargv(config_protect_mask, &cpm_argc, &cpm_argv);
 
-		eprefix = tree_pkg_meta(pkg_ctx, Q_EPREFIX);
 		if (eprefix != NULL)
 			eprefix_len = strlen(eprefix);
 	}
@@ -139,7 +178,7 @@ qcheck_cb(tree_pkg_ctx *pkg_ctx, void *priv)
 		free(buffer);
 		buffer = xstrdup(line);
 
-		entry = contents_parse_line(line);
+		entry = contents_parse_line_r(&ce, line);
 		if (!entry)
 			continue;
 
@@ -240,7 +279,9 @@ qcheck_cb(tree_pkg_ctx *pkg_ctx, void *priv)
 		 * do check hashes, but only print mismatched digests as
 		 * 'ignored file'. */
 		if (entry->digest && S_ISREG(st.st_mode)) {
+			char  digest[SHA1_DIGEST_LENGTH + 1];
 			char *f_digest;
+			size_t flen;
 			int   hash_algo;
 
 			/* Validate digest (handles MD5 / SHA1)
@@ -269,11 +310,16 @@ qcheck_cb(tree_pkg_ctx *pkg_ctx, void *priv)
 				continue;
 			}
 
-			/* compute hash for file */
+			/* compute hash for file, into a buffer of our own, unlike
+			 * hash_file_at_cb, such that other threads can do the same */
 			hash_cb_t hash_cb =
 				state->undo_prelink ? hash_cb_prelink_undo : NULL;
-			f_digest = hash_file_at_cb(portroot_fd,
-									   entry->name + 1, hash_algo, hash_cb);
+			f_digest = NULL;
+			if (hash_multiple_file_at_cb(portroot_fd, entry->name + 1,
+										 hash_cb, digest, digest,
+										 NULL, NULL, NULL,
+										 &flen, hash_algo) == 0)
+				f_digest = digest;
 
 			/* Digest-check 2/3:
 			 * do we have digest of the file? */
@@ -384,8 +430,7 @@ qcheck_cb(tree_pkg_ctx *pkg_ctx, void *priv)
 		FILE *fp_contents;
 		char path[_Q_PATH_MAX];
 
-		snprintf(path, sizeof(path), "%s/CONTENTS",
-				 tree_pkg_get_path(pkg_ctx));
+		snprintf(path, sizeof(path), "%s/CONTENTS", qp->path);
 		/* O_TRUNC truncates, but file owner and mode are unchanged */
 		fd_contents = openat(portroot_fd, path, O_WRONLY | O_TRUNC);
 		if (fd_contents < 0 ||
@@ -409,7 +454,7 @@ qcheck_cb(tree_pkg_ctx *pkg_ctx, void *priv)
 	}
 
 	if (state->bad_only && num_files_ok != num_files)
-		printf("%s\n", atom_format(state->fmt, atom));
+		fprintf(out, "%s\n", qp->name);
 	qcprintf("  %2$s*%1$s %3$s%4$zu%1$s out of %3$s%5$zu%1$s file%6$s are good",
 		NORM, BOLD, BLUE, num_files_ok, num_files,
 		(num_files != 1 ? "s" : ""));
@@ -429,11 +474,101 @@ qcheck_cb(tree_pkg_ctx *pkg_ctx, void *priv)
 		return EXIT_SUCCESS;
 }
 
+static int
+qcheck_cb(tree_pkg_ctx *pkg_ctx, void *priv)
+{
+	struct qcheck_opt_state *state = priv;
+	struct qcheck_pkg        qp;
+	int                      ret;
+
+	if (!qcheck_pkg_init(state, pkg_ctx, &qp))
+		return EXIT_FAILURE;
+
+	qp.out = stdout;
+	ret = qcheck_pkg_check(state, &qp);
+	free(qp.name);
+
+	return ret;
+}
+
+/* collects the packages for qcheck_run_parallel */
+static int
+qcheck_collect_cb(tree_pkg_ctx *pkg_ctx, void *priv)
+{
+	struct qcheck_opt_state *state = priv;
+	struct qcheck_pkg       *qp;
+	bool                     uniq;
+
+	/* the same package may match more than one of the atoms given,
+	 * checking it twice concurrently would have both chop up the same
+	 * CONTENTS, and with -u both rewrite it */
+	state->pkgs_seen = set_add_unique(state->pkgs_seen,
+			tree_pkg_get_path(pkg_ctx), &uniq);
+	if (!uniq)
+		return EXIT_SUCCESS;
+
+	qp = xmalloc(sizeof(*qp));
+	if (!qcheck_pkg_init(state, pkg_ctx, qp)) {
+		free(qp);
+		return EXIT_FAILURE;
+	}
+
+	array_append(state->pkgs, qp);
+	return EXIT_SUCCESS;
+}
+
+/* checks the collected packages using a pool of state->jobs threads,
+ * each package reports into a buffer of its own, which is printed once
+ * all packages before it are done, such that the output is the same as
+ * when checking one package at a time
+ * when updating, each package only rewrites its own CONTENTS */
+static int
+qcheck_run_parallel(struct qcheck_opt_state *state)
+{
+	size_t cnt = array_cnt(state->pkgs);
+	size_t n;
+	int    ret = 0;
+
+#pragma omp parallel for ordered schedule(dynamic) num_threads(state->jobs)
+	for (n = 0; n < cnt; n++) {
+		struct qcheck_pkg *qp = array_get(state->pkgs, n);
+
+		qp->out = open_memstream(&qp->outbuf, &qp->outlen);
+		if (qp->out == NULL) {
+			warnp("unable to allocate output buffer");
+			qp->ret = EXIT_FAILURE;
+		} else {
+			qp->ret = qcheck_pkg_check(state, qp);
+			fclose(qp->out);
+		}
+
+#pragma omp ordered
+		{
+			if (qp->outbuf != NULL)
+				fwrite(qp->outbuf, 1, qp->outlen, stdout);
+			ret |= qp->ret;
+		}
+
+		free(qp->outbuf);
+		free(qp->name);
+		free(qp);
+	}
+
+	array_free(state->pkgs);
+	state->pkgs = NULL;
+	set_free(state->pkgs_seen);
+	state->pkgs_seen = NULL;
+
+	return ret;
+}
+
 int qcheck_main(int argc, char **argv)
 {
 	size_t i;
 	int ret;
+	char *p;
 	tree_ctx *vdb;
+	tree_pkg_cb *cb = qcheck_cb;
 	depend_atom *atom;
 	struct qcheck_opt_state state = {
 		.atoms = array_new(),
@@ -446,6 +581,9 @@ int qcheck_main(int argc, char **argv)
 		.chk_config_protect = true,
 		.undo_prelink = false,
 		.fmt = NULL,
+		.jobs = 1,
+		.pkgs = NULL,
+		.pkgs_seen = NULL,
 	};
 
 	while ((ret = GETOPT_LONG(QCHECK, qcheck, "")) != -1) {
@@ -465,9 +603,28 @@ int qcheck_main(int argc, char **argv)
 		case 'P': state.chk_config_protect = false;          break;
 		case 'p': state.undo_prelink = prelink_available();  break;
 		case 'F': state.fmt = optarg;                        break;
+		case 'j':
+			state.jobs = (int)strtol(optarg, &p, 10);
+			if (*optarg == '\0' || *p != '\0' || state.jobs < 0)
+				err("invalid argument to --jobs: '%s'", optarg);
+			break;
 		}
 	}
 
+#ifdef _OPENMP
+	if (state.jobs == 0)
+		state.jobs = omp_get_max_threads();
+#endif
+	/* prelink is run by forked helpers feeding a pipe, which would be
+	 * inherited by the helpers forked from other threads, keeping it
+	 * open after the helper is done */
+	if (state.jobs < 1 || state.undo_prelink)
+		state.jobs = 1;
+	if (state.jobs > 1) {
+		state.pkgs = array_new();
+		cb = qcheck_collect_cb;
+	}
+
 	if (state.fmt == NULL)
 		state.fmt = verbose ? QCHECK_FORMAT_VERBOSE : QCHECK_FORMAT;
 
@@ -487,11 +644,14 @@ int qcheck_main(int argc, char **argv)
 		if (array_cnt(state.atoms) != 0) {
 			ret = 0;
 			array_for_each(state.atoms, i, atom) {
-				ret |= tree_foreach_pkg_sorted(vdb, qcheck_cb, &state, atom);
+				ret |= tree_foreach_pkg_sorted(vdb, cb, &state, atom);
 			}
 		} else {
-			ret = tree_foreach_pkg_sorted(vdb, qcheck_cb, &state, NULL);
+			ret = tree_foreach_pkg_sorted(vdb, cb, &state, NULL);
 		}
+		/* the packages refer to the tree, so check before closing */
+		if (state.pkgs != NULL)
+			ret |= qcheck_run_parallel(&state);
 		tree_close(vdb);
 	}
 
@@ -502,5 +662,6 @@ int qcheck_main(int argc, char **argv)
     }
 	array_deepfree(state.regex_arr, NULL);
 	array_deepfree(state.atoms, (array_free_cb *)atom_implode);
+	array_free(state.pkgs);
 	return ret != 0;
 }
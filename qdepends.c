@@ -460,6 +460,7 @@ int qdepends_main(int argc, char **argv)
       array_deepfree(state.atoms, (array_free_cb *)atom_implode);
       err("failed to open VDB at %s", portvdb);
     }
+    tree_set_parallel(state.vdb, true);
   }
 
   ret = 0;
@@ -473,6 +474,7 @@ int qdepends_main(int argc, char **argv)
     {
       t = tree_new(portroot, overlay, TREETYPE_EBUILD, false);
       if (t != NULL) {
+        tree_set_parallel(t, true);
         if (!(state.qmode & QMODE_REVERSE) &&
             array_cnt(state.atoms) > 0)
         {
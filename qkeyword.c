@@ -18,6 +18,7 @@
 #include <sys/stat.h>
 
 #include "atom.h"
+#include "matcher.h"
 #include "rmspace.h"
 #include "scandirat.h"
 #include "set.h"
@@ -69,6 +70,7 @@ typedef struct {
 	char *qmaint;
 	int *keywordsbuf;
 	size_t keywordsbuflen;
+	const char *lastkeywords;
 	const char *arch;
 	tree_pkg_cb *runfunc;
 	const char *fmt;
@@ -79,7 +81,7 @@ static array *archlist = NULL;
 static size_t arch_longest_len;
 static const char status[3] = {'-', '~', '+'};
 static int qkeyword_test_arch = 0;
-static hash_t *pmasks = NULL;
+static matcher_t *pmasks = NULL;
 
 enum { none = 0, testing, stable, minus };
 
@@ -108,23 +110,26 @@ decode_status(char c)
  *
  * IN:
  *  const char *arch - name of an arch (alpha, amd64, ...)
+ *  size_t len - length of arch, which need not be NUL-terminated
  * OUT:
  *  int - position in keywords, or -1 if not found
  */
 static int
-decode_arch(const char *arch)
+decode_arch(const char *arch, size_t len)
 {
 	char *q;
 	int a;
 	const char *p;
 
 	p = arch;
-	if (*p == '~' || *p == '-')
+	if (len > 0 && (*p == '~' || *p == '-')) {
 		p++;
+		len--;
+	}
 
 	array_for_each(archlist, a, q)
 	{
-		if (strcmp(q, p) == 0)
+		if (strncmp(q, p, len) == 0 && q[len] == '\0')
 			return a;
 	}
 
@@ -161,20 +166,19 @@ print_keywords(const char *category, const char *ebuild, int *keywords)
 }
 
 /*
- * Read the KEYWORDS string and decode the values
+ * Read the KEYWORDS string and decode the values, s is not modified
+ * since tree metadata is shared between packages
  *
  * IN:
- *  char *s - a keywords string (ex: "alpha ~amd64 -x86")
+ *  const char *s - a keywords string (ex: "alpha ~amd64 -x86")
  *  int *keywords - the output
  * ERR:
  *  int rc - -1 is returned on error (if !s || !keywords)
  */
 static int
-read_keywords(char *s, int *keywords)
+read_keywords(const char *s, int *keywords)
 {
-	char *arch;
-	char delim[2] = { ' ', '\0' };
-	char *savep;
+	const char *arch;
 	size_t slen;
 	size_t a;
 	size_t siz;
@@ -195,9 +199,14 @@ read_keywords(char *s, int *keywords)
 	if (!slen)
 		return 0;
 
-	while ((arch = strtok_r(s, delim, &savep)) != NULL) {
-		s = NULL;  /* for strtok_r */
-		i = decode_arch(arch);
+	while (*s != '\0') {
+		while (*s == ' ')
+			s++;
+		if (*s == '\0')
+			break;
+		for (arch = s; *s != '\0' && *s != ' '; s++)
+			;
+		i = decode_arch(arch, s - arch);
 		if (i == -1)
 			continue;
 		keywords[i] = decode_status(arch[0]);
@@ -240,26 +249,26 @@ qkeyword_kw(tree_pkg_ctx *pkg_ctx, void *priv, int what)
 {
 	qkeyword_data *data = (qkeyword_data *)priv;
 	depend_atom *atom;
-	array *masks;
 
 	if (data->keywordsbuf[qkeyword_test_arch] == what)
 	{
-		size_t n;
-		depend_atom *mask;
+		const depend_atom *mask;
+		const char *mfile;
 
 		atom = tree_pkg_atom(pkg_ctx, false);
-		masks = hash_get(pmasks, atom_format("%[CAT]%[PN]", atom));
-		if (masks != NULL) {
-			array_for_each(masks, n, mask) {
-				if (atom_compare(atom, mask) == EQUAL) {
-					if (verbose) {
-						printf("masked by %s: ", atom_to_string(mask));
-						printf("%s\n", atom_format(data->fmt,
-									tree_pkg_atom(pkg_ctx, true)));
-					}
-					return EXIT_FAILURE;
-				}
+		mfile = matcher_match(pmasks, atom, &mask);
+		if (mfile != NULL) {
+			if (verbose) {
+				/* drop the column range from file:line:cbeg-cend */
+				const char *p = strrchr(mfile, ':');
+				printf("masked by %s (%.*s): ",
+						atom_to_string((depend_atom *)mask),
+						p != NULL ? (int)(p - mfile) : (int)strlen(mfile),
+						mfile);
+				printf("%s\n", atom_format(data->fmt,
+							tree_pkg_atom(pkg_ctx, true)));
 			}
+			return EXIT_FAILURE;
 		}
 
 		printf("%s\n", atom_format(data->fmt, tree_pkg_atom(pkg_ctx, true)));
@@ -658,6 +667,7 @@ static int
 qkeyword_results_cb(tree_pkg_ctx *pkg_ctx, void *priv)
 {
 	int *keywords;
+	const char *kwds;
 	qkeyword_data *data = (qkeyword_data *)priv;
 	depend_atom *patom = NULL;
 	tree_metadata_xml *metadata;
@@ -692,11 +702,18 @@ qkeyword_results_cb(tree_pkg_ctx *pkg_ctx, void *priv)
 
 	keywords = data->keywordsbuf;
 
-	if (read_keywords(tree_pkg_meta(pkg_ctx, Q_KEYWORDS), keywords) < 0) {
-		if (verbose)
-			warn("Failed to read keywords for %s%s/%s%s%s",
-				BOLD, patom->CATEGORY, BLUE, patom->PF, NORM);
-		return EXIT_FAILURE;
+	/* metadata strings are interned, so equal KEYWORDS share the same
+	 * pointer and need not be decoded again */
+	kwds = tree_pkg_meta(pkg_ctx, Q_KEYWORDS);
+	if (kwds == NULL || kwds != data->lastkeywords) {
+		data->lastkeywords = NULL;
+		if (read_keywords(kwds, keywords) < 0) {
+			if (verbose)
+				warn("Failed to read keywords for %s%s/%s%s%s",
+					BOLD, patom->CATEGORY, BLUE, patom->PF, NORM);
+			return EXIT_FAILURE;
+		}
+		data->lastkeywords = kwds;
 	}
 
 	ret = data->runfunc(pkg_ctx, priv);
@@ -809,8 +826,9 @@ qkeyword_traverse(tree_pkg_cb func, void *priv)
 				archlist_count * sizeof(data->keywordsbuf[0]));
 		data->keywordsbuflen = archlist_count;
 	}
+	data->lastkeywords = NULL;
 
-	qkeyword_test_arch = decode_arch(data->arch);
+	qkeyword_test_arch = decode_arch(data->arch, strlen(data->arch));
 	if (qkeyword_test_arch == -1)
 		return EXIT_FAILURE;
 
@@ -819,9 +837,13 @@ qkeyword_traverse(tree_pkg_cb func, void *priv)
 	array_for_each(overlays, n, overlay) {
 		tree_ctx *t = tree_new(portroot, overlay, TREETYPE_EBUILD, false);
 		if (t != NULL) {
+			tree_set_parallel(t, true);
+			tree_set_keys(t, TREE_KEY(KEYWORDS));
 			ret |= tree_foreach_pkg_sorted(t,
 					qkeyword_results_cb, priv, data->qatom);
 			tree_close(t);
+			/* the cached pointer died with the tree */
+			data->lastkeywords = NULL;
 		}
 	}
 
@@ -903,35 +925,11 @@ int qkeyword_main(int argc, char **argv)
 	data.lastatom = NULL;
 	data.keywordsbuf = NULL;
 	data.keywordsbuflen = 0;
+	data.lastkeywords = NULL;
 	data.qmaint = maint;
 
 	/* prepare masks for easy(er) matching by key-ing on CAT/PN */
-	{
-		array *masks;
-		array *bucket;
-		array *ebuck;
-		size_t n;
-		char *mask;
-		depend_atom *atom;
-
-		pmasks = create_set();
-
-		masks = hash_keys(package_masks);
-		array_for_each(masks, n, mask) {
-			if ((atom = atom_explode(mask)) == NULL)
-				continue;
-			bucket = array_new();
-			array_append(bucket, atom);
-			pmasks = hash_add(pmasks, atom_format("%[CAT]%[PN]", atom),
-							  bucket, (void **)&ebuck);
-			if (ebuck != NULL) {
-				array_append(ebuck, atom);
-				array_free(bucket);
-			}
-		}
-
-		array_free(masks);
-	}
+	pmasks = matcher_add_hash(NULL, package_masks);
 
 	switch (action) {
 		case 'i': i = qkeyword_traverse(qkeyword_imlate, &data);        break;
@@ -953,6 +951,7 @@ int qkeyword_main(int argc, char **argv)
 	free(data.keywordsbuf);
 	array_free(archlist);
 	free_set(archs);
+	matcher_free(pmasks);
 	if (i == -2)
 		qkeyword_usage(EXIT_FAILURE);
 	return i;
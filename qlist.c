@@ -18,6 +18,7 @@
 
 #include "atom.h"
 #include "contents.h"
+#include "matcher.h"
 #include "tree.h"
 #include "xpak.h"
 #include "xregex.h"
@@ -122,16 +123,15 @@ umapstr(tree_pkg_ctx *pkg_ctx)
 	if (iuse == NULL || *iuse == '\0')
 		return;
 
-	/* strip out possible leading +/- flags in IUSE */
-	u = (int)strlen(iuse);
-	for (i = 0; i < u; i++)
-		if (iuse[i] == '+' || iuse[i] == '-')
-			if (i == 0 || iuse[i - 1] == ' ')
-				iuse[i] = ' ';
-
 	makeargv(use, &use_argc, &use_argv);
 	makeargv(iuse, &iuse_argc, &iuse_argv);
 
+	/* strip out possible leading +/- flags in IUSE, on our copy since
+	 * the metadata is shared */
+	for (i = 1; i < iuse_argc; i++)
+		if (iuse_argv[i][0] == '+' || iuse_argv[i][0] == '-')
+			memmove(iuse_argv[i], iuse_argv[i] + 1, strlen(iuse_argv[i]));
+
 	/* merge join, ensure inputs are sorted (Portage does this, but just
 	 * to be sure) */
 	qsort(&use_argv[1], use_argc - 1, sizeof(char *), cmpstringp);
@@ -162,6 +162,9 @@ umapstr(tree_pkg_ctx *pkg_ctx)
 	freeargv(use_argc, use_argv);
 }
 
+/* package_masks compiled for matching, on first use */
+static matcher_t *qlist_masks = NULL;
+
 /* forward declaration necessary for misuse from qmerge.c, see HACK there */
 bool
 qlist_match(
@@ -251,26 +254,9 @@ qlist_match(
 	}
 
 	if (applymasks) {
-		array *masks;
-		depend_atom *matom;
-		char *mask;
-		size_t n;
-		bool match = false;
-
-		masks = hash_keys(package_masks);
-
-		array_for_each(masks, n, mask) {
-			if ((matom = atom_explode(mask)) == NULL)
-				continue;
-			match = atom_compare(atom, matom) == EQUAL;
-			atom_implode(matom);
-			if (match)
-				break;
-		}
-
-		array_free(masks);
-
-		if (match)
+		if (qlist_masks == NULL)
+			qlist_masks = matcher_add_hash(NULL, package_masks);
+		if (matcher_match(qlist_masks, atom, NULL) != NULL)
 			return false;
 	}
 
@@ -524,6 +510,7 @@ int qlist_main(int argc, char **argv)
 		array_for_each(overlays, n, overlay) {
 			vdb = tree_new(portroot, overlay, TREETYPE_EBUILD, false);
 			if (vdb != NULL) {
+				tree_set_parallel(vdb, true);
 				ret |= tree_foreach_pkg_sorted(vdb, qlist_cb, &state, NULL);
 				tree_close(vdb);
 			}
@@ -534,6 +521,7 @@ int qlist_main(int argc, char **argv)
 		else
 			vdb = tree_new(portroot, portvdb, TREETYPE_VDB, false);
 		if (vdb != NULL) {
+			tree_set_parallel(vdb, true);
 			ret = tree_foreach_pkg_sorted(vdb, qlist_cb, &state, NULL);
 			tree_close(vdb);
 		}
@@ -543,6 +531,8 @@ int qlist_main(int argc, char **argv)
 		if (state.atoms[i - optind])
 			atom_implode(state.atoms[i - optind]);
 	free(state.atoms);
+	matcher_free(qlist_masks);
+	qlist_masks = NULL;
 
 	/* The return value is whether we matched anything. */
 	return ret ? EXIT_SUCCESS : EXIT_FAILURE;
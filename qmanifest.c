@@ -32,17 +32,31 @@
 #include <xalloc.h>
 #include <zlib.h>
 #include <gpgme.h>
+#ifdef _OPENMP
+# include <omp.h>
+#endif
+#ifdef ENABLE_GTREE
+# include <archive.h>
+# include <archive_entry.h>
+#endif
 
+#include "arena.h"
+#include "atom.h"
 #include "eat_file.h"
 #include "hash.h"
+#include "scandirat.h"
+#include "set.h"
 
-#define QMANIFEST_FLAGS "gs:pdo" COMMON_FLAGS
+#define QMANIFEST_FLAGS "gs:pdofcj:" COMMON_FLAGS
 static struct option const qmanifest_long_opts[] = {
 	{"generate",   no_argument, NULL, 'g'},
 	{"signas",      a_argument, NULL, 's'},
 	{"passphrase", no_argument, NULL, 'p'},
 	{"dir",        no_argument, NULL, 'd'},
 	{"overlay",    no_argument, NULL, 'o'},
+	{"force",      no_argument, NULL, 'f'},
+	{"caches",     no_argument, NULL, 'c'},
+	{"jobs",        a_argument, NULL, 'j'},
 	COMMON_LONG_OPTS
 };
 static const char * const qmanifest_opts_help[] = {
@@ -51,6 +65,9 @@ static const char * const qmanifest_opts_help[] = {
 	"Ask for GPG key password (instead of relying on gpg-agent)",
 	"Treat arguments as directories",
 	"Treat arguments as overlay names",
+	"Rehash all files, ignoring hashes from existing Manifests",
+	"Check gtree-2 cache entries, reading the repository data twice",
+	"Number of threads to verify with (default: all CPUs)",
 	COMMON_OPTS_HELP
 };
 #define qmanifest_usage(ret) usage(ret, QMANIFEST_FLAGS, qmanifest_long_opts, qmanifest_opts_help, NULL, lookup_applet_idx("qmanifest"))
@@ -58,6 +75,9 @@ static const char * const qmanifest_opts_help[] = {
 static int hashes = HASH_DEFAULT;
 static char *gpg_sign_key = NULL;
 static bool gpg_get_password = false;
+static bool force_rehash = false;
+static bool gtree_caches = false;
+static int verify_jobs = 0;
 
 /* linked list structure to hold verification complaints */
 typedef struct verify_msg {
@@ -92,6 +112,7 @@ update_times(struct timeval *tv, struct stat *s)
 #if defined (__MACH__) && defined __APPLE__
 # define st_mtim st_mtimespec
 # define st_atim st_atimespec
+# define st_ctim st_ctimespec
 #endif
 	if (tv[1].tv_sec < s->st_mtim.tv_sec ||
 			(tv[1].tv_sec == s->st_mtim.tv_sec &&
@@ -106,130 +127,355 @@ update_times(struct timeval *tv, struct stat *s)
 
 #define LISTSZ 64
 
-/**
- * qsort comparator which runs strcmp.
- */
-static int
-compare_strings(const void *l, const void *r)
-{
-	const char **strl = (const char **)l;
-	const char **strr = (const char **)r;
-	return strcmp(*strl, *strr);
-}
+/* the arenas used for a single dir or Manifest, most of these hold a
+ * few KiB, larger allocations get a block of their own anyway, and
+ * larger blocks only trigger the allocator to give back and fetch
+ * memory from the system for each dir */
+#define ARENA_BLKSIZE (4 * 1024)
 
 /**
  * Return a sorted list of entries in the given directory.  All entries
  * starting with a dot are ignored, and not present in the returned
- * list.  The list and all entries are allocated using xmalloc() and need
- * to be freed.
+ * list.  The list and all entries are allocated from arena a, and are
+ * released with it.
  * This function returns 0 when everything is fine, non-zero otherwise.
  */
 static char
-list_dir(char ***retlist, size_t *retcnt, const char *path)
+list_dir(arena_t *a, char ***retlist, size_t *retcnt, const char *path)
 {
-	DIR *d;
-	struct dirent *e;
-	size_t rlen = 0;
-	size_t rsize = 0;
-	char **rlist = NULL;
-
-	if ((d = opendir(path)) != NULL) {
-		while ((e = readdir(d)) != NULL) {
-			/* skip all dotfiles */
-			if (e->d_name[0] == '.')
-				continue;
+	int cnt = scandirat_names(a, AT_FDCWD, path, false, true, retlist);
 
-			if (rlen == rsize) {
-				rsize += LISTSZ;
-				rlist = xrealloc(rlist,
-						rsize * sizeof(rlist[0]));
-				if (rlist == NULL) {
-					fprintf(stderr, "out of memory\n");
-					return 1;
-				}
-			}
-			rlist[rlen] = xstrdup(e->d_name);
-			if (rlist[rlen] == NULL) {
-				fprintf(stderr, "out of memory\n");
-				return 1;
+	if (cnt < 0)
+		return 1;
+	*retcnt = (size_t)cnt;
+	return 0;
+}
+
+/**
+ * Read the (compressed) Manifest at path in its entirety into a buffer
+ * allocated from arena a, such that its lines can be used in place.
+ * The buffer is NUL-terminated, its length is returned in retlen.
+ * Returns NULL when the file cannot be read, errno is set then.
+ */
+static char *
+manifest_read(arena_t *a, const char *path, size_t *retlen)
+{
+	unsigned char hdr[4];
+	struct stat s;
+	gzFile mf = NULL;
+	size_t len = 0;
+	size_t size;
+	char *buf;
+	char *nbuf;
+	ssize_t rd;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1)
+		return NULL;
+	if (fstat(fd, &s) != 0) {
+		close(fd);
+		return NULL;
+	}
+	size = (size_t)s.st_size;
+
+	/* gzip records the uncompressed size (modulo 4GiB) in its last four
+	 * bytes, use it to size the buffer, plain files are read as is */
+	if (s.st_size >= 18 &&
+			pread(fd, hdr, 2, 0) == 2 &&
+			hdr[0] == 0x1f && hdr[1] == 0x8b)
+	{
+		if (pread(fd, hdr, 4, s.st_size - 4) == 4)
+			size = (size_t)hdr[0] | (size_t)hdr[1] << 8 |
+				(size_t)hdr[2] << 16 | (size_t)hdr[3] << 24;
+		if ((mf = gzdopen(fd, "rb")) == NULL) {
+			close(fd);
+			return NULL;
+		}
+	}
+
+	/* room for the terminator, and for a read that hits the end */
+	size += 2;
+	buf = arena_alloc(a, size);
+	do {
+		if (size - len < 2) {
+			/* the size was off, multi-member gzip or the file grew */
+			nbuf = arena_alloc(a, size * 2);
+			memcpy(nbuf, buf, len);
+			buf = nbuf;
+			size *= 2;
+		}
+		if (mf != NULL)
+			rd = gzread(mf, buf + len, (unsigned int)(size - len - 1));
+		else
+			rd = read(fd, buf + len, size - len - 1);
+		if (rd > 0)
+			len += rd;
+	} while (rd > 0 || (rd < 0 && mf == NULL && errno == EINTR));
+
+	if (mf != NULL)
+		gzclose(mf);
+	else
+		close(fd);
+	if (rd < 0) {
+		errno = EIO;
+		return NULL;
+	}
+
+	buf[len] = '\0';
+	*retlen = len;
+	return buf;
+}
+
+/* entries of the Manifest that is being replaced, files whose status
+ * didn't change after it was written, and still have the size it
+ * records, need not be hashed again */
+struct manifest_prev {
+	hash_t *ents;          /* "TYPE name" -> "size HASH value ..." */
+	arena_t *arena;        /* the file read, ents point into it */
+	struct timespec ctime; /* when the Manifest was written */
+};
+
+/* the hashes written for each entry */
+#define MANIFEST_HASHES  (HASH_BLAKE2B | HASH_SHA256 | HASH_SHA512)
+
+/**
+ * Load the entries from the (compressed) Manifest at path into mp,
+ * such that their hashes can be reused.  Only entries with exactly the
+ * set of hashes that will be written are retained, and MANIFEST
+ * entries are never retained, for they are cheap to hash and their
+ * mtime isn't updated when entries are merely removed from them.
+ */
+static void
+manifest_prev_load(struct manifest_prev *mp, const char *path)
+{
+	struct stat s;
+	size_t len;
+	char *buf;
+	char *p;
+	char *q;
+	char *nl;
+	char *val;
+	int mask;
+
+	memset(mp, 0, sizeof(*mp));
+	if (force_rehash || stat(path, &s) != 0)
+		return;
+	mp->arena = arena_new(ARENA_BLKSIZE);
+	if ((buf = manifest_read(mp->arena, path, &len)) == NULL || len == 0) {
+		arena_free(mp->arena);
+		mp->arena = NULL;
+		return;
+	}
+
+	mp->ctime = s.st_ctim;
+	mp->ents = hash_new();
+
+	/* TYPE name size HASH value ... */
+	for (p = buf; *p != '\0'; p = nl) {
+		if ((nl = strchr(p, '\n')) != NULL)
+			*nl++ = '\0';
+		else
+			nl = p + strlen(p);
+
+		if (strncmp(p, "MANIFEST ", 9) == 0 ||
+				(q = strchr(p, ' ')) == NULL ||
+				(q = strchr(q + 1, ' ')) == NULL)
+			continue;
+		*q++ = '\0';
+		val = q;
+
+		/* skip size, then compute the set of hashes present */
+		mask = 0;
+		q = strchr(val, ' ');
+		while (q != NULL) {
+			q++;
+			if (strncmp(q, "BLAKE2B ", 8) == 0) {
+				mask |= HASH_BLAKE2B;
+			} else if (strncmp(q, "SHA256 ", 7) == 0) {
+				mask |= HASH_SHA256;
+			} else if (strncmp(q, "SHA512 ", 7) == 0) {
+				mask |= HASH_SHA512;
+			} else {
+				mask = -1;
+				break;
 			}
-			rlen++;
+			/* skip over the value */
+			if ((q = strchr(q, ' ')) != NULL)
+				q = strchr(q + 1, ' ');
 		}
-		closedir(d);
+		if (mask != (hashes & MANIFEST_HASHES))
+			continue;
 
-		if (rlen > 1)
-			qsort(rlist, rlen, sizeof(rlist[0]), compare_strings);
+		mp->ents = hash_add(mp->ents, p, val, NULL);
+	}
+}
 
-		*retlist = rlist;
-		*retcnt = rlen;
-		return 0;
-	} else {
-		return 1;
+static void
+manifest_prev_free(struct manifest_prev *mp)
+{
+	hash_free(mp->ents);
+	arena_free(mp->arena);
+	memset(mp, 0, sizeof(*mp));
+}
+
+/* Manifest being written to, the entries are hashed in batches, and
+ * written out in the order they were added when flushed */
+struct manifest_out {
+	struct timeval *tv;
+	FILE *m;
+	gzFile gm;
+	hash_batch *batch;
+	struct manifest_prev *prev;
+	arena_t *arena;        /* dir listings and queued entries */
+};
+
+/* per entry data, the name written is the tail of the path hashed,
+ * when prevval is set, it is written instead of the computed hashes */
+struct manifest_ent {
+	const char *type;
+	size_t nameoff;
+	const char *prevval;
+};
+
+static void
+manifest_out_init(
+		struct manifest_out *mo,
+		struct timeval *tv,
+		FILE *m,
+		gzFile gm,
+		struct manifest_prev *prev)
+{
+	mo->tv = tv;
+	mo->m = m;
+	mo->gm = gm;
+	mo->batch = hash_batch_new(0, HASH_BATCH_READAHEAD);
+	mo->prev = prev;
+	mo->arena = arena_new(ARENA_BLKSIZE);
+}
+
+static void
+write_hashes_cb(hash_result *r, void *priv)
+{
+	struct manifest_out *mo = priv;
+	struct manifest_ent *me = r->priv;
+	const char *name = r->fname + me->nameoff;
+	char data[8192];
+	size_t len;
+
+	/* files we cannot read are not listed, as before when they could
+	 * not be stat-ed */
+	if (r->err == 0) {
+		update_times(mo->tv, &r->st);
+
+		if (me->prevval != NULL) {
+			/* unchanged since the previous Manifest */
+			len = snprintf(data, sizeof(data), "%s %s %s\n",
+					me->type, name, me->prevval);
+		} else {
+			len = snprintf(data, sizeof(data), "%s %s %zd",
+					me->type, name, r->flen);
+			if (hashes & HASH_BLAKE2B)
+				len += snprintf(data + len, sizeof(data) - len,
+						" BLAKE2B %s", r->blak2b);
+			if (hashes & HASH_SHA256)
+				len += snprintf(data + len, sizeof(data) - len,
+						" SHA256 %s", r->sha256);
+			if (hashes & HASH_SHA512)
+				len += snprintf(data + len, sizeof(data) - len,
+						" SHA512 %s", r->sha512);
+			len += snprintf(data + len, sizeof(data) - len, "\n");
+		}
+
+		if (mo->m != NULL)
+			fwrite(data, len, 1, mo->m);
+		if (mo->gm != NULL && gzwrite(mo->gm, data, len) == 0)
+			fprintf(stderr, "failed to write to compressed stream\n");
 	}
 }
 
 /**
- * Write hashes in Manifest format to the file open for writing m, or
- * gzipped file open for writing gm.  The hashes written are for a file
- * in root found by name.  The Manifest entry will be using type as
- * first component.
+ * Write hashes in Manifest format to the output mo, for all entries
+ * queued using write_hashes.  This must be called before the output is
+ * closed, or anything else is written to it.
+ */
+static void
+write_hashes_flush(struct manifest_out *mo)
+{
+	hash_batch_run(mo->batch, write_hashes_cb, mo);
+}
+
+static void
+manifest_out_done(struct manifest_out *mo)
+{
+	write_hashes_flush(mo);
+	hash_batch_free(mo->batch);
+	mo->batch = NULL;
+	arena_free(mo->arena);
+	mo->arena = NULL;
+}
+
+/**
+ * Queue writing hashes in Manifest format to the output mo.  The hashes
+ * written are for a file in root found by name.  The Manifest entry
+ * will be using type as first component.  The entry is written by
+ * write_hashes_flush.
  */
 static void
 write_hashes(
-		struct timeval *tv,
+		struct manifest_out *mo,
 		const char *root,
 		const char *name,
-		const char *type,
-		FILE *m,
-		gzFile gm)
+		const char *type)
 {
-	size_t flen = 0;
-	char sha256[SHA256_DIGEST_LENGTH + 1];
-	char sha512[SHA512_DIGEST_LENGTH + 1];
-	char blak2b[BLAKE2B_DIGEST_LENGTH + 1];
-	char data[8192];
 	char fname[8192];
-	size_t len;
+	struct manifest_ent *me;
+	struct manifest_prev *mp = mo->prev;
 	struct stat s;
+	const char *val;
 
 	snprintf(fname, sizeof(fname), "%s/%s", root, name);
 
-	if (stat(fname, &s) != 0)
-		return;
+	me = arena_alloc(mo->arena, sizeof(*me));
+	me->type = type;
+	me->nameoff = strlen(root) + 1;
+	me->prevval = NULL;
+
+	/* reuse the previous entry when the file is the same size, and its
+	 * status last changed before the previous Manifest was written, the
+	 * mtime is no use here, it is set on the Manifest to that of its
+	 * most recent entry, and cp -p, rsync -t and friends preserve it
+	 * for the files, while ctime cannot be set back */
+	if (mp != NULL && mp->ents != NULL) {
+		char key[8192];
+
+		snprintf(key, sizeof(key), "%s %s", type, name);
+		val = hash_get(mp->ents, key);
+		if (val != NULL &&
+				stat(fname, &s) == 0 &&
+				S_ISREG(s.st_mode) &&
+				strtoll(val, NULL, 10) == (long long)s.st_size &&
+				(s.st_ctim.tv_sec < mp->ctime.tv_sec ||
+				 (s.st_ctim.tv_sec == mp->ctime.tv_sec &&
+				  s.st_ctim.tv_nsec < mp->ctime.tv_nsec)))
+			me->prevval = val;
+	}
 
-	update_times(tv, &s);
-
-	hash_compute_file(fname, sha256, sha512, blak2b, &flen, hashes);
-
-	len = snprintf(data, sizeof(data), "%s %s %zd", type, name, flen);
-	if (hashes & HASH_BLAKE2B)
-		len += snprintf(data + len, sizeof(data) - len,
-				" BLAKE2B %s", blak2b);
-	if (hashes & HASH_SHA256)
-		len += snprintf(data + len, sizeof(data) - len,
-				" SHA256 %s", sha256);
-	if (hashes & HASH_SHA512)
-		len += snprintf(data + len, sizeof(data) - len,
-				" SHA512 %s", sha512);
-	len += snprintf(data + len, sizeof(data) - len, "\n");
-
-	if (m != NULL)
-		fwrite(data, len, 1, m);
-	if (gm != NULL && gzwrite(gm, data, len) == 0)
-		fprintf(stderr, "failed to write to compressed stream\n");
+	/* stat only the entries that are reused, to keep their order, and
+	 * keep track of their mtimes */
+	hash_batch_add(mo->batch, AT_FDCWD, fname,
+			me->prevval != NULL ? 0 : hashes, me);
 }
 
 /**
  * Walk through a directory recursively and write hashes for each file
- * found to the gzipped open stream for writing zm.  The Manifest
- * entries generated will all be of DATA type.
+ * found to the gzipped output mo.  The Manifest entries generated will
+ * all be of DATA type.
  */
 static char
 write_hashes_dir(
-		struct timeval *tv,
+		struct manifest_out *mo,
 		const char *root,
-		const char *name,
-		gzFile zm)
+		const char *name)
 {
 	char path[8192];
 	char **dentries;
@@ -237,16 +483,14 @@ write_hashes_dir(
 	size_t i;
 
 	snprintf(path, sizeof(path), "%s/%s", root, name);
-	if (list_dir(&dentries, &dentrieslen, path) == 0) {
+	if (list_dir(mo->arena, &dentries, &dentrieslen, path) == 0) {
 		for (i = 0; i < dentrieslen; i++) {
 			snprintf(path, sizeof(path), "%s/%s", name, dentries[i]);
-			free(dentries[i]);
-			if (write_hashes_dir(tv, root, path, zm) == 0)
+			if (write_hashes_dir(mo, root, path) == 0)
 				continue;
 			/* regular file */
-			write_hashes(tv, root, path, "DATA", NULL, zm);
+			write_hashes(mo, root, path, "DATA");
 		}
-		free(dentries);
 		return 0;
 	} else {
 		return 1;
@@ -255,11 +499,11 @@ write_hashes_dir(
 
 /**
  * Walk through directory recursively and write hashes for each file
- * found to the open stream for writing m.  All files will not use the
- * "files/" prefix and Manifest entries will be of AUX type.
+ * found to the output mo.  All files will not use the "files/" prefix
+ * and Manifest entries will be of AUX type.
  */
 static char
-process_files(struct timeval *tv, const char *dir, const char *off, FILE *m)
+process_files(struct manifest_out *mo, const char *dir, const char *off)
 {
 	char path[8192];
 	char **dentries;
@@ -267,17 +511,15 @@ process_files(struct timeval *tv, const char *dir, const char *off, FILE *m)
 	size_t i;
 
 	snprintf(path, sizeof(path), "%s/%s", dir, off);
-	if (list_dir(&dentries, &dentrieslen, path) == 0) {
+	if (list_dir(mo->arena, &dentries, &dentrieslen, path) == 0) {
 		for (i = 0; i < dentrieslen; i++) {
 			snprintf(path, sizeof(path), "%s%s%s",
 					off, *off == '\0' ? "" : "/", dentries[i]);
-			free(dentries[i]);
-			if (process_files(tv, dir, path, m) == 0)
+			if (process_files(mo, dir, path) == 0)
 				continue;
 			/* regular file */
-			write_hashes(tv, dir, path, "AUX", m, NULL);
+			write_hashes(mo, dir, path, "AUX");
 		}
-		free(dentries);
 		return 0;
 	} else {
 		return 1;
@@ -387,6 +629,8 @@ generate_dir(const char *dir, enum type_manifest mtype)
 	char path[8192];
 	struct stat s;
 	struct timeval tv[2];
+	struct manifest_out mo;
+	struct manifest_prev mp;
 	char **dentries;
 	size_t dentrieslen;
 	size_t i;
@@ -411,9 +655,11 @@ generate_dir(const char *dir, enum type_manifest mtype)
 		time_t rtime;
 
 		snprintf(path, sizeof(path), "%s/%s", dir, str_manifest_files_gz);
+		manifest_prev_load(&mp, path);
 		if ((mf = gzopen(path, "wb9")) == NULL) {
 			fprintf(stderr, "failed to open file '%s' for writing: %s\n",
 					path, strerror(errno));
+			manifest_prev_free(&mp);
 			return NULL;
 		}
 
@@ -429,11 +675,15 @@ generate_dir(const char *dir, enum type_manifest mtype)
 			fprintf(stderr, "failed to write to file '%s/%s': %s\n",
 					dir, str_manifest_files_gz, strerror(errno));
 			gzclose(mf);
+			manifest_prev_free(&mp);
 			return NULL;
 		}
 
-		if (list_dir(&dentries, &dentrieslen, dir) != 0) {
+		manifest_out_init(&mo, tv, NULL, mf, &mp);
+		if (list_dir(mo.arena, &dentries, &dentrieslen, dir) != 0) {
+			manifest_out_done(&mo);
 			gzclose(mf);
+			manifest_prev_free(&mp);
 			return NULL;
 		}
 
@@ -441,10 +691,7 @@ generate_dir(const char *dir, enum type_manifest mtype)
 			/* ignore existing Manifests */
 			if (strcmp(dentries[i], str_manifest_files_gz) == 0 ||
 					strcmp(dentries[i], str_manifest) == 0)
-			{
-				free(dentries[i]);
 				continue;
-			}
 
 			snprintf(path, sizeof(path), "%s/%s", dir, dentries[i]);
 
@@ -467,27 +714,26 @@ generate_dir(const char *dir, enum type_manifest mtype)
 					if (mfest == NULL) {
 						fprintf(stderr, "generating Manifest for %s failed!\n",
 								path);
+						manifest_out_done(&mo);
+						manifest_prev_free(&mp);
 						gzclose(mf);
-						for (; i < dentrieslen; i++)
-							free(dentries[i]);
-						free(dentries);
 						return NULL;
 					}
 
 					snprintf(path, sizeof(path), "%s/%s",
 							dentries[i], mfest);
-					write_hashes(tv, dir, path, "MANIFEST", NULL, mf);
+					write_hashes(&mo, dir, path, "MANIFEST");
 				} else if (s.st_mode & S_IFREG) {
-					write_hashes(tv, dir, dentries[i], "DATA", NULL, mf);
+					write_hashes(&mo, dir, dentries[i], "DATA");
 				} /* ignore other "things" (like symlinks) as they
 					 don't belong in a tree */
 			} else {
 				fprintf(stderr, "stat(%s) failed: %s\n",
 						path, strerror(errno));
 			}
-			free(dentries[i]);
 		}
-		free(dentries);
+		manifest_out_done(&mo);
+		manifest_prev_free(&mp);
 		gzclose(mf);
 
 		if (tv[0].tv_sec != 0) {
@@ -503,7 +749,9 @@ generate_dir(const char *dir, enum type_manifest mtype)
 			return NULL;
 		}
 
-		write_hashes(tv, dir, str_manifest_files_gz, "MANIFEST", f, NULL);
+		manifest_out_init(&mo, tv, f, NULL, NULL);
+		write_hashes(&mo, dir, str_manifest_files_gz, "MANIFEST");
+		manifest_out_done(&mo);
 		time(&rtime);
 		len = strftime(path, sizeof(path),
 				"TIMESTAMP %Y-%m-%dT%H:%M:%SZ\n", gmtime(&rtime));
@@ -519,9 +767,11 @@ generate_dir(const char *dir, enum type_manifest mtype)
 		gzFile mf;
 
 		snprintf(path, sizeof(path), "%s/%s", dir, str_manifest_gz);
+		manifest_prev_load(&mp, path);
 		if ((mf = gzopen(path, "wb9")) == NULL) {
 			fprintf(stderr, "failed to open file '%s' for writing: %s\n",
 					path, strerror(errno));
+			manifest_prev_free(&mp);
 			return NULL;
 		}
 
@@ -539,28 +789,30 @@ generate_dir(const char *dir, enum type_manifest mtype)
 				fprintf(stderr, "failed to write to file '%s/%s': %s\n",
 						dir, str_manifest_gz, strerror(errno));
 				gzclose(mf);
+				manifest_prev_free(&mp);
 				return NULL;
 			}
 		}
 
-		if (list_dir(&dentries, &dentrieslen, dir) != 0) {
+		manifest_out_init(&mo, tv, NULL, mf, &mp);
+		if (list_dir(mo.arena, &dentries, &dentrieslen, dir) != 0) {
+			manifest_out_done(&mo);
 			gzclose(mf);
+			manifest_prev_free(&mp);
 			return NULL;
 		}
 
 		for (i = 0; i < dentrieslen; i++) {
 			/* ignore existing Manifests */
-			if (strcmp(dentries[i], str_manifest_gz) == 0) {
-				free(dentries[i]);
+			if (strcmp(dentries[i], str_manifest_gz) == 0)
 				continue;
-			}
 
-			if (write_hashes_dir(tv, dir, dentries[i], mf) != 0)
-				write_hashes(tv, dir, dentries[i], "DATA", NULL, mf);
-			free(dentries[i]);
+			if (write_hashes_dir(&mo, dir, dentries[i]) != 0)
+				write_hashes(&mo, dir, dentries[i], "DATA");
 		}
 
-		free(dentries);
+		manifest_out_done(&mo);
+		manifest_prev_free(&mp);
 		gzclose(mf);
 
 		if (tv[0].tv_sec != 0) {
@@ -577,23 +829,26 @@ generate_dir(const char *dir, enum type_manifest mtype)
 		const char *ret = str_manifest_gz;
 
 		snprintf(path, sizeof(path), "%s/%s", dir, str_manifest_gz);
+		manifest_prev_load(&mp, path);
 		if ((mf = gzopen(path, "wb9")) == NULL) {
 			fprintf(stderr, "failed to open file '%s' for writing: %s\n",
 					path, strerror(errno));
+			manifest_prev_free(&mp);
 			return NULL;
 		}
 
-		if (list_dir(&dentries, &dentrieslen, dir) != 0) {
+		manifest_out_init(&mo, tv, NULL, mf, &mp);
+		if (list_dir(mo.arena, &dentries, &dentrieslen, dir) != 0) {
+			manifest_out_done(&mo);
 			gzclose(mf);
+			manifest_prev_free(&mp);
 			return NULL;
 		}
 
 		for (i = 0; i < dentrieslen; i++) {
 			/* ignore existing Manifests */
-			if (strcmp(dentries[i], str_manifest_gz) == 0) {
-				free(dentries[i]);
+			if (strcmp(dentries[i], str_manifest_gz) == 0)
 				continue;
-			}
 
 			snprintf(path, sizeof(path), "%s/%s", dir, dentries[i]);
 			if (!stat(path, &s)) {
@@ -608,20 +863,20 @@ generate_dir(const char *dir, enum type_manifest mtype)
 					} else {
 						snprintf(path, sizeof(path), "%s/%s",
 								dentries[i], mfest);
-						write_hashes(tv, dir, path, "MANIFEST", NULL, mf);
+						write_hashes(&mo, dir, path, "MANIFEST");
 					}
 				} else if (s.st_mode & S_IFREG) {
-					write_hashes(tv, dir, dentries[i], "DATA", NULL, mf);
+					write_hashes(&mo, dir, dentries[i], "DATA");
 				} /* ignore other "things" (like symlinks) as they
 					 don't belong in a tree */
 			} else {
 				fprintf(stderr, "stat(%s) failed: %s\n",
 						path, strerror(errno));
 			}
-			free(dentries[i]);
 		}
 
-		free(dentries);
+		manifest_out_done(&mo);
+		manifest_prev_free(&mp);
 		gzclose(mf);
 
 		if (tv[0].tv_sec != 0) {
@@ -646,8 +901,12 @@ generate_dir(const char *dir, enum type_manifest mtype)
 		/* we know the Manifest is sorted, and stuff in files/ is
 		 * prefixed with AUX, hence, if it exists, we need to do it
 		 * first */
+		snprintf(path, sizeof(path), "%s/%s", dir, str_manifest);
+		manifest_prev_load(&mp, path);
+		manifest_out_init(&mo, tv, m, NULL, &mp);
 		snprintf(path, sizeof(path), "%s/files", dir);
-		process_files(tv, path, "", m);
+		process_files(&mo, path, "");
+		write_hashes_flush(&mo);
 
 		/* the Manifest file may be missing in case there are no DIST
 		 * entries to be stored */
@@ -666,28 +925,28 @@ generate_dir(const char *dir, enum type_manifest mtype)
 								dir, strerror(errno));
 						fclose(f);
 						fclose(m);
+						hash_batch_free(mo.batch);
+						arena_free(mo.arena);
+						manifest_prev_free(&mp);
 						return NULL;
 					}
 			}
 			fclose(f);
 		}
 
-		if (list_dir(&dentries, &dentrieslen, dir) == 0) {
+		if (list_dir(mo.arena, &dentries, &dentrieslen, dir) == 0) {
 			for (i = 0; i < dentrieslen; i++) {
 				if (strcmp(dentries[i] + strlen(dentries[i]) - 7,
 							".ebuild") != 0)
-				{
-					free(dentries[i]);
 					continue;
-				}
-				write_hashes(tv, dir, dentries[i], "EBUILD", m, NULL);
-				free(dentries[i]);
+				write_hashes(&mo, dir, dentries[i], "EBUILD");
 			}
-			free(dentries);
 		}
 
-		write_hashes(tv, dir, "ChangeLog", "MISC", m, NULL);
-		write_hashes(tv, dir, "metadata.xml", "MISC", m, NULL);
+		write_hashes(&mo, dir, "ChangeLog", "MISC");
+		write_hashes(&mo, dir, "metadata.xml", "MISC");
+		manifest_out_done(&mo);
+		manifest_prev_free(&mp);
 
 		fflush(m);
 		fclose(m);
@@ -882,65 +1141,23 @@ msgs_add(
 	*msgs = msg;
 }
 
-gpg_sig *
-verify_gpg_sig(const char *path, verify_msg **msgs)
+/* interprets the outcome of the verify operation done on g_ctx, and
+ * returns the first signature found, or NULL when it isn't valid */
+static gpg_sig *
+verify_gpg_result(gpgme_ctx_t g_ctx, const char *path, verify_msg **msgs)
 {
-	gpgme_ctx_t g_ctx;
-	gpgme_data_t manifest;
-	gpgme_data_t out;
 	gpgme_verify_result_t vres;
 	gpgme_signature_t sig;
 	gpgme_key_t key;
 	char buf[64];
-	FILE *f;
 	struct tm *ctime;
 	gpg_sig *ret = NULL;
 
-	if (gpgme_new(&g_ctx) != GPG_ERR_NO_ERROR) {
-		msgs_add(msgs, path, NULL, "failed to create gpgme context");
-		return NULL;
-	}
-
-	if (gpgme_data_new(&out) != GPG_ERR_NO_ERROR) {
-		msgs_add(msgs, path, NULL, "failed to create gpgme data");
-		gpgme_release(g_ctx);
-		return NULL;
-	}
-
-	if ((f = fopen(path, "r")) == NULL) {
-		msgs_add(msgs, path, NULL, "failed to open: %s", strerror(errno));
-		gpgme_data_release(out);
-		gpgme_release(g_ctx);
-		return NULL;
-	}
-
-	if (gpgme_data_new_from_stream(&manifest, f) != GPG_ERR_NO_ERROR) {
-		msgs_add(msgs, path, NULL,
-				"failed to create new gpgme data from stream");
-		gpgme_data_release(out);
-		gpgme_release(g_ctx);
-		fclose(f);
-		return NULL;
-	}
-
-	if (gpgme_op_verify(g_ctx, manifest, NULL, out) != GPG_ERR_NO_ERROR) {
-		msgs_add(msgs, path, NULL, "failed to verify signature");
-		gpgme_data_release(out);
-		gpgme_data_release(manifest);
-		gpgme_release(g_ctx);
-		fclose(f);
-		return NULL;
-	}
-
 	vres = gpgme_op_verify_result(g_ctx);
-	fclose(f);
 
 	if (vres == NULL || vres->signatures == NULL) {
 		msgs_add(msgs, path, NULL,
 				"verification failed due to a missing gpg keyring");
-		gpgme_data_release(out);
-		gpgme_data_release(manifest);
-		gpgme_release(g_ctx);
 		return NULL;
 	}
 
@@ -1030,6 +1247,57 @@ verify_gpg_sig(const char *path, verify_msg **msgs)
 		}
 	}
 
+	return ret;
+}
+
+gpg_sig *
+verify_gpg_sig(const char *path, verify_msg **msgs)
+{
+	gpgme_ctx_t g_ctx;
+	gpgme_data_t manifest;
+	gpgme_data_t out;
+	FILE *f;
+	gpg_sig *ret;
+
+	if (gpgme_new(&g_ctx) != GPG_ERR_NO_ERROR) {
+		msgs_add(msgs, path, NULL, "failed to create gpgme context");
+		return NULL;
+	}
+
+	if (gpgme_data_new(&out) != GPG_ERR_NO_ERROR) {
+		msgs_add(msgs, path, NULL, "failed to create gpgme data");
+		gpgme_release(g_ctx);
+		return NULL;
+	}
+
+	if ((f = fopen(path, "r")) == NULL) {
+		msgs_add(msgs, path, NULL, "failed to open: %s", strerror(errno));
+		gpgme_data_release(out);
+		gpgme_release(g_ctx);
+		return NULL;
+	}
+
+	if (gpgme_data_new_from_stream(&manifest, f) != GPG_ERR_NO_ERROR) {
+		msgs_add(msgs, path, NULL,
+				"failed to create new gpgme data from stream");
+		gpgme_data_release(out);
+		gpgme_release(g_ctx);
+		fclose(f);
+		return NULL;
+	}
+
+	if (gpgme_op_verify(g_ctx, manifest, NULL, out) != GPG_ERR_NO_ERROR) {
+		msgs_add(msgs, path, NULL, "failed to verify signature");
+		gpgme_data_release(out);
+		gpgme_data_release(manifest);
+		gpgme_release(g_ctx);
+		fclose(f);
+		return NULL;
+	}
+
+	fclose(f);
+	ret = verify_gpg_result(g_ctx, path, msgs);
+
 	gpgme_data_release(out);
 	gpgme_data_release(manifest);
 	gpgme_release(g_ctx);
@@ -1042,21 +1310,32 @@ static size_t checked_files = 0;
 static size_t failed_files = 0;
 static char strict = 0;
 
+/* Manifest entry queued for verification by verify_file_add */
+struct verify_ent {
+	const char *mfest;
+	char *path;
+	long long int fsize;
+	char *hashlist;
+	verify_msg **msgs;
+};
+
+/* parses mfline and queues the file it refers to for hashing in batch,
+ * the result is checked by verify_file_cb, which retains mfline, ve is
+ * filled in and must stay around until the batch has run */
 static char
-verify_file(const char *dir, char *mfline, const char *mfest, verify_msg **msgs)
+verify_file_add(
+		hash_batch *batch,
+		struct verify_ent *ve,
+		const char *dir,
+		char *mfline,
+		const char *mfest,
+		verify_msg **msgs)
 {
 	char *path;
 	char *size;
 	long long int fsize;
-	char *hashtype;
-	char *hash;
 	char *p;
 	char buf[8192];
-	size_t flen = 0;
-	char sha256[SHA256_DIGEST_LENGTH + 1];
-	char sha512[SHA512_DIGEST_LENGTH + 1];
-	char blak2b[BLAKE2B_DIGEST_LENGTH + 1];
-	char ret = 0;
 
 	/* mfline is a Manifest file line with type and leading path
 	 * stripped, something like:
@@ -1085,15 +1364,52 @@ verify_file(const char *dir, char *mfline, const char *mfest, verify_msg **msgs)
 		return 1;
 	}
 
-	sha256[0] = sha512[0] = blak2b[0] = '\0';
+	ve->mfest = mfest;
+	ve->path = path;
+	ve->fsize = fsize;
+	ve->hashlist = p;
+	ve->msgs = msgs;
+
 	snprintf(buf, sizeof(buf), "%s/%s", dir, path);
-	hash_compute_file(buf, sha256, sha512, blak2b, &flen, hashes);
+	hash_batch_add(batch, AT_FDCWD, buf, hashes, ve);
 
-	if (flen == 0) {
+	return 0;
+}
+
+/* checks the hashes computed for an entry queued by verify_file_add,
+ * priv points to the char holding the return status to update */
+static void
+verify_file_cb(hash_result *r, void *priv)
+{
+	struct verify_ent *ve = r->priv;
+	verify_msg **msgs = ve->msgs;
+	const char *mfest = ve->mfest;
+	const char *path = ve->path;
+	char *p = ve->hashlist;
+	char *hashtype;
+	char *hash;
+	size_t flen = r->flen;
+	long long int fsize = ve->fsize;
+	char *sha256 = r->sha256;
+	char *sha512 = r->sha512;
+	char *blak2b = r->blak2b;
+	char *retp = priv;
+	char ret = 0;
+
+	if (r->err != 0) {
 		msgs_add(msgs, mfest, path, "cannot open file!");
-		return 1;
+		*retp |= 1;
+		return;
 	}
 
+	if (!(hashes & HASH_SHA256))
+		sha256[0] = '\0';
+	if (!(hashes & HASH_SHA512))
+		sha512[0] = '\0';
+	if (!(hashes & HASH_BLAKE2B))
+		blak2b[0] = '\0';
+
+#pragma omp atomic
 	checked_files++;
 
 	if (flen != (size_t)fsize) {
@@ -1102,8 +1418,10 @@ verify_file(const char *dir, char *mfline, const char *mfest, verify_msg **msgs)
 				"     got: %zd\n"
 				"expected: %lld",
 				flen, fsize);
+#pragma omp atomic
 		failed_files++;
-		return 1;
+		*retp |= 1;
+		return;
 	}
 
 	/* now we are in free territory, we read TYPE HASH pairs until we
@@ -1114,7 +1432,8 @@ verify_file(const char *dir, char *mfline, const char *mfest, verify_msg **msgs)
 		if (p == NULL) {
 			msgs_add(msgs, mfest, path,
 					"corrupt manifest line, missing hash type");
-			return 1;
+			*retp |= 1;
+			return;
 		}
 		*p++ = '\0';
 
@@ -1199,7 +1518,22 @@ verify_file(const char *dir, char *mfline, const char *mfest, verify_msg **msgs)
 		ret = 1;
 	}
 
+#pragma omp atomic
 	failed_files += ret;
+	*retp |= ret;
+}
+
+/* verifies a single Manifest entry */
+static char
+verify_file(const char *dir, char *mfline, const char *mfest, verify_msg **msgs)
+{
+	hash_batch *batch = hash_batch_new(1, HASH_BATCH_READAHEAD);
+	struct verify_ent ve;
+	char ret = verify_file_add(batch, &ve, dir, mfline, mfest, msgs);
+
+	hash_batch_run(batch, verify_file_cb, &ret);
+	hash_batch_free(batch);
+
 	return ret;
 }
 
@@ -1221,12 +1555,56 @@ compare_elems(const void *l, const void *r)
 	return cl - cr;
 }
 
+/* a subdir of the dir being verified, processed as a separate task, the
+ * messages it produces are collected in its own list, such that they
+ * can be appended in Manifest order once all tasks finished */
 struct subdir_workload {
 	size_t subdirlen;
 	size_t elemslen;
 	char **elems;
+	verify_msg msghead;
+	verify_msg *msgtail;
+	char ret;
 };
 
+static char verify_dir(const char *dir, char **elems, size_t elemslen,
+		size_t skippath, const char *mfest, verify_msg **msgs);
+
+static void
+verify_subdir(
+		const char *dir,
+		struct subdir_workload *w,
+		size_t skippath,
+		const char *mfest)
+{
+	char ndir[8192];
+	char *entry = w->elems[0] + 2 + skippath;
+	char etpe = w->elems[0][0];
+	char *slash;
+	verify_msg **msgs = &w->msgtail;
+
+	/* restore original entry format */
+	w->elems[w->elemslen - 1][2 + skippath + w->subdirlen] = '/';
+
+	if (etpe == 'M') {
+		size_t skiplen = strlen(dir) + 1 + w->subdirlen;
+		/* sub-Manifest, we need to do a proper recurse */
+		snprintf(ndir, sizeof(ndir), "%s/%s", dir, entry);
+		ndir[skiplen] = '\0';
+		slash = strchr(ndir + skiplen + 1, ' ');
+		if (slash != NULL)  /* path should fit in ndir ... */
+			*slash = '\0';
+		if (verify_file(dir, entry, mfest, msgs) != 0 ||
+				verify_manifest(ndir, ndir + skiplen + 1, msgs) != 0)
+			w->ret |= 1;
+	} else {
+		snprintf(ndir, sizeof(ndir), "%s/%.*s", dir,
+				(int)w->subdirlen, entry);
+		w->ret |= verify_dir(ndir, w->elems, w->elemslen,
+				skippath + w->subdirlen + 1, mfest, msgs);
+	}
+}
+
 static char
 verify_dir(
 		const char *dir,
@@ -1245,6 +1623,7 @@ verify_dir(
 	char etpe;
 	char ret = 0;
 	int cmp;
+	arena_t *arena;
 	struct subdir_workload **subdir = NULL;
 	size_t subdirsize = 0;
 	size_t subdirlen = 0;
@@ -1279,7 +1658,10 @@ verify_dir(
 	 * easily flag missing entries in either list without hashing or
 	 * anything.
 	 */
-	if (list_dir(&dentries, &dentrieslen, dir) == 0) {
+	arena = arena_new(ARENA_BLKSIZE);
+	if (list_dir(arena, &dentries, &dentrieslen, dir) == 0) {
+		hash_batch *batch = hash_batch_new(0, HASH_BATCH_READAHEAD);
+
 		while (curdentry < dentrieslen) {
 			if (strcmp(dentries[curdentry], str_manifest) == 0 ||
 					strcmp(dentries[curdentry], str_manifest_gz) == 0 ||
@@ -1318,13 +1700,16 @@ verify_dir(
 					if (subdir == NULL) {
 						msgs_add(msgs, mfest, NULL, "out of memory allocating "
 								"sublist for %.*s", (int)sublen, entry);
+						arena_free(arena);
 						return 1;
 					}
 				}
-				subdir[subdirlen] = xmalloc(sizeof(struct subdir_workload));
+				subdir[subdirlen] = arena_zalloc(arena,
+						sizeof(struct subdir_workload));
 				subdir[subdirlen]->subdirlen = sublen;
 				subdir[subdirlen]->elemslen = curelem - elemstart;
 				subdir[subdirlen]->elems = subelems;
+				subdir[subdirlen]->msgtail = &subdir[subdirlen]->msghead;
 				subdirlen++;
 
 				curelem--; /* move back, see below */
@@ -1351,7 +1736,9 @@ verify_dir(
 			if (cmp == 0) {
 				/* equal, so yay */
 				if (etpe == 'D') {
-					ret |= verify_file(dir, entry, mfest, msgs);
+					ret |= verify_file_add(batch,
+							arena_alloc(arena, sizeof(struct verify_ent)),
+							dir, entry, mfest, msgs);
 				}
 				/* else this is I(GNORE) or S(ubdir), which means it is
 				 * ok in any way (M shouldn't happen) */
@@ -1370,6 +1757,7 @@ verify_dir(
 							"but not found", etpe == 'M' ? "MANIFEST" : "DATA");
 					if (slash != NULL)
 						*slash = ' ';
+#pragma omp atomic
 					failed_files++;
 				}
 				curelem++;
@@ -1379,134 +1767,138 @@ verify_dir(
 				msgs_add(msgs, mfest, NULL,
 						"file not listed: %s", dentries[curdentry]);
 				curdentry++;
+#pragma omp atomic
 				failed_files++;
 			}
 		}
 
-		for (curdentry = 0; curdentry < dentrieslen; curdentry++)
-			free(dentries[curdentry]);
-		free(dentries);
+		/* hash all files of this dir using the worker pool */
+		hash_batch_run(batch, verify_file_cb, &ret);
+		hash_batch_free(batch);
 
-#pragma omp parallel for shared(ret) private(entry, etpe, slash)
+		/* each subdir is a task of its own, idle threads pick up
+		 * whatever tasks remain, also those created by other subdirs,
+		 * so a few large categories don't leave threads waiting */
 		for (elem = 0; elem < subdirlen; elem++) {
-			char ndir[8192];
-
-			entry = subdir[elem]->elems[0] + 2 + skippath;
-			etpe = subdir[elem]->elems[0][0];
-
-			/* restore original entry format */
-			subdir[elem]->elems[subdir[elem]->elemslen - 1]
-				[2 + skippath + subdir[elem]->subdirlen] = '/';
-
-			if (etpe == 'M') {
-				size_t skiplen = strlen(dir) + 1 + subdir[elem]->subdirlen;
-				/* sub-Manifest, we need to do a proper recurse */
-				slash = strrchr(entry, '/');  /* cannot be NULL */
-				snprintf(ndir, sizeof(ndir), "%s/%s", dir, entry);
-				ndir[skiplen] = '\0';
-				slash = strchr(ndir + skiplen + 1, ' ');
-				if (slash != NULL)  /* path should fit in ndir ... */
-					*slash = '\0';
-				if (verify_file(dir, entry, mfest, msgs) != 0 ||
-						verify_manifest(ndir, ndir + skiplen + 1, msgs) != 0)
-					ret |= 1;
-			} else {
-				snprintf(ndir, sizeof(ndir), "%s/%.*s", dir,
-						(int)subdir[elem]->subdirlen, entry);
-				ret |= verify_dir(ndir, subdir[elem]->elems,
-						subdir[elem]->elemslen,
-						skippath + subdir[elem]->subdirlen + 1, mfest, msgs);
-			}
+			struct subdir_workload *w = subdir[elem];
+#pragma omp task firstprivate(w) if(subdirlen > 1)
+			verify_subdir(dir, w, skippath, mfest);
+		}
+#pragma omp taskwait
 
-			free(subdir[elem]);
+		/* collect results in Manifest order */
+		for (elem = 0; elem < subdirlen; elem++) {
+			struct subdir_workload *w = subdir[elem];
+
+			ret |= w->ret;
+			if (w->msghead.next != NULL && msgs != NULL && *msgs != NULL) {
+				(*msgs)->next = w->msghead.next;
+				*msgs = w->msgtail;
+			}
 		}
 
 		if (subdir)
 			free(subdir);
+		arena_free(arena);
 
 		return ret;
 	} else {
+		arena_free(arena);
 		return 1;
 	}
 }
 
+/* turns a Manifest line into the form verify_dir works with: the type
+ * is replaced by a single letter in front of the path, D(ATA),
+ * I(GNORE) or M(ANIFEST), this is done in place, except for AUX which
+ * gets files/ prepended, for which a copy is allocated from a
+ * returns NULL for lines that need no verifying */
+static char *
+manifest_elem(arena_t *a, char *line)
+{
+	char *endp = line + strlen(line) - 1;
+	size_t slen;
+	char *ret;
+
+	while (endp > line && isspace((int)*endp))
+		*endp-- = '\0';
+
+	if (endp - line < 4) {
+		/* avoid doing comparisons, none will match */
+		return NULL;
+	} else if (strncmp(line, "IGNORE ", 7) == 0) {
+		line[5] = 'I';
+		return line + 5;
+	} else if (strncmp(line, "MANIFEST ", 9) == 0) {
+		line[7] = 'M';
+		return line + 7;
+	} else if (strncmp(line, "DATA ", 5) == 0 ||
+			strncmp(line, "MISC ", 5) == 0)
+	{
+		line[3] = 'D';
+		return line + 3;
+	} else if (strncmp(line, "EBUILD ", 7) == 0) {
+		line[5] = 'D';
+		return line + 5;
+	} else if (strncmp(line, "AUX ", 4) == 0) {
+		/* translate directly into what it is: DATA in files/ */
+		slen = strlen(line + 4) + sizeof("D files/");
+		ret = arena_alloc(a, slen);
+		snprintf(ret, slen, "D files/%s", line + 4);
+		return ret;
+	}
+
+	/* TIMESTAMP, DIST and anything unknown */
+	return NULL;
+}
+
 char
 verify_manifest(
 		const char *dir,
 		const char *manifest,
 		verify_msg **msgs)
 {
-	char buf[8192];
-	FILE *f;
-	gzFile mf;
-	char ret = 0;
-
+	char path[8192];
+	arena_t *arena;
+	char *buf = NULL;
+	char *line;
+	char *nl;
+	size_t len = 0;
 	size_t elemssize = 0;
 	size_t elemslen = 0;
 	char **elems = NULL;
-#define append_list(STR) \
-	if (strncmp(STR, "TIMESTAMP ", 10) != 0 || strncmp(STR, "DIST ", 5) != 0) {\
-		char *endp = STR + strlen(STR) - 1;\
-		while (endp > STR && isspace(*endp))\
-			*endp-- = '\0';\
-		if (elemslen == elemssize) {\
-			elemssize += LISTSZ;\
-			elems = xrealloc(elems, elemssize * sizeof(elems[0]));\
-		}\
-		if (endp - STR < 4) {\
-			/* avoid doing comparisons, none will match */\
-		} else if (strncmp(STR, "IGNORE ", 7) == 0) {\
-			STR[5] = 'I';\
-			elems[elemslen] = xstrdup(STR + 5);\
-			elemslen++;\
-		} else if (strncmp(STR, "MANIFEST ", 9) == 0) {\
-			STR[7] = 'M';\
-			elems[elemslen] = xstrdup(STR + 7);\
-			elemslen++;\
-		} else if (strncmp(STR, "DATA ", 5) == 0 ||\
-				strncmp(STR, "MISC ", 5) == 0 ||\
-				strncmp(STR, "EBUILD ", 7) == 0)\
-		{\
-			if (*STR == 'E') {\
-				STR[5] = 'D';\
-				elems[elemslen] = xstrdup(STR + 5);\
-			} else {\
-				STR[3] = 'D';\
-				elems[elemslen] = xstrdup(STR + 3);\
-			}\
-			elemslen++;\
-		} else if (strncmp(STR, "AUX ", 4) == 0) {\
-			/* translate directly into what it is: DATA in files/ */\
-			size_t slen = strlen(STR + 2) + sizeof("files/");\
-			elems[elemslen] = xmalloc(slen);\
-			snprintf(elems[elemslen], slen, "D files/%s", STR + 4);\
-			elemslen++;\
-		}\
-	}
-
-	snprintf(buf, sizeof(buf), "%s/%s", dir, manifest);
-	if (strcmp(manifest, str_manifest) == 0) {
-		if ((f = fopen(buf, "r")) == NULL) {
-			msgs_add(msgs, buf, NULL, "failed to open %s: %s\n",
-					manifest, strerror(errno));
-			return 1;
-		}
-		while (fgets(buf, sizeof(buf), f) != NULL) {
-			append_list(buf);
-		}
-		fclose(f);
-	} else if (strcmp(manifest, str_manifest_files_gz) == 0 ||
+	char ret = 0;
+
+	/* the Manifest is read in one go, and its lines are used in place,
+	 * everything is released at once when done */
+	arena = arena_new(ARENA_BLKSIZE);
+	snprintf(path, sizeof(path), "%s/%s", dir, manifest);
+	if (strcmp(manifest, str_manifest) == 0 ||
+			strcmp(manifest, str_manifest_files_gz) == 0 ||
 			strcmp(manifest, str_manifest_gz) == 0)
 	{
-		if ((mf = gzopen(buf, "rb9")) == NULL) {
-			msgs_add(msgs, buf, NULL, "failed to open %s: %s\n",
+		if ((buf = manifest_read(arena, path, &len)) == NULL) {
+			msgs_add(msgs, path, NULL, "failed to open %s: %s\n",
 					manifest, strerror(errno));
+			arena_free(arena);
 			return 1;
 		}
-		while (gzgets(mf, buf, sizeof(buf)) != NULL) {
-			append_list(buf);
+
+		/* one elem at most per line */
+		elemssize = 1;
+		for (line = buf; (line = memchr(line, '\n',
+						len - (line - buf))) != NULL; line++)
+			elemssize++;
+		elems = arena_alloc(arena, elemssize * sizeof(elems[0]));
+
+		for (line = buf; *line != '\0'; line = nl) {
+			if ((nl = strchr(line, '\n')) != NULL)
+				*nl++ = '\0';
+			else
+				nl = line + strlen(line);
+			if ((elems[elemslen] = manifest_elem(arena, line)) != NULL)
+				elemslen++;
 		}
-		gzclose(mf);
 	}
 
 	/* The idea:
@@ -1519,13 +1911,11 @@ verify_manifest(
 	 */
 	if (elemslen > 1)
 		qsort(elems, elemslen, sizeof(elems[0]), compare_elems);
-	snprintf(buf, sizeof(buf), "%s/%s", dir, manifest);
-	ret = verify_dir(dir, elems, elemslen, 0, buf + 2, msgs);
+	ret = verify_dir(dir, elems, elemslen, 0, path + 2, msgs);
+#pragma omp atomic
 	checked_manifests++;
 
-	for (elemssize = 0; elemssize < elemslen; elemssize++)
-		free(elems[elemssize]);
-	free(elems);
+	arena_free(arena);
 
 	return ret;
 }
@@ -1573,6 +1963,122 @@ format_line(const char *pfx, const char *msg)
 	}
 }
 
+/* prints the signature details, and releases gs */
+static void
+print_gpg_sig(gpg_sig *gs)
+{
+	fprintf(stdout,
+			"%s%s%s signature made %s by\n"
+			"  %s%s%s\n"
+			"primary key fingerprint %s\n"
+			"%4s subkey fingerprint %s\n",
+			gs->isgood ? GREEN : RED,
+			gs->isgood ? "good": "BAD",
+			NORM, gs->timestamp,
+			DKBLUE, gs->signer, NORM,
+			gs->pkfingerprint,
+			gs->algo, gs->fingerprint);
+	if (!gs->isgood)
+		fprintf(stdout, "reason: %s%s%s\n", RED, gs->reason, NORM);
+	free(gs->algo);
+	free(gs->fingerprint);
+	free(gs->timestamp);
+	free(gs->signer);
+	free(gs->pkfingerprint);
+	if (!gs->isgood)
+		free(gs->reason);
+	free(gs);
+}
+
+/* produces a report of the verification complaints in msgs, and
+ * releases them */
+static void
+print_msgs(verify_msg *msgs)
+{
+	verify_msg *walk;
+	verify_msg *next;
+	char *mfest;
+	char *ebuild;
+	char *msg;
+	char *lastmfest = (char *)"-";
+	char *lastebuild = (char *)"-";
+	char *msgline;
+	const char *pfx;
+
+	for (walk = msgs; walk != NULL; walk = walk->next) {
+		mfest = walk->msg;
+		ebuild = strchr(mfest, ':');
+		if (ebuild != NULL) {
+			*ebuild++ = '\0';
+			msg = strchr(ebuild, ':');
+			if (msg != NULL)
+				*msg++ = '\0';
+		}
+		if (ebuild != NULL && msg != NULL) {
+			if (strcmp(mfest, lastmfest) != 0 ||
+					strcmp(ebuild, lastebuild) != 0)
+			{
+				char *mycat = mfest;
+				char *mypkg = NULL;
+
+				if ((mfest = strchr(mycat, '/')) != NULL) {
+					*mfest++ = '\0';
+					mypkg = mfest;
+					if ((mfest = strchr(mypkg, '/')) != NULL) {
+						*mfest++ = '\0';
+					} else {
+						mfest = mypkg;
+						mypkg = NULL;
+					}
+				} else {
+					mfest = mycat;
+					mycat = NULL;
+				}
+
+				fprintf(stdout, "%s%s%s" "%s%s%s%s" "%s%s" "%s%s%s%s\n",
+						mycat == NULL ? "" : BOLD,
+						mycat == NULL ? "" : mycat,
+						mycat == NULL ? "" : "/",
+						mypkg == NULL ? "" : BLUE,
+						mypkg == NULL ? "" : mypkg,
+						mypkg == NULL ? "" : NORM,
+						mypkg == NULL ? "" : "/",
+						mfest, *ebuild == '\0' ? ":" : "::",
+						CYAN, ebuild, NORM, *ebuild == '\0' ? "" : ":");
+			}
+
+			lastmfest = mfest;
+			lastebuild = ebuild;
+
+			pfx = "- ";
+			msgline = msg;
+			while ((msgline = strchr(msgline, '\n')) != NULL) {
+				*msgline++ = '\0';
+				format_line(pfx, msg);
+				pfx = "  ";
+				msg = msgline;
+			}
+			format_line(pfx, msg);
+		}
+	}
+
+	/* clean up messages */
+	walk = msgs;
+	while (walk != NULL) {
+		next = walk->next;
+		free(walk->msg);
+		free(walk);
+		walk = next;
+	}
+}
+
+static double
+timeval_diff(struct timeval *start, struct timeval *end)
+{
+	return ((double)((end->tv_sec - start->tv_sec) * 1000000 +
+				end->tv_usec) - (double)start->tv_usec) / 1000000.0;
+}
+
 static const char *
 process_dir_vrfy(void)
 {
@@ -1580,12 +2086,15 @@ process_dir_vrfy(void)
 	int newhashes;
 	const char *ret = NULL;
 	struct timeval startt;
+	struct timeval sigt;
+	struct timeval verifyt;
 	struct timeval finisht;
 	double etime;
 	char *timestamp;
+	char vret = 0;
+	int nthreads = 1;
 	verify_msg topmsg;
 	verify_msg *walk = &topmsg;
-	verify_msg *next;
 	gpg_sig *gs;
 
 	walk->next = NULL;
@@ -1601,27 +2110,7 @@ process_dir_vrfy(void)
 	if ((gs = verify_gpg_sig(str_manifest, &walk)) == NULL) {
 		ret = "gpg signature invalid";
 	} else {
-		fprintf(stdout,
-				"%s%s%s signature made %s by\n"
-				"  %s%s%s\n"
-				"primary key fingerprint %s\n"
-				"%4s subkey fingerprint %s\n",
-				gs->isgood ? GREEN : RED,
-				gs->isgood ? "good": "BAD",
-				NORM, gs->timestamp,
-				DKBLUE, gs->signer, NORM,
-				gs->pkfingerprint,
-				gs->algo, gs->fingerprint);
-		if (!gs->isgood)
-			fprintf(stdout, "reason: %s%s%s\n", RED, gs->reason, NORM);
-		free(gs->algo);
-		free(gs->fingerprint);
-		free(gs->timestamp);
-		free(gs->signer);
-		free(gs->pkfingerprint);
-		if (!gs->isgood)
-			free(gs->reason);
-		free(gs);
+		print_gpg_sig(gs);
 	}
 
 	if ((timestamp = verify_timestamp(str_manifest)) != NULL) {
@@ -1631,6 +2120,8 @@ process_dir_vrfy(void)
 		ret = "manifest timestamp entry missing";
 	}
 
+	gettimeofday(&sigt, NULL);
+
 	/* verification goes like this:
 	 * - verify the signature of the top-level Manifest file (done
 	 *   above)
@@ -1639,94 +2130,626 @@ process_dir_vrfy(void)
 	 *   be there
 	 * - recurse into directories for which Manifest files are defined
 	 */
-	if (verify_manifest(".\0", str_manifest, &walk) != 0)
+#ifdef _OPENMP
+	nthreads = verify_jobs > 0 ? verify_jobs : omp_get_max_threads();
+#endif
+	/* all Manifests and dirs become tasks for this team to execute,
+	 * started off by a single thread */
+#pragma omp parallel num_threads(nthreads)
+#pragma omp single
+	vret = verify_manifest(".\0", str_manifest, &walk);
+	if (vret != 0)
 		ret = "manifest verification failed";
 
+	gettimeofday(&verifyt, NULL);
+
+	print_msgs(topmsg.next);
+
 	gettimeofday(&finisht, NULL);
 
-	/* produce a report */
+	etime = timeval_diff(&startt, &finisht);
+	printf("checked %zd Manifests, %zd files, %zd failures in %.02fs\n",
+			checked_manifests, checked_files, failed_files, etime);
+	if (verbose)
+		printf("signature %.02fs, tree (%d threads) %.02fs, "
+				"report %.02fs\n",
+				timeval_diff(&startt, &sigt),
+				nthreads, timeval_diff(&sigt, &verifyt),
+				timeval_diff(&verifyt, &finisht));
+	return ret;
+}
+
+#ifdef ENABLE_GTREE
+/* the repo.tar member of a gtree container, it is read straight from
+ * the container, and hashed while handing it out when hctx is set */
+struct gtree_repo {
+	int fd;
+	off_t off;
+	off_t left;
+	hash_ctx *hctx;
+	char *buf;    /* for libarchive reads */
+};
+
+static ssize_t
+gtree_repo_read(void *handle, void *buf, size_t size)
+{
+	struct gtree_repo *gr = handle;
+	ssize_t rd;
+
+	if ((off_t)size > gr->left)
+		size = (size_t)gr->left;
+	if (size == 0)
+		return 0;
+
+	rd = pread(gr->fd, buf, size, gr->off);
+	if (rd > 0) {
+		if (gr->hctx != NULL)
+			hash_ctx_update(gr->hctx, buf, (size_t)rd);
+		gr->off += rd;
+		gr->left -= rd;
+	}
+
+	return rd;
+}
+
+#define GTREE_READ_SIZE  (64 * 1024)
+static la_ssize_t
+gtree_repo_archive_read(struct archive *a, void *handle, const void **buf)
+{
+	struct gtree_repo *gr = handle;
+	ssize_t rd;
+
+	(void)a;
+	*buf = gr->buf;
+	rd = gtree_repo_read(gr, gr->buf, GTREE_READ_SIZE);
+
+	return rd < 0 ? ARCHIVE_FATAL : (la_ssize_t)rd;
+}
+
+/* verifies the detached signature sig over the repo data, reading it
+ * exactly once */
+static gpg_sig *
+verify_gtree_sig(
+		const char *path,
+		struct gtree_repo *gr,
+		const char *sig,
+		size_t siglen,
+		verify_msg **msgs)
+{
+	struct gpgme_data_cbs cbs;
+	gpgme_ctx_t g_ctx;
+	gpgme_data_t sigdata;
+	gpgme_data_t repodata;
+	gpg_sig *ret = NULL;
+
+	memset(&cbs, 0, sizeof(cbs));
+	cbs.read = gtree_repo_read;
+
+	if (gpgme_new(&g_ctx) != GPG_ERR_NO_ERROR) {
+		msgs_add(msgs, path, NULL, "failed to create gpgme context");
+		return NULL;
+	}
+
+	if (gpgme_data_new_from_mem(&sigdata, sig, siglen, 0) !=
+			GPG_ERR_NO_ERROR)
+	{
+		msgs_add(msgs, path, NULL, "failed to create gpgme data");
+		gpgme_release(g_ctx);
+		return NULL;
+	}
+
+	if (gpgme_data_new_from_cbs(&repodata, &cbs, gr) != GPG_ERR_NO_ERROR) {
+		msgs_add(msgs, path, NULL, "failed to create gpgme data");
+		gpgme_data_release(sigdata);
+		gpgme_release(g_ctx);
+		return NULL;
+	}
+
+	if (gpgme_op_verify(g_ctx, sigdata, repodata, NULL) != GPG_ERR_NO_ERROR)
+		msgs_add(msgs, path, NULL, "failed to verify signature");
+	else
+		ret = verify_gpg_result(g_ctx, path, msgs);
+
+	gpgme_data_release(repodata);
+	gpgme_data_release(sigdata);
+	gpgme_release(g_ctx);
+
+	return ret;
+}
+
+/* returns whether the member outer is positioned at has its data right
+ * after its header, as gtree requires, such that it can be read from
+ * the container directly */
+static bool
+gtree_member_plain(int fd, struct archive *outer, const char *name)
+{
+	char hdr[512];
+	off_t pos = archive_read_header_position(outer);
+
+	return pread(fd, hdr, sizeof(hdr), pos) == (ssize_t)sizeof(hdr) &&
+		memcmp(hdr + 257, "ustar", 5) == 0 &&
+		strncmp(hdr, name, 100) == 0;
+}
+
+/* a line from caches.idx */
+struct gtree_idx_ent {
+	char *pkg;        /* CAT/PN */
+	uint64_t off;
+	uint64_t len;
+	bool found;       /* its frame holds entries for pkg */
+};
+
+/* returns the caches/ entries from the repository data as a map from
+ * CAT/PF to a digest of their contents */
+static hash_t *
+gtree_repo_caches(struct gtree_repo *gr, const char *repo, verify_msg **msgs)
+{
+	struct archive *inner;
+	struct archive_entry *entry;
+	hash_t *ret = hash_new();
+	const char *fname;
+	char *data = NULL;
+	size_t datalen = 0;
+	size_t len;
+	void *prev;
+	int r;
+
+	inner = archive_read_new();
+	archive_read_support_format_tar(inner);
+	archive_read_support_filter_all(inner);
+	if (archive_read_open(inner, gr, NULL,
+				gtree_repo_archive_read, NULL) != ARCHIVE_OK)
+	{
+		msgs_add(msgs, repo, NULL, "cannot read: %s",
+				archive_error_string(inner));
+		archive_read_free(inner);
+		return ret;
+	}
+
+	while ((r = archive_read_next_header(inner, &entry)) == ARCHIVE_OK) {
+		if ((fname = archive_entry_pathname(entry)) == NULL ||
+				strncmp(fname, "caches/", sizeof("caches/") - 1) != 0)
+			continue;
+
+		len = (size_t)archive_entry_size(entry);
+		if (len + 1 > datalen) {
+			datalen = len + 1;
+			data = xrealloc(data, datalen);
+		}
+		if (archive_read_data(inner, data, len) != (la_ssize_t)len) {
+			r = ARCHIVE_FATAL;
+			break;
+		}
+
+		ret = hash_add(ret, fname + sizeof("caches/") - 1,
+				xstrdup(hash_string(data, (ssize_t)len, HASH_SHA256)),
+				&prev);
+		free(prev);
+	}
+	if (r != ARCHIVE_EOF)
+		msgs_add(msgs, repo, NULL, "cannot read: %s",
+				archive_error_string(inner));
+
+	archive_read_free(inner);
+	free(data);
+
+	return ret;
+}
+
+/* checks the caches.pack frame at off against the cache entries from
+ * the repository data, taking the entries it holds off caches, returns
+ * the number of problems found */
+static size_t
+gtree_verify_frame(
+		int fd,
+		off_t packoff,
+		struct gtree_idx_ent *ent,
+		hash_t *pkgs,
+		hash_t *caches,
+		verify_msg **msgs)
+{
+	struct archive *a;
+	struct archive_entry *entry;
+	struct gtree_idx_ent *pent;
+	atom_ctx *atom;
+	const char *fname;
+	char *frame;
+	char *data = NULL;
+	char *digest;
+	char pkg[_Q_PATH_MAX];
+	size_t datalen = 0;
+	size_t len;
+	size_t ret = 0;
+	int r;
+
+	frame = xmalloc((size_t)ent->len);
+	if (pread(fd, frame, (size_t)ent->len, packoff + (off_t)ent->off) !=
+			(ssize_t)ent->len)
 	{
-		char *mfest;
-		char *ebuild;
-		char *msg;
-		char *lastmfest = (char *)"-";
-		char *lastebuild = (char *)"-";
-		char *msgline;
-		const char *pfx;
-
-		for (walk = topmsg.next; walk != NULL; walk = walk->next) {
-			mfest = walk->msg;
-			ebuild = strchr(mfest, ':');
-			if (ebuild != NULL) {
-				*ebuild++ = '\0';
-				msg = strchr(ebuild, ':');
-				if (msg != NULL)
-					*msg++ = '\0';
+		msgs_add(msgs, "caches.pack", NULL,
+				"cannot read frame at %llu", (unsigned long long)ent->off);
+		free(frame);
+		return 1;
+	}
+
+	a = archive_read_new();
+	archive_read_support_format_tar(a);
+	archive_read_support_filter_all(a);
+	if (archive_read_open_memory(a, frame, (size_t)ent->len) != ARCHIVE_OK) {
+		msgs_add(msgs, "caches.pack", NULL, "cannot read frame at %llu: %s",
+				(unsigned long long)ent->off, archive_error_string(a));
+		archive_read_free(a);
+		free(frame);
+		return 1;
+	}
+
+	while ((r = archive_read_next_header(a, &entry)) == ARCHIVE_OK) {
+		if ((fname = archive_entry_pathname(entry)) == NULL ||
+				strncmp(fname, "caches/", sizeof("caches/") - 1) != 0)
+			continue;
+		fname += sizeof("caches/") - 1;
+
+		len = (size_t)archive_entry_size(entry);
+		if (len + 1 > datalen) {
+			datalen = len + 1;
+			data = xrealloc(data, datalen);
+		}
+		if (archive_read_data(a, data, len) != (la_ssize_t)len) {
+			r = ARCHIVE_FATAL;
+			break;
+		}
+
+		/* the index must lead to this frame for this package */
+		atom = atom_explode(fname);
+		snprintf(pkg, sizeof(pkg), "%s/%s",
+				atom->CATEGORY ? atom->CATEGORY : "", atom->PN);
+		atom_implode(atom);
+		pent = hash_get(pkgs, pkg);
+		if (pent == NULL || pent->off != ent->off || pent->len != ent->len) {
+			msgs_add(msgs, "caches.idx", NULL,
+					"%s: frame at %llu not indexed for it",
+					fname, (unsigned long long)ent->off);
+			ret++;
+		} else {
+			pent->found = true;
+		}
+
+		digest = hash_delete(caches, fname);
+		if (digest == NULL) {
+			msgs_add(msgs, "caches.pack", NULL,
+					"%s: not in repository data, or duplicate", fname);
+			ret++;
+		} else {
+			if (strcmp(digest,
+						hash_string(data, (ssize_t)len, HASH_SHA256)) != 0)
+			{
+				msgs_add(msgs, "caches.pack", NULL,
+						"%s: differs from repository data", fname);
+				ret++;
 			}
-			if (ebuild != NULL && msg != NULL) {
-				if (strcmp(mfest, lastmfest) != 0 ||
-						strcmp(ebuild, lastebuild) != 0)
-				{
-					char *mycat = mfest;
-					char *mypkg = NULL;
-
-					if ((mfest = strchr(mycat, '/')) != NULL) {
-						*mfest++ = '\0';
-						mypkg = mfest;
-						if ((mfest = strchr(mypkg, '/')) != NULL) {
-							*mfest++ = '\0';
-						} else {
-							mfest = mypkg;
-							mypkg = NULL;
-						}
-					} else {
-						mfest = mycat;
-						mycat = NULL;
-					}
+			free(digest);
+		}
+	}
+	if (r != ARCHIVE_EOF) {
+		msgs_add(msgs, "caches.pack", NULL, "cannot read frame at %llu: %s",
+				(unsigned long long)ent->off, archive_error_string(a));
+		ret++;
+	}
 
-					fprintf(stdout, "%s%s%s" "%s%s%s%s" "%s%s" "%s%s%s%s\n",
-							mycat == NULL ? "" : BOLD,
-							mycat == NULL ? "" : mycat,
-							mycat == NULL ? "" : "/",
-							mypkg == NULL ? "" : BLUE,
-							mypkg == NULL ? "" : mypkg,
-							mypkg == NULL ? "" : NORM,
-							mypkg == NULL ? "" : "/",
-							mfest, *ebuild == '\0' ? ":" : "::",
-							CYAN, ebuild, NORM, *ebuild == '\0' ? "" : ":");
-				}
+	archive_read_free(a);
+	free(data);
+	free(frame);
 
-				lastmfest = mfest;
-				lastebuild = ebuild;
+	return ret;
+}
 
-				pfx = "- ";
-				msgline = msg;
-				while ((msgline = strchr(msgline, '\n')) != NULL) {
-					*msgline++ = '\0';
-					format_line(pfx, msg);
-					pfx = "  ";
-					msg = msgline;
-				}
-				format_line(pfx, msg);
+static int
+gtree_compar_str(const void *l, const void *r)
+{
+	return strcmp(*(const char **)l, *(const char **)r);
+}
+
+/* checks that the index and frames of a gtree-2 container hold the
+ * same cache entries as the (signed) repository data, returns the
+ * number of problems found */
+static size_t
+gtree_verify_frames(
+		struct gtree_repo *gr,
+		const char *repo,
+		char *idx,
+		off_t packoff,
+		off_t packlen,
+		verify_msg **msgs)
+{
+	struct gtree_idx_ent *ents = NULL;
+	hash_t *caches;
+	hash_t *pkgs = hash_new();
+	array *left;
+	char *line;
+	char *next;
+	char *end;
+	size_t nents = 0;
+	size_t sents = 0;
+	size_t ret = 0;
+	size_t i;
+
+	for (line = idx; *line != '\0'; line = next) {
+		if ((next = strchr(line, '\n')) != NULL)
+			*next++ = '\0';
+		else
+			next = line + strlen(line);
+		if (*line == '\0')
+			continue;
+
+		if (nents == sents) {
+			sents = sents == 0 ? 1024 : sents * 2;
+			ents = xrealloc(ents, sizeof(ents[0]) * sents);
+		}
+		ents[nents].pkg = line;
+		ents[nents].found = false;
+		if ((end = strchr(line, ' ')) == NULL) {
+			msgs_add(msgs, "caches.idx", NULL, "malformed line: %s", line);
+			ret++;
+			continue;
+		}
+		*end++ = '\0';
+		ents[nents].off = strtoull(end, &end, 10);
+		ents[nents].len = strtoull(end, &end, 10);
+		if (*end != '\0' || ents[nents].len == 0 ||
+				ents[nents].off + ents[nents].len > (uint64_t)packlen)
+		{
+			msgs_add(msgs, "caches.idx", NULL,
+					"%s: frame out of range", line);
+			ret++;
+			continue;
+		}
+		if (nents > 0 && strcmp(ents[nents - 1].pkg, line) >= 0) {
+			msgs_add(msgs, "caches.idx", NULL, "%s: not sorted", line);
+			ret++;
+		}
+		nents++;
+	}
+
+	/* the index array is complete, hence its pointers are stable now */
+	for (i = 0; i < nents; i++)
+		pkgs = hash_add(pkgs, ents[i].pkg, &ents[i], NULL);
+
+	caches = gtree_repo_caches(gr, repo, msgs);
+
+	/* packages sharing a frame have the same location, so decode each
+	 * frame only once */
+	for (i = 0; i < nents; i++) {
+		if (i > 0 && ents[i].off == ents[i - 1].off &&
+				ents[i].len == ents[i - 1].len)
+			continue;
+		ret += gtree_verify_frame(gr->fd, packoff, &ents[i],
+				pkgs, caches, msgs);
+	}
+
+	for (i = 0; i < nents; i++) {
+		if (!ents[i].found) {
+			msgs_add(msgs, "caches.idx", NULL,
+					"%s: no cache entries in its frame", ents[i].pkg);
+			ret++;
+		}
+	}
+
+	left = hash_keys(caches);
+	array_sort(left, gtree_compar_str);
+	array_for_each(left, i, line) {
+		msgs_add(msgs, "caches.pack", NULL,
+				"%s: missing, present in repository data", line);
+		ret++;
+	}
+	array_free(left);
+
+	left = hash_values(caches);
+	array_deepfree(left, NULL);
+	hash_free(caches);
+	hash_free(pkgs);
+	free(ents);
+
+	return ret;
+}
+
+/**
+ * Verify the gtree container at path, without extracting anything: the
+ * repository data member is read once, both to compute its hashes, and
+ * to verify its detached signature with.  Only the headers of the other
+ * members are looked at, which is cheap since the container is not
+ * compressed.  Members are accepted in any order.
+ * When requested, for gtree-2 containers the repository data is read a
+ * second time to check the cache entries in caches.pack (which the
+ * signature doesn't cover) match the ones in there.  gpgme and
+ * libarchive both pull their input, so this cannot share the first
+ * read, instead the data is hashed again, to ensure it still is what
+ * the signature was checked over.
+ */
+static const char *
+process_gtree_vrfy(const char *path)
+{
+	struct archive *outer;
+	struct archive_entry *entry;
+	struct gtree_repo gr;
+	struct timeval startt;
+	struct timeval finisht;
+	verify_msg topmsg;
+	verify_msg *walk = &topmsg;
+	const char *fname;
+	const char *ret = NULL;
+	char *repo = NULL;
+	char *signame = NULL;
+	char *sig = NULL;
+	size_t siglen = 0;
+	char *idx = NULL;
+	off_t repooff = 0;
+	off_t repolen = 0;
+	off_t packoff = 0;
+	off_t packlen = -1;
+	gpg_sig *gs = NULL;
+	char buf[BUFSIZ];
+	char sha256[SHA256_DIGEST_LENGTH + 1];
+	char sha512[SHA512_DIGEST_LENGTH + 1];
+	char blak2b[BLAKE2B_DIGEST_LENGTH + 1];
+	char resha512[SHA512_DIGEST_LENGTH + 1];
+	size_t failures = 0;
+	size_t len;
+
+	walk->next = NULL;
+	gettimeofday(&startt, NULL);
+	memset(&gr, 0, sizeof(gr));
+	sha256[0] = sha512[0] = blak2b[0] = '\0';
+
+	if ((gr.fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+		return "cannot open gtree";
+
+	outer = archive_read_new();
+	archive_read_support_format_tar(outer);
+	if (archive_read_open_fd(outer, gr.fd, BUFSIZ) != ARCHIVE_OK ||
+			archive_read_next_header(outer, &entry) != ARCHIVE_OK ||
+			(fname = archive_entry_pathname(entry)) == NULL ||
+			(strcmp(fname, "gtree-1") != 0 && strcmp(fname, "gtree-2") != 0))
+	{
+		archive_read_free(outer);
+		close(gr.fd);
+		return "not a gtree container";
+	}
+
+	/* locate repo.tar{compr}, its signature and the index and frames,
+	 * in whatever order they come */
+	while (ret == NULL &&
+			archive_read_next_header(outer, &entry) == ARCHIVE_OK)
+	{
+		if ((fname = archive_entry_pathname(entry)) == NULL)
+			continue;
+
+		len = strlen(fname);
+		if (strcmp(fname, "caches.idx") == 0) {
+			len = (size_t)archive_entry_size(entry);
+			free(idx);
+			idx = xmalloc(len + 1);
+			if (archive_read_data(outer, idx, len) != (la_ssize_t)len)
+				ret = "failed to read caches.idx";
+			idx[len] = '\0';
+		} else if (strcmp(fname, "caches.pack") == 0) {
+			if (!gtree_member_plain(gr.fd, outer, fname))
+				ret = "unsupported gtree, caches.pack isn't plain ustar";
+			packoff = archive_read_header_position(outer) + 512;
+			packlen = archive_entry_size(entry);
+		} else if (strncmp(fname, "repo.tar", sizeof("repo.tar") - 1) != 0 ||
+				(fname[sizeof("repo.tar") - 1] != '.' &&
+				 fname[sizeof("repo.tar") - 1] != '\0'))
+		{
+			continue;
+		} else if (len > 4 && strcmp(fname + len - 4, ".sig") == 0) {
+			if (sig != NULL) {
+				ret = "multiple signatures in gtree";
+				break;
 			}
+			signame = xstrdup(fname);
+			siglen = (size_t)archive_entry_size(entry);
+			sig = xmalloc(siglen + 1);
+			if (archive_read_data(outer, sig, siglen) != (la_ssize_t)siglen)
+				ret = "failed to read signature";
+		} else {
+			if (repo != NULL) {
+				ret = "multiple repository data members in gtree";
+				break;
+			}
+			if (!gtree_member_plain(gr.fd, outer, fname)) {
+				ret = "unsupported gtree, repository data isn't plain ustar";
+				break;
+			}
+			repo = xstrdup(fname);
+			repooff = archive_read_header_position(outer) + 512;
+			repolen = archive_entry_size(entry);
 		}
 	}
+	archive_read_free(outer);
+
+	if (ret == NULL && repo == NULL)
+		ret = "no repository data in gtree";
+	if (ret == NULL && sig != NULL &&
+			(strlen(signame) != strlen(repo) + 4 ||
+			 strncmp(signame, repo, strlen(repo)) != 0))
+		ret = "signature in gtree does not belong to its repository data";
+	if (ret == NULL && (idx != NULL) != (packlen >= 0))
+		ret = "incomplete gtree, caches.idx and caches.pack go together";
+
+	if (ret == NULL) {
+		gr.off = repooff;
+		gr.left = repolen;
+		gr.hctx = hash_ctx_new((hashes & MANIFEST_HASHES) | HASH_SHA512);
+
+		if (sig != NULL)
+			gs = verify_gtree_sig(repo, &gr, sig, siglen, &walk);
+		/* hash whatever gpg did not consume, e.g. when it bailed out */
+		while (gtree_repo_read(&gr, buf, sizeof(buf)) > 0)
+			;
+		if (gr.left != 0) {
+			msgs_add(&walk, repo, NULL, "truncated, %lld bytes missing",
+					(long long)gr.left);
+			failures++;
+		}
 
-	/* clean up messages */
-	walk = topmsg.next;
-	while (walk != NULL) {
-		next = walk->next;
-		free(walk->msg);
-		free(walk);
-		walk = next;
+		hash_ctx_finish(gr.hctx, NULL, NULL, sha256, sha512, blak2b);
+		gr.hctx = NULL;
+		len = snprintf(buf, sizeof(buf), "%s %lld", repo, (long long)repolen);
+		/* empty when built without blake2b support */
+		if ((hashes & HASH_BLAKE2B) && blak2b[0] != '\0')
+			len += snprintf(buf + len, sizeof(buf) - len,
+					" BLAKE2B %s", blak2b);
+		if (hashes & HASH_SHA256)
+			len += snprintf(buf + len, sizeof(buf) - len,
+					" SHA256 %s", sha256);
+		if (hashes & HASH_SHA512)
+			len += snprintf(buf + len, sizeof(buf) - len,
+					" SHA512 %s", sha512);
+		printf("%s\n", buf);
+
+		if (failures == 0 && idx != NULL && gtree_caches) {
+			gr.off = repooff;
+			gr.left = repolen;
+			gr.hctx = hash_ctx_new(HASH_SHA512);
+			gr.buf = xmalloc(GTREE_READ_SIZE);
+			failures += gtree_verify_frames(&gr, repo, idx,
+					packoff, packlen, &walk);
+			while (gtree_repo_read(&gr, buf, sizeof(buf)) > 0)
+				;
+			hash_ctx_finish(gr.hctx, NULL, NULL, NULL, resha512, NULL);
+			gr.hctx = NULL;
+			free(gr.buf);
+			if (gr.left != 0 || strcmp(sha512, resha512) != 0) {
+				msgs_add(&walk, repo, NULL,
+						"changed while checking its cache entries");
+				failures++;
+			}
+		}
+
+		if (sig == NULL)
+			ret = "unsigned";
+		else if (gs != NULL)
+			print_gpg_sig(gs);
+		else
+			ret = "gpg signature invalid";
+		if (failures != 0)
+			ret = "gtree verification failed";
 	}
 
-	etime = ((double)((finisht.tv_sec - startt.tv_sec) * 1000000 +
-				finisht.tv_usec) - (double)startt.tv_usec) / 1000000.0;
-	printf("checked %zd Manifests, %zd files, %zd failures in %.02fs\n",
-			checked_manifests, checked_files, failed_files, etime);
+	print_msgs(topmsg.next);
+	free(repo);
+	free(signame);
+	free(sig);
+	free(idx);
+	close(gr.fd);
+
+	gettimeofday(&finisht, NULL);
+	if (verbose)
+		printf("checked gtree in %.02fs\n", timeval_diff(&startt, &finisht));
+
 	return ret;
 }
+#endif
 
 int
 qmanifest_main(int argc, char **argv)
@@ -1743,6 +2766,8 @@ qmanifest_main(int argc, char **argv)
 	size_t n;
 	int i;
 	int curdirfd;
+	char *p;
+	size_t len;
 
 	if ((prog = strrchr(argv[0], '/')) == NULL) {
 		prog = argv[0];
@@ -1767,6 +2792,13 @@ qmanifest_main(int argc, char **argv)
 			case 'p': gpg_get_password = true;    break;
 			case 'd': isdir = true;               break;
 			case 'o': isoverlay = true;           break;
+			case 'f': force_rehash = true;        break;
+			case 'c': gtree_caches = true;        break;
+			case 'j':
+				verify_jobs = (int)strtol(optarg, &p, 10);
+				if (*optarg == '\0' || *p != '\0' || verify_jobs < 0)
+					err("invalid argument to --jobs: '%s'", optarg);
+				break;
 		}
 	}
 
@@ -1860,6 +2892,31 @@ qmanifest_main(int argc, char **argv)
 		}
 
 		snprintf(path2, sizeof(path2), "%s%s", portroot, path);
+
+		len = strlen(path2);
+		if (len > sizeof(".gtree.tar") - 1 &&
+				strcmp(path2 + len - (sizeof(".gtree.tar") - 1),
+					".gtree.tar") == 0)
+		{
+#ifdef ENABLE_GTREE
+			if (runfunc == process_dir_vrfy) {
+				printf("verifying %s%s%s...\n", BOLD, overlay, NORM);
+				rsn = process_gtree_vrfy(path2);
+				if (rsn != NULL) {
+					printf("%s%s%s\n", RED, rsn, NORM);
+					ret |= 2;
+				}
+			} else {
+				warn("cannot generate Manifests for a gtree: %s", overlay);
+				ret |= 1;
+			}
+#else
+			warn("gtree support is not enabled, cannot verify %s", overlay);
+			ret |= 1;
+#endif
+			continue;
+		}
+
 		if (chdir(path2) != 0) {
 			warn("cannot change directory to %s: %s", overlay, strerror(errno));
 			ret |= 1;
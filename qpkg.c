@@ -69,6 +69,29 @@ typedef struct qpkg_cb_args {
 	size_t    pkgs_made;
 } qpkg_cb_args;
 
+/* array_filter callback, retains binpkgs not found in any of the trees */
+static bool
+qpkg_clean_notintrees(void *elem, void *priv)
+{
+	tree_pkg_ctx *binpkg = elem;
+	array *trees = priv;
+	tree_ctx *t;
+	size_t n;
+
+	array_for_each(trees, n, t) {
+		array *mx = tree_match_atom(t, tree_pkg_atom(binpkg, false),
+									(TREE_MATCH_DEFAULT |
+									 TREE_MATCH_FIRST));
+		size_t l  = array_cnt(mx);
+		array_free(mx);
+
+		if (l > 0)
+			return false;
+	}
+
+	return true;
+}
+
 /* figure out what dirs we want to process for cleaning and display results. */
 static int
 qpkg_clean(qpkg_cb_args *args)
@@ -106,23 +129,7 @@ qpkg_clean(qpkg_cb_args *args)
 
 	/* check which binpkgs exist in the trees (vdb or ebuilds), such
 	 * that the remainder is what we would clean */
-	array_for_each_rev(bins, n, binpkg) {
-		size_t m;
-		array_for_each(trees, m, t)
-		{
-			array *mx = tree_match_atom(t, tree_pkg_atom(binpkg, false),
-									    (TREE_MATCH_DEFAULT |
-									     TREE_MATCH_FIRST));
-			size_t l  = array_cnt(mx);
-			array_free(mx);
-
-			if (l > 0)
-			{
-				array_remove(bins, n);
-				break;
-			}
-		}
-	}
+	array_filter(bins, qpkg_clean_notintrees, trees);
 
 	array_deepfree(trees, (array_free_cb *)tree_close);
 	trees = NULL;
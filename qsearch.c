@@ -173,6 +173,7 @@ int qsearch_main(int argc, char **argv)
 	array_for_each(overlays, n, overlay) {
 		tree_ctx *t = tree_new(portroot, overlay, TREETYPE_EBUILD, false);
 		if (t != NULL) {
+			tree_set_keys(t, TREE_KEY(DESCRIPTION) | TREE_KEY(HOMEPAGE));
 			ret |= tree_foreach_pkg_sorted(t, qsearch_cb, &state, NULL);
 			tree_close(t);
 		}
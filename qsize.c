@@ -93,7 +93,7 @@ struct qsize_opt_state {
 	const char *fmt;
 	bool need_full_atom:1;
 
-	set *uniq_files;
+	iset_t *uniq_files;
 	size_t num_all_files;
 	size_t num_all_nonfiles;
 	size_t num_all_ignored;
@@ -112,8 +112,7 @@ qsize_cb(tree_pkg_ctx *pkg_ctx, void *priv)
 	uint64_t num_bytes;
 	struct stat st;
 	bool ok = false;
-	char ikey[2 * (sizeof(size_t) * 2) + 1 + 1];  /* hex rep */
-	size_t cur_uniq = cnt_set(state->uniq_files);
+	size_t cur_uniq = iset_size(state->uniq_files);
 	bool isuniq;
 
 	if ((line = tree_pkg_meta(pkg_ctx, Q_CONTENTS)) == NULL)
@@ -143,10 +142,9 @@ qsize_cb(tree_pkg_ctx *pkg_ctx, void *priv)
 			if (fstatat(tree_pkg_get_portroot_fd(pkg_ctx),
 						e->name + 1, &st, AT_SYMLINK_NOFOLLOW) == 0)
 			{
-				snprintf(ikey, sizeof(ikey), "%zx:%zx",
-						(size_t)st.st_dev, (size_t)st.st_ino);
 				state->uniq_files =
-					add_set_unique(ikey, state->uniq_files, &isuniq);
+					iset_add_unique(state->uniq_files,
+							(uint64_t)st.st_dev, (uint64_t)st.st_ino, &isuniq);
 				if (isuniq)
 					num_bytes +=
 						state->fs_size ? st.st_blocks * S_BLKSIZE : st.st_size;
@@ -163,7 +161,7 @@ qsize_cb(tree_pkg_ctx *pkg_ctx, void *priv)
 	if (!state->summary_only) {
 		char uniqbuf[32];
 
-		cur_uniq = cnt_set(state->uniq_files) - cur_uniq;
+		cur_uniq = iset_size(state->uniq_files) - cur_uniq;
 		atom = tree_pkg_atom(pkg_ctx, state->need_full_atom);
 
 		if (cur_uniq != num_files)
@@ -199,7 +197,7 @@ int qsize_main(int argc, char **argv)
 		.disp_units = 0,
 		.str_disp_units = NULL,
 		.ignore_regexp = array_new(),
-		.uniq_files = create_set(),
+		.uniq_files = iset_new(),
 		.num_all_files = 0,
 		.num_all_nonfiles = 0,
 		.num_all_ignored = 0,
@@ -261,7 +259,7 @@ int qsize_main(int argc, char **argv)
 
 	if (state.summary) {
 		char uniqbuf[32];
-		size_t uniq_files = cnt_set(state.uniq_files);
+		size_t uniq_files = iset_size(state.uniq_files);
 
 		if (uniq_files != state.num_all_files)
 			snprintf(uniqbuf, sizeof(uniqbuf), " (%zu unique)", uniq_files);
@@ -280,7 +278,7 @@ int qsize_main(int argc, char **argv)
 
 	array_deepfree(state.atoms, (array_free_cb *)atom_implode);
 	array_deepfree(state.ignore_regexp, NULL);
-	free_set(state.uniq_files);
+	iset_free(state.uniq_files);
 
 	return ret;
 }
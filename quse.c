@@ -68,8 +68,16 @@ struct quse_state {
 	depend_atom *match;
 	regex_t *pregv;
 	const char *fmt;
+	const char *lastval;  /* interned IUSE/LICENSE scanned last */
+	char *lastbuf;
+	int lastcnt;
+	int lastmaxlen;
+	bool lastmatch;
 };
 
+#define QUSE_SCANBUF_SIZE 8192
+#define QUSE_KEYS (TREE_KEY(IUSE) | TREE_KEY(USE) | TREE_KEY(LICENSE))
+
 static char *_quse_getline_buf = NULL;
 static size_t _quse_getline_buflen = 0;
 #define GETLINE(FD, BUF, LEN) \
@@ -428,6 +436,7 @@ quse_results_cb(tree_pkg_ctx *pkg_ctx, void *priv)
 	char buf[8192];
 	set *use = NULL;
 	bool match;
+	const char *val;
 	char *p;
 	char *q;
 	char *s;
@@ -459,15 +468,7 @@ quse_results_cb(tree_pkg_ctx *pkg_ctx, void *priv)
 		}
 
 		/* available when dealing with VDB or binpkgs */
-		if ((p = tree_pkg_meta(pkg_ctx, Q_USE)) != NULL) {
-			while ((q = strchr(p, (int)' ')) != NULL) {
-				*q++ = '\0';
-				use = add_set(p, use);
-				p = q;
-			}
-			if (*p != '\0')
-				use = add_set(p, use);
-		}
+		use = set_add_from_string(use, tree_pkg_meta(pkg_ctx, Q_USE));
 	} else {
 		if ((s = tree_pkg_meta(pkg_ctx, Q_LICENSE)) == NULL)
 			return 0;
@@ -477,14 +478,22 @@ quse_results_cb(tree_pkg_ctx *pkg_ctx, void *priv)
 	cnt = 0;
 	match = false;
 	p = q = s;  /* set to IUSE or LICENSE above */
-	buf[0] = '\0';
-	v = buf;
-	w = buf + sizeof(buf);
+	val = s;    /* s is reused while scanning */
 
 	if (state->do_all && !state->do_describe) {
 		match = true;
 		v = q;
+	} else if (val == state->lastval) {
+		/* metadata strings are interned, so the same pointer means the
+		 * same value as the previous package, reuse its result */
+		match = state->lastmatch;
+		cnt = state->lastcnt;
+		maxlen = state->lastmaxlen;
+		v = state->lastbuf;
 	} else {
+		v = state->lastbuf;
+		w = v + QUSE_SCANBUF_SIZE;
+		*v = '\0';
 		do {
 			if (*p == ' ' || *p == '\0') {
 				/* skip over consequtive whitespace */
@@ -500,18 +509,15 @@ quse_results_cb(tree_pkg_ctx *pkg_ctx, void *priv)
 					i = 0;
 					match = true;
 				} else if (state->do_regex) {
-					char r;
+					/* IUSE is shared metadata, match on a copy */
+					snprintf(buf, sizeof(buf), "%.*s", (int)(p - q), q);
 					for (i = 0; i < state->argc; i++) {
-						r = *p;
-						*p = '\0';
-						if (regexec(&state->pregv[i], q, 0, NULL, 0) == 0) {
-							*p = r;
+						if (regexec(&state->pregv[i], buf, 0, NULL, 0) == 0) {
 							v += snprintf(v, w - v, "%s%.*s%s%c",
 									RED, (int)(p - s), s, NORM, *p);
 							match = true;
 							break;
 						}
-						*p = r;
 					}
 				} else {
 					for (i = 0; i < state->argc; i++) {
@@ -536,7 +542,11 @@ quse_results_cb(tree_pkg_ctx *pkg_ctx, void *priv)
 				q = p + 1;
 			}
 		} while (*p++ != '\0' && v < w);
-		v = buf;
+		v = state->lastbuf;
+		state->lastval = val;
+		state->lastmatch = match;
+		state->lastcnt = cnt;
+		state->lastmaxlen = maxlen;
 	}
 
 	if (match) {
@@ -671,6 +681,7 @@ int quse_main(int argc, char **argv)
 		.match          = NULL,
 		.overlay        = NULL,
 		.fmt            = NULL,
+		.lastval        = NULL,
 	};
 
 	while ((i = GETOPT_LONG(QUSE, quse, "")) != -1) {
@@ -723,6 +734,8 @@ int quse_main(int argc, char **argv)
 				state.fmt = "%[CATEGORY]%[PN]";
 	}
 
+	state.lastbuf = xmalloc(QUSE_SCANBUF_SIZE);
+
 	ret = EXIT_FAILURE;
 	if (state.do_describe && state.match == NULL) {
 		array_for_each(overlays, n, overlay) {
@@ -740,24 +753,29 @@ int quse_main(int argc, char **argv)
 	} else if (state.do_installed) {
 		tree_ctx *t = tree_new(portroot, portvdb, TREETYPE_VDB, false);
 		if (t != NULL) {
+			tree_set_keys(t, QUSE_KEYS);
 			state.overlay = NULL;
 			state.repo = NULL;
 			if (tree_foreach_pkg_sorted(t, quse_results_cb,
 						&state, state.match) > 0)
 				ret = EXIT_SUCCESS;
 			tree_close(t);
+			state.lastval = NULL;
 		}
 	} else {
 		array_for_each(overlays, n, overlay) {
 			tree_ctx *t = tree_new(portroot, overlay, TREETYPE_EBUILD, false);
 			state.overlay = overlay;
 			if (t != NULL) {
+				tree_set_keys(t, QUSE_KEYS);
 				state.repo =
 					state.need_full_atom ? tree_get_repo_name(t) : NULL;
 				if (tree_foreach_pkg_sorted(t, quse_results_cb,
 							&state, state.match) > 0)
 					ret = EXIT_SUCCESS;
 				tree_close(t);
+				/* the interned strings died with the tree */
+				state.lastval = NULL;
 			}
 		}
 	}
@@ -770,6 +788,7 @@ int quse_main(int argc, char **argv)
 
 	if (state.match != NULL)
 		atom_implode(state.match);
+	free(state.lastbuf);
 
 	return ret;
 }
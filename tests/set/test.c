@@ -0,0 +1,212 @@
+/*
+ * Copyright 2026 Gentoo Foundation
+ * Distributed under the terms of the GNU General Public License v2
+ */
+
+#include "main.h"
+#include "set.h"
+#include "array.h"
+#include "xalloc.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+const char *argv0;
+FILE *warnout;
+
+#define KEY(B,I)  (snprintf(B, sizeof(B), "cat-%zu/pkg-%zu", (I) % 97, (I)), B)
+
+/* array_filter callback, keeps the keys with an odd pkg number */
+static bool keep_odd(void *elem, void *priv)
+{
+	size_t *seen = priv;
+
+	(*seen)++;
+	return strtoul(strrchr(elem, '-') + 1, NULL, 10) % 2 == 1;
+}
+
+/* array_merge comparator, orders on the key strings */
+static int key_compar(const void *l, const void *r)
+{
+	return strcmp(*(const char **)l, *(const char **)r);
+}
+
+static void testone(size_t n)
+{
+	char buf[64];
+	set_t *s = NULL;
+	hash_t *h = NULL;
+	iset_t *is;
+	array *a;
+	array *b;
+	char *cp;
+	const char *k;
+	void *prev;
+	bool uniq;
+	bool removed;
+	size_t seen;
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		s = set_add_unique(s, KEY(buf, i), NULL);
+	assert(set_size(s) == n);
+
+	/* keys are copied and stay put across growth */
+	k = set_get(s, KEY(buf, 0));
+	assert(k != NULL && k != buf && strcmp(k, buf) == 0);
+	for (i = 0; i < n; i++)
+		s = set_add_unique(s, KEY(buf, i), &uniq);
+	assert(!uniq);
+	assert(set_size(s) == n);
+	assert(set_get(s, KEY(buf, 0)) == k);
+
+	/* duplicates are allowed with set_add */
+	s = set_add(s, KEY(buf, 1));
+	assert(set_size(s) == n + 1);
+	set_delete(s, buf, &removed);
+	assert(removed);
+	assert(set_get(s, buf) != NULL);
+
+	/* removal must not break probing for whatever follows */
+	for (i = 0; i < n; i += 2) {
+		set_delete(s, KEY(buf, i), &removed);
+		assert(removed);
+	}
+	set_delete(s, KEY(buf, 0), &removed);
+	assert(!removed);
+	for (i = 0; i < n; i++)
+		assert((set_get(s, KEY(buf, i)) != NULL) == (i % 2 == 1));
+	assert(set_size(s) == n / 2);
+
+	set_clear(s);
+	assert(set_size(s) == 0);
+	assert(set_get(s, KEY(buf, 1)) == NULL);
+	s = set_add_from_string(s, " a b\ta  c ");
+	assert(set_size(s) == 3);
+	set_free(s);
+
+	for (i = 0; i < n; i++)
+		h = hash_add(h, KEY(buf, i), (void *)(i + 1), NULL);
+	h = hash_add(h, KEY(buf, 3), (void *)1, &prev);
+	assert(prev == (void *)4);
+	assert(hash_get(h, buf) == (void *)1);
+	assert(hash_size(h) == n);
+	a = hash_keys(h);
+	assert(array_cnt(a) == n);
+	seen = 0;
+	assert(array_filter(a, keep_odd, &seen) == n - n / 2);
+	assert(seen == n);
+	assert(array_cnt(a) == n / 2);
+	array_for_each(a, i, k)
+		assert(keep_odd((void *)k, &seen));
+
+	/* merging the sorted odd keys with the sorted full set keeps the
+	 * order, and on equal keys those from the destination go first */
+	cp = xmalloc(n * sizeof(buf));
+	b = array_new();
+	for (i = 0; i < n; i++)
+		array_append(b, strcpy(cp + i * sizeof(buf), KEY(buf, i)));
+	array_sort(a, key_compar);
+	array_sort(b, key_compar);
+	array_merge(b, a, key_compar);
+	assert(array_cnt(a) == 0);
+	assert(array_cnt(b) == n + n / 2);
+	prev = NULL;
+	array_for_each(b, i, k) {
+		assert(prev == NULL || strcmp(prev, k) <= 0);
+		if (prev != NULL && strcmp(prev, k) == 0)
+			assert((char *)prev >= cp && (char *)prev < cp + n * sizeof(buf) &&
+				   (k < cp || k >= cp + n * sizeof(buf)));
+		prev = (void *)k;
+	}
+	array_free(b);
+	free(cp);
+	array_free(a);
+	for (i = 0; i < n; i++) {
+		prev = hash_delete_chk(h, KEY(buf, i), &removed);
+		assert(removed);
+		assert(i == 3 ? prev == (void *)1 : prev == (void *)(i + 1));
+	}
+	assert(hash_size(h) == 0);
+	hash_free(h);
+
+	is = NULL;
+	for (i = 0; i < n; i++)
+		is = iset_add_unique(is, i % 3, i, NULL);
+	is = iset_add_unique(is, 1, 1, &uniq);
+	assert(!uniq);
+	is = iset_add_unique(is, 0, 1, &uniq);
+	assert(uniq);
+	assert(iset_size(is) == n + 1);
+	for (i = 0; i < n; i++)
+		assert(iset_contains(is, i % 3, i));
+	assert(!iset_contains(is, 0, n));
+	is = ihash_add(is, 2, 2, buf, &prev);
+	assert(prev == NULL && ihash_get(is, 2, 2) == buf);
+	iset_free(is);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* not run as part of the tests, invoke as m -b to compare the set
+ * implementation against itself over time */
+static void bench(size_t n)
+{
+	char buf[64];
+	hash_t *h = NULL;
+	double t;
+	size_t i;
+	size_t hit = 0;
+
+	t = now();
+	for (i = 0; i < n; i++)
+		h = hash_add(h, KEY(buf, i), (void *)i, NULL);
+	printf("%8zu insert: %6.1f ns/op\n", n, (now() - t) * 1e9 / n);
+
+	t = now();
+	for (i = 0; i < n; i++)
+		hit += set_get(h, KEY(buf, i)) != NULL;
+	printf("%8zu hit:    %6.1f ns/op\n", n, (now() - t) * 1e9 / n);
+
+	t = now();
+	for (i = n; i < 2 * n; i++)
+		hit += set_get(h, KEY(buf, i)) != NULL;
+	printf("%8zu miss:   %6.1f ns/op\n", n, (now() - t) * 1e9 / n);
+	assert(hit == n);
+
+	t = now();
+	for (i = 0; i < n; i++)
+		hash_delete(h, KEY(buf, i));
+	printf("%8zu delete: %6.1f ns/op\n", n, (now() - t) * 1e9 / n);
+
+	hash_free(h);
+}
+
+int main(int argc, char *argv[])
+{
+	size_t n;
+
+	argv0 = argv[0];
+	warnout = stderr;
+
+	if (argc > 1 && strcmp(argv[1], "-b") == 0) {
+		for (n = 1000; n <= 1000000; n *= 10)
+			bench(n);
+		return 0;
+	}
+
+	for (n = 8; n < 40; n++)
+		testone(n);
+	testone(1000);
+	testone(100000);
+
+	return 0;
+}